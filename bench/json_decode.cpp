@@ -0,0 +1,155 @@
+/**
+ * @file json_decode.cpp
+ * @brief Compares decoding recorded GitLab responses by building a rapidjson DOM (as gitlabapi.cpp used to) with the
+ * in-place SAX decoders of gitlabjson.hpp. Unlike the other benchmarks, this one does not need a running daemon.
+ *
+ * Usage: bench_json_decode [payload directory] [iterations]
+ *
+ * The entries of each recorded payload are repeated to fill a page of 100 entries, the page size the daemon requests.
+ */
+
+#include <gitlabjson.hpp>
+
+#include <rapidjson/document.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::size_t PageSize = 100;
+
+/** @return the recorded array's entries repeated to PageSize entries **/
+static std::string loadPage(const std::filesystem::path& path) {
+	std::ifstream file(path);
+	std::string recorded{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	rapidjson::Document json;
+	json.Parse(recorded.c_str());
+	if (json.HasParseError() || !json.IsArray() || json.Empty())
+		return {};
+	auto first = recorded.find('['), last = recorded.rfind(']');
+	auto entries = recorded.substr(first + 1, last - first - 1);
+	std::string page = "[";
+	for (std::size_t count = 0; count < PageSize; count += json.Size())
+		page += (count == 0 ? "" : ",") + entries;
+	return page + "]";
+}
+
+/**
+ * @brief Decodes the page iterations times and prints the timings.
+ * @param decode Decodes a copy of the page and returns the number of decoded entries
+ */
+static void measure(
+		const char* name, const std::string& page, unsigned iterations,
+		const std::function<std::size_t(std::string)>& decode
+) {
+	std::vector<Clock::duration> samples;
+	samples.reserve(iterations);
+	std::size_t entries = 0;
+	for (unsigned i = 0; i < iterations; ++i) {
+		auto start = Clock::now();
+		entries = decode(page);
+		samples.push_back(Clock::now() - start);
+	}
+	std::ranges::sort(samples);
+	auto ns = [](Clock::duration duration) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	};
+	Clock::duration total{};
+	for (auto sample : samples)
+		total += sample;
+	auto mean = ns(total) / samples.size();
+	std::cout << "  " << name << ": " << entries << " entries, mean " << mean << " ns, p50 "
+			  << ns(samples[samples.size() / 2]) << " ns, p99 " << ns(samples[samples.size() * 99 / 100]) << " ns, "
+			  << (mean > 0 ? page.size() * 1000 / mean : 0) << " MB/s" << std::endl;
+}
+
+template <typename T>
+static std::size_t count(const std::expected<std::vector<T>, Error>& decoded) {
+	return decoded.has_value() ? decoded->size() : 0;
+}
+
+/** What gitlabapi.cpp did before: Parse into a DOM, then pick the fields **/
+template <typename F>
+static std::size_t viaDOM(const std::string& body, F&& pick) {
+	rapidjson::Document json;
+	json.Parse(body.c_str());
+	if (json.HasParseError() || !json.IsArray())
+		return 0;
+	std::size_t picked = 0;
+	for (const auto& entry : json.GetArray())
+		picked += pick(entry);
+	return picked;
+}
+
+int main(int argc, char* argv[]) {
+	std::filesystem::path payloads = argc > 1 ? argv[1] : NSSGITLAB_BENCH_PAYLOADS;
+	unsigned iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000;
+	struct Benchmark {
+		const char* file;
+		std::function<std::size_t(std::string)> dom;
+		std::function<std::size_t(std::string)> sax;
+	};
+	std::vector<Benchmark> benchmarks{
+			{"users.json",
+			 [](std::string body) {
+				 return viaDOM(body, [](const rapidjson::Value& user) {
+					 gitlab::User parsed{
+							 .id = user["id"].Get<gitlab::UserID>(),
+							 .username = user["username"].GetString(),
+							 .name = user["name"].GetString()
+					 };
+					 return !parsed.username.empty();
+				 });
+			 },
+			 [](std::string body) { return count(gitlab::json::parseUsers(std::move(body))); }},
+			{"memberships.json",
+			 [](std::string body) {
+				 return viaDOM(body, [](const rapidjson::Value& group) {
+					 gitlab::Group parsed{
+							 .id = group["source_id"].Get<gitlab::GroupID>(), .name = group["source_name"].GetString()
+					 };
+					 return !parsed.name.empty();
+				 });
+			 },
+			 [](std::string body) { return count(gitlab::json::parseMemberships(std::move(body))); }},
+			{"keys.json",
+			 [](std::string body) {
+				 return viaDOM(body, [](const rapidjson::Value& key) {
+					 if (key["usage_type"] != "auth_and_signing")
+						 return false;
+					 std::string parsed = key["key"].GetString();
+					 return !parsed.empty();
+				 });
+			 },
+			 [](std::string body) { return count(gitlab::json::parseKeys(std::move(body))); }},
+			{"members.json",
+			 [](std::string body) {
+				 return viaDOM(body, [](const rapidjson::Value& member) {
+					 std::string parsed = member["username"].GetString();
+					 return !parsed.empty();
+				 });
+			 },
+			 [](std::string body) { return count(gitlab::json::parseUsernames(std::move(body))); }},
+	};
+	for (const auto& benchmark : benchmarks) {
+		auto page = loadPage(payloads / benchmark.file);
+		if (page.empty()) {
+			std::cerr << "Cannot read a JSON array from " << (payloads / benchmark.file).string() << std::endl;
+			return -1;
+		}
+		std::cout << benchmark.file << " (" << page.size() << " bytes):" << std::endl;
+		// Both are handed a copy of the page, like a response body that is moved out of the response
+		measure("DOM", page, iterations, benchmark.dom);
+		measure("SAX in place", page, iterations, benchmark.sax);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,282 @@
+/**
+ * @file load.cpp
+ * @brief Drives a running daemon with lookups of the synthetic users and groups of bench_mock_gitlab from many threads
+ * and reports the throughput and latency percentiles per kind of lookup.
+ *
+ * Usage: bench_load [options]
+ *   --mode rpc|nss     asks the daemon over RPC or calls the NSS module's _nss_gitlab_* functions (rpc)
+ *   --library PATH     the NSS module to load in nss mode (libnss_gitlab.so.2)
+ *   --threads N        the number of client threads (the number of CPU cores)
+ *   --seconds N        how long to keep up the load (10)
+ *   --users N          the lookups pick among user1 to userN (10000)
+ *   --groups N         the lookups pick among the groups with the IDs 1 to N (1000)
+ *   --uid-offset N     the uid_offset of the NSS module's config (0)
+ *   --gid-offset N     the gid_offset of the NSS module's config (0)
+ *
+ * Each thread cycles through a lookup by username, by user ID and by group ID with keys picked uniformly at random,
+ * which mirrors getpwnam(), getpwuid() and getgrgid(). In nss mode, the module is called directly such that it does
+ * not need to be configured in /etc/nsswitch.conf.
+ */
+
+#include <error.hpp>
+#include <rpcclient.hpp>
+
+#include <dlfcn.h>
+#include <grp.h>
+#include <nss.h>
+#include <pwd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+	bool nss = false;
+	std::string library = "libnss_gitlab.so.2";
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	unsigned seconds = 10;
+	unsigned users = 10000;
+	unsigned groups = 1000;
+	unsigned uidOffset = 0;
+	unsigned gidOffset = 0;
+};
+
+static std::optional<Options> parseOptions(int argc, char* argv[]) {
+	static const option Long[] = {
+			{"mode", required_argument, nullptr, 'm'},
+			{"library", required_argument, nullptr, 'l'},
+			{"threads", required_argument, nullptr, 't'},
+			{"seconds", required_argument, nullptr, 's'},
+			{"users", required_argument, nullptr, 'u'},
+			{"groups", required_argument, nullptr, 'g'},
+			{"uid-offset", required_argument, nullptr, 'U'},
+			{"gid-offset", required_argument, nullptr, 'G'},
+			{nullptr, 0, nullptr, 0}
+	};
+	Options options;
+	for (int opt; (opt = getopt_long(argc, argv, "", Long, nullptr)) != -1;) {
+		auto number = [] { return static_cast<unsigned>(std::strtoul(optarg, nullptr, 10)); };
+		switch (opt) {
+		case 'm':
+			if (optarg != std::string{"rpc"} && optarg != std::string{"nss"})
+				return std::nullopt;
+			options.nss = optarg == std::string{"nss"};
+			break;
+		case 'l':
+			options.library = optarg;
+			break;
+		case 't':
+			options.threads = std::max(number(), 1u);
+			break;
+		case 's':
+			options.seconds = std::max(number(), 1u);
+			break;
+		case 'u':
+			options.users = std::max(number(), 1u);
+			break;
+		case 'g':
+			options.groups = std::max(number(), 1u);
+			break;
+		case 'U':
+			options.uidOffset = number();
+			break;
+		case 'G':
+			options.gidOffset = number();
+			break;
+		default:
+			return std::nullopt;
+		}
+	}
+	return options;
+}
+
+enum class Outcome { Found, NotFound, Failed };
+
+/** The kinds of lookups, which the threads cycle through **/
+enum Kind { ByName, ByUID, ByGID, Kinds };
+static constexpr std::array<const char*, Kinds> KindNames{"getpwnam", "getpwuid", "getgrgid"};
+
+/** Looks up a user by name, a user by ID or a group by ID given the key **/
+using Lookup = std::function<Outcome(Kind kind, unsigned key)>;
+
+static Outcome outcome(Error error) {
+	return error == Error::Ok ? Outcome::Found : error == Error::NotFound ? Outcome::NotFound : Outcome::Failed;
+}
+
+static Lookup rpcLookup() {
+	return [](Kind kind, unsigned key) {
+		std::optional<Error> error;
+		switch (kind) {
+		case ByName: {
+			auto username = "user" + std::to_string(key);
+			auto response = callDaemon([&username](GitLabDaemon::Client& daemon) {
+				auto request = daemon.getUserByNameRequest();
+				request.setName(username.c_str());
+				return request.send();
+			});
+			if (response)
+				error = static_cast<Error>(response->getErrcode());
+			break;
+		}
+		case ByUID: {
+			auto response = callDaemon([key](GitLabDaemon::Client& daemon) {
+				auto request = daemon.getUserByIDRequest();
+				request.setId(key);
+				return request.send();
+			});
+			if (response)
+				error = static_cast<Error>(response->getErrcode());
+			break;
+		}
+		default: {
+			auto response = callDaemon([key](GitLabDaemon::Client& daemon) {
+				auto request = daemon.getGroupByIDRequest();
+				request.setId(key);
+				return request.send();
+			});
+			if (response)
+				error = static_cast<Error>(response->getErrcode());
+			break;
+		}
+		}
+		return error ? outcome(*error) : Outcome::Failed;
+	};
+}
+
+using GetPwNam = nss_status (*)(const char*, passwd*, char*, size_t, int*);
+using GetPwUID = nss_status (*)(uid_t, passwd*, char*, size_t, int*);
+using GetGrGID = nss_status (*)(gid_t, group*, char*, size_t, int*);
+
+/** @return the lookups through the NSS module or std::nullopt if it cannot be loaded **/
+static std::optional<Lookup> nssLookup(const Options& options) {
+	auto* module = dlopen(options.library.c_str(), RTLD_NOW);
+	if (!module) {
+		std::cerr << "Loading " << options.library << " failed: " << dlerror() << std::endl;
+		return std::nullopt;
+	}
+	auto getpwnam = reinterpret_cast<GetPwNam>(dlsym(module, "_nss_gitlab_getpwnam_r"));
+	auto getpwuid = reinterpret_cast<GetPwUID>(dlsym(module, "_nss_gitlab_getpwuid_r"));
+	auto getgrgid = reinterpret_cast<GetGrGID>(dlsym(module, "_nss_gitlab_getgrgid_r"));
+	if (!getpwnam || !getpwuid || !getgrgid) {
+		std::cerr << options.library << " lacks the _nss_gitlab_* functions" << std::endl;
+		return std::nullopt;
+	}
+	return [&options, getpwnam, getpwuid, getgrgid](Kind kind, unsigned key) {
+		// Large enough for the members of any synthetic group
+		thread_local std::vector<char> buffer(1 << 20);
+		int errnop = 0;
+		nss_status status;
+		if (kind == ByName) {
+			passwd pwd;
+			auto username = "user" + std::to_string(key);
+			status = getpwnam(username.c_str(), &pwd, buffer.data(), buffer.size(), &errnop);
+		} else if (kind == ByUID) {
+			passwd pwd;
+			status = getpwuid(key + options.uidOffset, &pwd, buffer.data(), buffer.size(), &errnop);
+		} else {
+			group grp;
+			status = getgrgid(key + options.gidOffset, &grp, buffer.data(), buffer.size(), &errnop);
+		}
+		return status == NSS_STATUS_SUCCESS    ? Outcome::Found
+			   : status == NSS_STATUS_NOTFOUND ? Outcome::NotFound
+											   : Outcome::Failed;
+	};
+}
+
+struct Samples {
+	std::array<std::vector<Clock::duration>, Kinds> latencies;
+	std::array<std::size_t, Kinds> notFound{};
+	std::array<std::size_t, Kinds> failed{};
+};
+
+static Samples run(const Options& options, const Lookup& lookup) {
+	std::vector<Samples> perThread(options.threads);
+	std::atomic<bool> stop = false;
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < options.threads; ++i)
+		threads.emplace_back([&options, &lookup, &stop, &samples = perThread[i], i]() {
+			std::mt19937 random{i};
+			std::uniform_int_distribution<unsigned> user{1, options.users}, group{1, options.groups};
+			for (unsigned n = 0; !stop.load(std::memory_order_relaxed); ++n) {
+				auto kind = static_cast<Kind>(n % Kinds);
+				auto key = kind == ByGID ? group(random) : user(random);
+				auto start = Clock::now();
+				auto result = lookup(kind, key);
+				samples.latencies[kind].push_back(Clock::now() - start);
+				if (result == Outcome::NotFound)
+					++samples.notFound[kind];
+				else if (result == Outcome::Failed)
+					++samples.failed[kind];
+			}
+		});
+	std::this_thread::sleep_for(std::chrono::seconds{options.seconds});
+	stop = true;
+	for (auto& thread : threads)
+		thread.join();
+	Samples merged;
+	for (auto& samples : perThread)
+		for (int kind = 0; kind < Kinds; ++kind) {
+			std::ranges::move(samples.latencies[kind], std::back_inserter(merged.latencies[kind]));
+			merged.notFound[kind] += samples.notFound[kind];
+			merged.failed[kind] += samples.failed[kind];
+		}
+	return merged;
+}
+
+static void report(
+		const char* name, std::vector<Clock::duration>& latencies, std::size_t notFound, std::size_t failed,
+		unsigned seconds
+) {
+	if (latencies.empty()) {
+		std::cout << name << ": no lookups" << std::endl;
+		return;
+	}
+	std::ranges::sort(latencies);
+	auto us = [&latencies](double quantile) {
+		auto index = std::min(static_cast<std::size_t>(quantile * latencies.size()), latencies.size() - 1);
+		return std::chrono::duration<double, std::micro>(latencies[index]).count();
+	};
+	std::cout << name << ": " << latencies.size() / seconds << " lookups/s, p50 " << us(0.5) << " us, p99 " << us(0.99)
+			  << " us, p999 " << us(0.999) << " us, " << notFound << " not found, " << failed << " failed" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	auto options = parseOptions(argc, argv);
+	if (!options) {
+		std::cerr << "Usage: " << argv[0] << " [--mode rpc|nss] [--library PATH] [--threads N] [--seconds N] "
+				  << "[--users N] [--groups N] [--uid-offset N] [--gid-offset N]" << std::endl;
+		return -1;
+	}
+	auto lookup = options->nss ? nssLookup(*options) : std::optional{rpcLookup()};
+	if (!lookup)
+		return -2;
+	std::cout << (options->nss ? "NSS module" : "RPC") << ", " << options->threads << " threads, "
+			  << options->seconds << " s" << std::endl;
+	auto samples = run(*options, *lookup);
+	std::vector<Clock::duration> all;
+	std::size_t notFound = 0, failed = 0;
+	for (int kind = 0; kind < Kinds; ++kind) {
+		report(
+				KindNames[kind], samples.latencies[kind], samples.notFound[kind], samples.failed[kind],
+				options->seconds
+		);
+		all.insert(all.end(), samples.latencies[kind].begin(), samples.latencies[kind].end());
+		notFound += samples.notFound[kind];
+		failed += samples.failed[kind];
+	}
+	report("all", all, notFound, failed, options->seconds);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#!/usr/bin/env bash
+# Runs gitlabnssd against bench_mock_gitlab and drives it with bench_load, first over RPC and then through the NSS
+# module. Started by the loadtest target; run it as root on a machine without a running gitlabnssd since the daemon's
+# socket path (/var/run/gitlabnss.sock) is fixed for its clients.
+#
+# Usage: loadtest.sh <gitlabnssd> <bench_mock_gitlab> <bench_load> <libnss_gitlab.so> <bench_rpc_fork>
+#
+# The environment variables MOCK_USERS, MOCK_GROUPS, MOCK_LATENCY (ms), MOCK_JITTER (ms), MOCK_ERROR_RATE, MOCK_PER_PAGE
+# and MOCK_PORT tune the mock, LOAD_THREADS and LOAD_SECONDS the load.
+set -euo pipefail
+
+if [[ $# -ne 5 ]]; then
+	echo "Usage: $0 <gitlabnssd> <bench_mock_gitlab> <bench_load> <libnss_gitlab.so> <bench_rpc_fork>" >&2
+	exit 1
+fi
+daemon=$1 mock=$2 load=$3 module=$4 fork=$5
+users=${MOCK_USERS:-10000} groups=${MOCK_GROUPS:-1000} port=${MOCK_PORT:-18080}
+threads=${LOAD_THREADS:-$(nproc)} seconds=${LOAD_SECONDS:-10}
+socket=/var/run/gitlabnss.sock
+
+if [[ $EUID -ne 0 ]]; then
+	echo "The load test has to run as root since the daemon binds $socket" >&2
+	exit 1
+fi
+if [[ -e $socket ]]; then
+	echo "$socket exists; stop the running gitlabnssd first" >&2
+	exit 1
+fi
+
+workdir=$(mktemp -d)
+mock_pid=
+cleanup() {
+	if [[ -f /run/gitlabnssd.pid ]]; then
+		kill -INT "$(cat /run/gitlabnssd.pid)" 2>/dev/null || true
+		for _ in $(seq 50); do [[ -e $socket ]] || break; sleep 0.1; done
+	fi
+	[[ -n $mock_pid ]] && kill -INT "$mock_pid" 2>/dev/null && wait "$mock_pid" || true
+	rm -rf "$workdir"
+}
+trap cleanup EXIT
+
+# The NSS module reads its offsets from the installed config
+config=/etc/gitlabnss/gitlabnss.conf
+uid_offset=$(sed -n 's/^uid_offset *= *\([0-9]*\).*/\1/p' "$config" 2>/dev/null | head -n1)
+gid_offset=$(sed -n 's/^gid_offset *= *\([0-9]*\).*/\1/p' "$config" 2>/dev/null | head -n1)
+
+echo "bench-token" > "$workdir/secret.txt"
+cat > "$workdir/gitlabnss.conf" <<EOF
+[general]
+socket_path = "$socket"
+socket_permissions = 0o666
+threads = 0
+
+[gitlabapi]
+base_url = "http://127.0.0.1:$port/api/v4"
+secret = "$workdir/secret.txt"
+http2 = false
+rate_limit = 0
+
+[sync]
+enabled = false
+
+[shared_table]
+enabled = false
+
+[checkpoint]
+enabled = false
+
+[nss]
+provision_homes = false
+uid_offset = ${uid_offset:-0}
+gid_offset = ${gid_offset:-0}
+EOF
+
+"$mock" --port "$port" --users "$users" --groups "$groups" --latency "${MOCK_LATENCY:-20}" \
+	--jitter "${MOCK_JITTER:-10}" --error-rate "${MOCK_ERROR_RATE:-0}" --max-per-page "${MOCK_PER_PAGE:-100}" &
+mock_pid=$!
+for _ in $(seq 50); do (echo > "/dev/tcp/127.0.0.1/$port") 2>/dev/null && break; sleep 0.1; done
+
+"$daemon" "$workdir/gitlabnss.conf"
+for _ in $(seq 100); do [[ -S $socket ]] && break; sleep 0.1; done
+if [[ ! -S $socket ]]; then
+	echo "gitlabnssd did not come up; see /var/log/gitlabnss.log" >&2
+	exit 1
+fi
+
+common=(--threads "$threads" --seconds "$seconds" --users "$users" --groups "$groups")
+echo "== Cold caches"
+"$load" --mode rpc "${common[@]}"
+echo "== Warm caches"
+"$load" --mode rpc "${common[@]}"
+echo "== Through the NSS module"
+"$load" --mode nss --library "$module" --uid-offset "${uid_offset:-0}" --gid-offset "${gid_offset:-0}" "${common[@]}"
+echo "== Lookups after fork()"
+"$fork" user1
\ No newline at end of file
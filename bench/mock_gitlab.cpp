@@ -0,0 +1,512 @@
+/**
+ * @file mock_gitlab.cpp
+ * @brief A local stand-in for GitLab's REST API that serves a synthetic directory such that the daemon can be load
+ * tested without a GitLab instance (see loadtest.sh).
+ *
+ * Usage: bench_mock_gitlab [options]
+ *   --port N             the port on 127.0.0.1 to listen on (8080)
+ *   --users N            the users user1 to userN with the IDs 1 to N (10000)
+ *   --groups N           the groups group1 to groupN with the IDs 1 to N (1000)
+ *   --memberships N      the number of groups of each user (5)
+ *   --keys N             the number of SSH keys of each user (2)
+ *   --latency MS         added to every response (0)
+ *   --jitter MS          at most this much is added to the latency at random (0)
+ *   --error-rate P       the fraction of requests answered with 500 Internal Server Error (0)
+ *   --rate-limit-rate P  the fraction of requests answered with 429 Too Many Requests and Retry-After: 1 (0)
+ *   --max-per-page N     the largest page size served, which is 100 on GitLab (100)
+ *   --no-totals          leaves out X-Total and X-Total-Pages like GitLab does for listings of over 10000 entries
+ *
+ * Serves users/:id, users?username=, users/:id_or_username/keys, keys?fingerprint=, users/:id/memberships,
+ * groups/:id, groups?search=, groups/:id/members and the listings of all users and groups below /api/v4. Listings are
+ * paginated with page and per_page like GitLab does. Connections are kept alive. Once interrupted, it prints how many
+ * requests it answered.
+ */
+
+#include <sshkeys.hpp>
+
+#include <kj/async-io.h>
+#include <kj/async-unix.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <csignal>
+#include <cstdlib>
+#include <format>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** Requests whose header does not end within this many bytes are dropped **/
+static constexpr std::size_t MaxHeader = 16384;
+/** GitLab's page size if per_page is not given **/
+static constexpr std::size_t DefaultPerPage = 20;
+
+struct Options {
+	unsigned port = 8080;
+	unsigned users = 10000;
+	unsigned groups = 1000;
+	unsigned memberships = 5;
+	unsigned keys = 2;
+	unsigned latency = 0;
+	unsigned jitter = 0;
+	double errorRate = 0;
+	double rateLimitRate = 0;
+	unsigned maxPerPage = 100;
+	bool totals = true;
+};
+
+static std::optional<Options> parseOptions(int argc, char* argv[]) {
+	static const option Long[] = {
+			{"port", required_argument, nullptr, 'p'},
+			{"users", required_argument, nullptr, 'u'},
+			{"groups", required_argument, nullptr, 'g'},
+			{"memberships", required_argument, nullptr, 'm'},
+			{"keys", required_argument, nullptr, 'k'},
+			{"latency", required_argument, nullptr, 'l'},
+			{"jitter", required_argument, nullptr, 'j'},
+			{"error-rate", required_argument, nullptr, 'e'},
+			{"rate-limit-rate", required_argument, nullptr, 'r'},
+			{"max-per-page", required_argument, nullptr, 'n'},
+			{"no-totals", no_argument, nullptr, 't'},
+			{nullptr, 0, nullptr, 0}
+	};
+	Options options;
+	for (int opt; (opt = getopt_long(argc, argv, "", Long, nullptr)) != -1;) {
+		auto number = [] { return static_cast<unsigned>(std::strtoul(optarg, nullptr, 10)); };
+		switch (opt) {
+		case 'p':
+			options.port = number();
+			break;
+		case 'u':
+			options.users = number();
+			break;
+		case 'g':
+			options.groups = std::max(number(), 1u);
+			break;
+		case 'm':
+			options.memberships = number();
+			break;
+		case 'k':
+			options.keys = number();
+			break;
+		case 'l':
+			options.latency = number();
+			break;
+		case 'j':
+			options.jitter = number();
+			break;
+		case 'e':
+			options.errorRate = std::strtod(optarg, nullptr);
+			break;
+		case 'r':
+			options.rateLimitRate = std::strtod(optarg, nullptr);
+			break;
+		case 'n':
+			options.maxPerPage = std::max(number(), 1u);
+			break;
+		case 't':
+			options.totals = false;
+			break;
+		default:
+			return std::nullopt;
+		}
+	}
+	options.memberships = std::min(options.memberships, options.groups);
+	return options;
+}
+
+static std::optional<unsigned> parseNumber(std::string_view text) {
+	unsigned value;
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (error != std::errc{} || end != text.data() + text.size())
+		return std::nullopt;
+	return value;
+}
+
+/** @return text with %XX sequences decoded **/
+static std::string percentDecode(std::string_view text) {
+	std::string decoded;
+	for (std::size_t i = 0; i < text.size(); ++i) {
+		unsigned char byte;
+		auto digits = text.substr(std::min(i + 1, text.size()), 2);
+		if (text[i] == '%' && digits.size() == 2 &&
+			std::from_chars(digits.data(), digits.data() + 2, byte, 16).ptr == digits.data() + 2) {
+			decoded += static_cast<char>(byte);
+			i += 2;
+		} else {
+			decoded += text[i];
+		}
+	}
+	return decoded;
+}
+
+/** @return the ID in name if it is prefix followed by a number, e.g. 42 for user42 **/
+static std::optional<unsigned> idOf(std::string_view name, std::string_view prefix) {
+	if (!name.starts_with(prefix))
+		return std::nullopt;
+	return parseNumber(name.substr(prefix.size()));
+}
+
+/**
+ * @brief The synthetic users and groups. User u is a member of the groups (u + i * stride) % groups + 1 for i below
+ * the number of memberships, which spreads the members evenly over the groups.
+ */
+class Directory final {
+private:
+	const Options& options;
+	/** The user and the index of each key by its fingerprint **/
+	std::unordered_map<std::string, std::pair<unsigned, unsigned>> fingerprints;
+
+	unsigned stride() const noexcept { return std::max(options.groups / std::max(options.memberships, 1u), 1u); }
+
+public:
+	explicit Directory(const Options& options) : options(options) {
+		for (unsigned user = 1; user <= options.users; ++user)
+			for (unsigned index = 0; index < options.keys; ++index)
+				fingerprints.emplace(*sshkeys::fingerprint(publicKey(user, index)), std::pair{user, index});
+	}
+
+	bool hasUser(unsigned id) const noexcept { return id >= 1 && id <= options.users; }
+	bool hasGroup(unsigned id) const noexcept { return id >= 1 && id <= options.groups; }
+
+	std::vector<unsigned> groupsOf(unsigned user) const {
+		std::vector<unsigned> groups;
+		for (unsigned i = 0; i < options.memberships; ++i)
+			groups.push_back((user + i * stride()) % options.groups + 1);
+		return groups;
+	}
+
+	std::vector<unsigned> membersOf(unsigned group) const {
+		std::vector<unsigned> members;
+		for (unsigned i = 0; i < options.memberships; ++i) {
+			// The users with user + i * stride = group - 1 modulo the number of groups
+			auto offset = (i * static_cast<uint64_t>(stride())) % options.groups;
+			auto first = (group - 1 + options.groups - offset) % options.groups;
+			for (uint64_t user = first == 0 ? options.groups : first; user <= options.users; user += options.groups)
+				members.push_back(static_cast<unsigned>(user));
+		}
+		std::ranges::sort(members);
+		return members;
+	}
+
+	static std::string user(unsigned id) {
+		return std::format(R"({{"id":{},"username":"user{}","name":"User {}","state":"active"}})", id, id, id);
+	}
+	static std::string member(unsigned id) {
+		return std::format(
+				R"({{"id":{},"username":"user{}","name":"User {}","state":"active","access_level":30}})", id, id, id
+		);
+	}
+	static std::string group(unsigned id) {
+		return std::format(R"({{"id":{},"name":"group{}","path":"group{}","full_path":"group{}"}})", id, id, id, id);
+	}
+	static std::string membership(unsigned group) {
+		return std::format(
+				R"({{"source_id":{},"source_name":"group{}","source_type":"Namespace","access_level":30}})", group,
+				group
+		);
+	}
+	/** @return the key and the user it belongs to if it is one of the users' keys **/
+	std::optional<std::pair<unsigned, unsigned>> keyOf(const std::string& fingerprint) const {
+		auto found = fingerprints.find(fingerprint);
+		return found != fingerprints.end() ? std::optional{found->second} : std::nullopt;
+	}
+
+	static std::string publicKey(unsigned user, unsigned index) {
+		return std::format("ssh-ed25519 AAAAC3NzaC1lZDI1NTE5AAAAI{:0>43} user{}@bench", user * 100 + index, user);
+	}
+	static std::string key(unsigned user, unsigned index) {
+		return std::format(
+				R"({{"id":{},"title":"key {}","key":"{}","usage_type":"auth_and_signing","expires_at":null}})",
+				user * 100 + index, index, publicKey(user, index)
+		);
+	}
+	/** A key as GitLab returns it when looked up by fingerprint **/
+	static std::string ownedKey(unsigned user, unsigned index) {
+		auto json = key(user, index);
+		json.pop_back();
+		return json + R"(,"user":)" + Directory::user(user) + "}";
+	}
+};
+
+/** The request line and query of a GET request **/
+struct Request {
+	std::string_view method;
+	std::string_view path;
+	std::string_view host;
+	std::vector<std::pair<std::string_view, std::string_view>> query;
+
+	std::optional<std::string_view> parameter(std::string_view name) const {
+		auto found = std::ranges::find(query, name, &std::pair<std::string_view, std::string_view>::first);
+		return found != query.end() ? std::optional{found->second} : std::nullopt;
+	}
+};
+
+static Request parseRequest(std::string_view header) {
+	Request request;
+	auto line = header.substr(0, header.find("\r\n"));
+	request.method = line.substr(0, line.find(' '));
+	auto target = line.substr(std::min(line.find(' '), line.size()));
+	target = target.substr(target.find_first_not_of(' ') == std::string_view::npos ? target.size() : 1);
+	target = target.substr(0, target.find(' '));
+	request.path = target.substr(0, target.find('?'));
+	if (auto mark = target.find('?'); mark != std::string_view::npos) {
+		auto query = target.substr(mark + 1);
+		while (!query.empty()) {
+			auto parameter = query.substr(0, query.find('&'));
+			query.remove_prefix(std::min(parameter.size() + 1, query.size()));
+			auto equals = std::min(parameter.find('='), parameter.size());
+			auto value = parameter.substr(std::min(equals + 1, parameter.size()));
+			request.query.emplace_back(parameter.substr(0, equals), value);
+		}
+	}
+	for (auto field : {"\r\nHost: ", "\r\nhost: "})
+		if (auto at = header.find(field); at != std::string_view::npos) {
+			auto value = header.substr(at + std::string_view{field}.size());
+			request.host = value.substr(0, value.find("\r\n"));
+		}
+	return request;
+}
+
+static std::size_t contentLength(std::string_view header) {
+	for (auto field : {"\r\nContent-Length: ", "\r\ncontent-length: "})
+		if (auto at = header.find(field); at != std::string_view::npos) {
+			auto value = header.substr(at + std::string_view{field}.size());
+			return parseNumber(value.substr(0, value.find("\r\n"))).value_or(0);
+		}
+	return 0;
+}
+
+struct Response {
+	unsigned status;
+	std::string body;
+	std::string headers;
+
+	std::string str() const {
+		const char* reason = status == 200 ? "OK"
+						   : status == 404 ? "Not Found"
+						   : status == 429 ? "Too Many Requests"
+										   : "Internal Server Error";
+		return std::format(
+				"HTTP/1.1 {} {}\r\nContent-Type: application/json\r\nContent-Length: {}\r\n{}\r\n{}", status, reason,
+				body.size(), headers, body
+		);
+	}
+};
+
+static Response notFound() {
+	return Response{.status = 404, .body = R"({"message":"404 Not found"})", .headers = {}};
+}
+
+class Mock final : private kj::TaskSet::ErrorHandler {
+private:
+	/** The bytes read from a connection that were not answered yet **/
+	struct Buffered {
+		std::string data;
+		std::array<char, 4096> chunk;
+	};
+
+	const Options& options;
+	Directory directory;
+	kj::Timer& timer;
+	std::mt19937 random{42};
+	kj::TaskSet connections;
+
+	/**
+	 * @brief Answers a listing with the page that the request asks for.
+	 * @param entry returns the JSON of the i-th entry
+	 */
+	Response page(const Request& request, std::size_t total, const std::function<std::string(std::size_t)>& entry) {
+		auto perPage = std::clamp<std::size_t>(
+				parseNumber(request.parameter("per_page").value_or("")).value_or(DefaultPerPage), 1,
+				options.maxPerPage
+		);
+		std::size_t number = std::max(parseNumber(request.parameter("page").value_or("")).value_or(1), 1u);
+		std::size_t pages = std::max<std::size_t>((total + perPage - 1) / perPage, 1);
+		std::string body = "[";
+		for (auto i = (number - 1) * perPage; i < std::min(number * perPage, total); ++i)
+			body += (body.size() > 1 ? "," : "") + entry(i);
+		body += "]";
+		// The other parameters are kept in the links to the other pages
+		std::string base = std::format("http://{}{}?", request.host, request.path);
+		for (auto [name, value] : request.query)
+			if (name != "page" && name != "per_page")
+				base += std::format("{}={}&", name, value);
+		auto link = [&base, perPage](std::size_t page, const char* rel) {
+			return std::format("<{}page={}&per_page={}>; rel=\"{}\"", base, page, perPage, rel);
+		};
+		auto next = number < pages ? std::to_string(number + 1) : std::string{};
+		std::string links = link(1, "first");
+		if (number < pages)
+			links = link(number + 1, "next") + ", " + links;
+		std::string headers = std::format("X-Page: {}\r\nX-Per-Page: {}\r\nX-Next-Page: {}\r\n", number, perPage, next);
+		if (options.totals) {
+			headers += std::format("X-Total: {}\r\nX-Total-Pages: {}\r\n", total, pages);
+			links += ", " + link(pages, "last");
+		}
+		headers += std::format("Link: {}\r\n", links);
+		return Response{.status = 200, .body = std::move(body), .headers = std::move(headers)};
+	}
+
+	template <typename T>
+	Response list(const Request& request, const std::vector<T>& entries, std::string (*json)(T)) {
+		return page(request, entries.size(), [&entries, json](std::size_t i) { return json(entries[i]); });
+	}
+
+	Response route(const Request& request) {
+		if (request.method != "GET" || !request.path.starts_with("/api/v4/"))
+			return notFound();
+		std::vector<std::string_view> segments;
+		for (auto path = request.path.substr(8); !path.empty();) {
+			segments.push_back(path.substr(0, path.find('/')));
+			path.remove_prefix(std::min(segments.back().size() + 1, path.size()));
+		}
+		auto id = segments.size() > 1 ? parseNumber(segments[1]) : std::nullopt;
+		// Like GitLab, keys are also listed by username
+		if (!id && segments.size() == 3 && segments[0] == "users" && segments[2] == "keys")
+			id = idOf(segments[1], "user");
+		if (segments.size() == 1 && segments[0] == "users") {
+			if (auto username = request.parameter("username")) {
+				auto found = idOf(*username, "user");
+				auto known = found && directory.hasUser(*found);
+				return list(request, known ? std::vector{*found} : std::vector<unsigned>{}, Directory::user);
+			}
+			return page(request, options.users, [](std::size_t i) { return Directory::user(i + 1); });
+		}
+		if (segments.size() == 1 && segments[0] == "keys") {
+			auto fingerprint = request.parameter("fingerprint");
+			auto found = fingerprint ? directory.keyOf(percentDecode(*fingerprint)) : std::nullopt;
+			if (!found)
+				return notFound();
+			return Response{.status = 200, .body = Directory::ownedKey(found->first, found->second), .headers = {}};
+		}
+		if (segments.size() == 1 && segments[0] == "groups") {
+			if (auto search = request.parameter("search")) {
+				// Like GitLab, the search matches all groups whose name contains it
+				std::vector<unsigned> found;
+				for (unsigned group = 1; group <= options.groups; ++group)
+					if (std::format("group{}", group).contains(*search))
+						found.push_back(group);
+				return list(request, found, Directory::group);
+			}
+			return page(request, options.groups, [](std::size_t i) { return Directory::group(i + 1); });
+		}
+		if (segments[0] == "users" && id && directory.hasUser(*id)) {
+			if (segments.size() == 2)
+				return Response{.status = 200, .body = Directory::user(*id), .headers = {}};
+			if (segments.size() == 3 && segments[2] == "memberships")
+				return list(request, directory.groupsOf(*id), Directory::membership);
+			if (segments.size() == 3 && segments[2] == "keys")
+				return page(request, options.keys, [user = *id](std::size_t i) {
+					return Directory::key(user, static_cast<unsigned>(i));
+				});
+		}
+		if (segments[0] == "groups" && id && directory.hasGroup(*id)) {
+			if (segments.size() == 2)
+				return Response{.status = 200, .body = Directory::group(*id), .headers = {}};
+			if (segments.size() == 3 && segments[2] == "members")
+				return list(request, directory.membersOf(*id), Directory::member);
+		}
+		return notFound();
+	}
+
+	Response answer(std::string_view header) {
+		++answered;
+		std::uniform_real_distribution<double> chance{0, 1};
+		if (chance(random) < options.errorRate) {
+			++failed;
+			return Response{.status = 500, .body = R"({"message":"500 Internal Server Error"})", .headers = {}};
+		}
+		if (chance(random) < options.rateLimitRate) {
+			++rateLimited;
+			return Response{.status = 429, .body = R"({"message":"Retry later"})", .headers = "Retry-After: 1\r\n"};
+		}
+		auto request = parseRequest(header);
+		if (request.host.empty())
+			request.host = "127.0.0.1";
+		return route(request);
+	}
+
+	kj::Promise<void> delay() {
+		if (options.latency == 0 && options.jitter == 0)
+			return kj::READY_NOW;
+		std::uniform_int_distribution<unsigned> jitter{0, options.jitter};
+		return timer.afterDelay((options.latency + jitter(random)) * kj::MILLISECONDS);
+	}
+
+	/** Answers the requests on the connection one after the other until the client closes it **/
+	kj::Promise<void> serve(kj::AsyncIoStream& stream, std::shared_ptr<Buffered> buffered) {
+		auto end = buffered->data.find("\r\n\r\n");
+		auto length = end == std::string::npos ? 0 : end + 4 + contentLength({buffered->data.data(), end + 2});
+		if (end == std::string::npos || buffered->data.size() < length) {
+			if (end == std::string::npos && buffered->data.size() > MaxHeader)
+				return kj::READY_NOW;
+			return stream.tryRead(buffered->chunk.data(), 1, buffered->chunk.size())
+					.then([this, &stream, buffered](std::size_t read) -> kj::Promise<void> {
+						if (read == 0)
+							return kj::READY_NOW;
+						buffered->data.append(buffered->chunk.data(), read);
+						return serve(stream, buffered);
+					});
+		}
+		auto response = std::make_shared<std::string>(answer({buffered->data.data(), end + 2}).str());
+		buffered->data.erase(0, length);
+		return delay()
+				.then([&stream, response]() { return stream.write(response->data(), response->size()); })
+				.then([this, &stream, buffered]() { return serve(stream, buffered); });
+	}
+
+	void taskFailed(kj::Exception&& exception) override {
+		std::cerr << "A connection failed: " << exception.getDescription().cStr() << std::endl;
+	}
+
+public:
+	std::size_t answered = 0;
+	std::size_t failed = 0;
+	std::size_t rateLimited = 0;
+
+	Mock(const Options& options, kj::Timer& timer)
+			: options(options), directory(options), timer(timer), connections(*this) {}
+
+	kj::Promise<void> run(kj::ConnectionReceiver& listener) {
+		return listener.accept().then([this, &listener](kj::Own<kj::AsyncIoStream>&& connection) {
+			auto& stream = *connection;
+			connections.add(serve(stream, std::make_shared<Buffered>()).attach(kj::mv(connection)));
+			return run(listener);
+		});
+	}
+};
+
+int main(int argc, char* argv[]) {
+	auto options = parseOptions(argc, argv);
+	if (!options) {
+		std::cerr << "Usage: " << argv[0] << " [--port N] [--users N] [--groups N] [--memberships N] [--keys N] "
+				  << "[--latency MS] [--jitter MS] [--error-rate P] [--rate-limit-rate P] [--max-per-page N] "
+				  << "[--no-totals]" << std::endl;
+		return -1;
+	}
+	kj::UnixEventPort::captureSignal(SIGINT);
+	kj::UnixEventPort::captureSignal(SIGTERM);
+	auto io = kj::setupAsyncIo();
+	auto address = std::format("127.0.0.1:{}", options->port);
+	auto listener = io.provider->getNetwork().parseAddress(address.c_str()).wait(io.waitScope)->listen();
+	Mock mock{*options, io.provider->getTimer()};
+	auto running = mock.run(*listener).eagerlyEvaluate([](kj::Exception&& exception) {
+		std::cerr << "Stopped accepting connections: " << exception.getDescription().cStr() << std::endl;
+	});
+	std::cout << "Serving " << options->users << " users and " << options->groups << " groups at http://" << address
+			  << "/api/v4" << std::endl;
+	io.unixEventPort.onSignal(SIGINT).exclusiveJoin(io.unixEventPort.onSignal(SIGTERM)).wait(io.waitScope);
+	std::cout << "Answered " << mock.answered << " requests, " << mock.failed << " with 500 and " << mock.rateLimited
+			  << " with 429" << std::endl;
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+/**
+ * @file nss_load.cpp
+ * @brief Measures what loading the NSS module costs a process that does not look up any GitLab user, next to glibc's
+ * libnss_files. It does not need a running daemon.
+ *
+ * Usage: bench_nss_load [module] [iterations]
+ *
+ * Each iteration forks a fresh process, which loads the module like glibc does (dlopen() with RTLD_LAZY and dlsym() of
+ * one of its functions) and reports how long that took and by how much its resident set grew. Since the benchmark is a
+ * C++ program, libstdc++ is already loaded; a C program like ls would also have to load that for libnss_gitlab.
+ */
+
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/** The result of loading a module once, as written from the child to the parent **/
+struct Sample {
+	bool loaded;
+	Clock::duration took;
+	/** The growth of the resident set in KiB **/
+	long rss;
+};
+
+/** @return the resident set of the calling process in KiB **/
+static long residentKiB() {
+	long pages = 0, resident = 0;
+	if (auto* statm = std::fopen("/proc/self/statm", "r")) {
+		if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		std::fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static Sample loadOnce(const std::string& library, const std::string& symbol) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return {.loaded = false};
+	auto child = fork();
+	if (child == 0) {
+		close(fds[0]);
+		auto before = residentKiB();
+		auto start = Clock::now();
+		auto* module = dlopen(library.c_str(), RTLD_LAZY);
+		bool loaded = module && dlsym(module, symbol.c_str());
+		Sample sample{.loaded = loaded, .took = Clock::now() - start, .rss = residentKiB() - before};
+		auto written = write(fds[1], &sample, sizeof(sample));
+		_exit(written == sizeof(sample) ? 0 : 1);
+	}
+	close(fds[1]);
+	Sample sample{.loaded = false};
+	if (child < 0 || read(fds[0], &sample, sizeof(sample)) != sizeof(sample))
+		sample.loaded = false;
+	close(fds[0]);
+	if (child > 0)
+		waitpid(child, nullptr, 0);
+	return sample;
+}
+
+static void measure(const std::string& library, const std::string& service, unsigned iterations) {
+	std::vector<Clock::duration> samples;
+	long rss = 0;
+	for (unsigned i = 0; i < iterations; ++i) {
+		auto sample = loadOnce(library, "_nss_" + service + "_getpwnam_r");
+		if (!sample.loaded) {
+			std::cout << library << ": could not be loaded" << std::endl;
+			return;
+		}
+		samples.push_back(sample.took);
+		rss = std::max(rss, sample.rss);
+	}
+	std::ranges::sort(samples);
+	auto us = [](Clock::duration duration) { return std::chrono::duration<double, std::micro>(duration).count(); };
+	std::cout << library << ": load p50 " << us(samples[samples.size() / 2]) << " us, p99 "
+			  << us(samples[samples.size() * 99 / 100]) << " us, resident set +" << rss << " KiB" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	std::string module = argc > 1 ? argv[1] : "libnss_gitlab.so.2";
+	unsigned iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+	if (iterations == 0) {
+		std::cerr << "Usage: " << argv[0] << " [module] [iterations]" << std::endl;
+		return -1;
+	}
+	measure("libnss_files.so.2", "files", iterations);
+	measure(module, "gitlab", iterations);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+/**
+ * @file nss_populate.cpp
+ * @brief Measures how long the NSS module takes to fill the passwd and group structs that glibc passes in from a
+ * daemon's answer and from the shared table. Like bench_json_decode, it does not need a running daemon.
+ *
+ * Usage: bench_nss_populate [iterations]
+ */
+
+#include <sharedtable.hpp>
+
+#include <capnp/message.h>
+#include <protocol/messages.capnp.h>
+
+#include <grp.h>
+#include <pwd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <string>
+#include <vector>
+
+// Defined in nss_interface.cpp, which is compiled into the benchmark
+bool populatePasswd(passwd& pwd, const User::Reader& user, std::span<char> buffer);
+bool populatePasswd(passwd& pwd, const sharedtable::User& user, std::span<char> buffer);
+bool populateGroup(group& group, const sharedtable::Group& obj, std::span<char> buffer);
+
+using Clock = std::chrono::steady_clock;
+
+/** What glibc's getpwnam() and getgrgid() start with (sysconf(_SC_GETPW_R_SIZE_MAX) is usually 1024) **/
+static constexpr std::size_t BufferSize = 1024;
+
+static void measure(const std::string& name, unsigned iterations, const std::function<bool()>& populate) {
+	std::vector<Clock::duration> samples;
+	samples.reserve(iterations);
+	bool fits = true;
+	for (unsigned i = 0; i < iterations; ++i) {
+		auto start = Clock::now();
+		fits = populate();
+		samples.push_back(Clock::now() - start);
+	}
+	std::ranges::sort(samples);
+	auto ns = [](Clock::duration duration) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	};
+	Clock::duration total{};
+	for (auto sample : samples)
+		total += sample;
+	std::cout << name << ": mean " << ns(total) / samples.size() << " ns, p50 " << ns(samples[samples.size() / 2])
+			  << " ns, p99 " << ns(samples[samples.size() * 99 / 100]) << " ns" << (fits ? "" : ", buffer too small")
+			  << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	unsigned iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+	if (iterations == 0) {
+		std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+		return -1;
+	}
+	std::vector<char> buffer(BufferSize);
+	passwd pwd;
+
+	capnp::MallocMessageBuilder message;
+	auto built = message.initRoot<User>();
+	built.setId(1042);
+	built.setName("Alice Miller");
+	built.setUsername("alice.miller");
+	auto groups = built.initGroups(5);
+	for (unsigned i = 0; i < groups.size(); ++i) {
+		groups[i].setId(100 + i);
+		groups[i].setName("group" + std::to_string(i));
+	}
+	auto user = built.asReader();
+	measure("populatePasswd from an RPC answer", iterations, [&]() { return populatePasswd(pwd, user, buffer); });
+
+	sharedtable::User tableUser{.id = 1042, .group = 100, .username = "alice.miller", .name = "Alice Miller"};
+	measure("populatePasswd from the shared table", iterations, [&]() {
+		return populatePasswd(pwd, tableUser, buffer);
+	});
+
+	for (unsigned members : {10u, 100u, 1000u}) {
+		// The table's string section with the members' usernames
+		std::string strings;
+		std::vector<uint32_t> offsets;
+		for (unsigned i = 0; i < members; ++i) {
+			offsets.push_back(static_cast<uint32_t>(strings.size()));
+			strings += "user" + std::to_string(i) + '\0';
+		}
+		sharedtable::Group tableGroup{.id = 100, .name = "webis", .members = offsets, .strings = strings.data()};
+		// Like glibc, which doubles the buffer until the group fits
+		std::vector<char> groupBuffer(BufferSize);
+		group grp;
+		while (!populateGroup(grp, tableGroup, groupBuffer))
+			groupBuffer.resize(groupBuffer.size() * 2);
+		measure(
+				"populateGroup with " + std::to_string(members) + " members", iterations,
+				[&]() { return populateGroup(grp, tableGroup, groupBuffer); }
+		);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+/**
+ * @file rpc_fork.cpp
+ * @brief Checks that lookups still work in a process that forked after it looked a user up, like sshd, sudo or a
+ * shell do, and measures the first lookup of the child, which has to give up the inherited connection and reconnect.
+ *
+ * Usage: bench_rpc_fork <username> [iterations]
+ *
+ * Each iteration looks the user up, forks and looks the user up twice in the child, which reports how long each took.
+ * The parent looks the user up once more afterwards to make sure that the child did not disturb its connection. Exits
+ * with 1 if any of the lookups failed.
+ */
+
+#include <error.hpp>
+#include <rpcclient.hpp>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/** The lookups of a child, as written from the child to the parent **/
+struct Sample {
+	bool found;
+	/** The first lookup after fork(), which reconnects **/
+	Clock::duration first;
+	Clock::duration second;
+};
+
+static bool lookup(const std::string& username) {
+	auto response = callDaemon([&username](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getUserByNameRequest();
+		request.setName(username.c_str());
+		return request.send();
+	});
+	return response && static_cast<Error>(response->getErrcode()) == Error::Ok;
+}
+
+static Sample forkOnce(const std::string& username) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return {.found = false};
+	auto child = fork();
+	if (child == 0) {
+		close(fds[0]);
+		auto start = Clock::now();
+		bool found = lookup(username);
+		auto first = Clock::now() - start;
+		start = Clock::now();
+		found = lookup(username) && found;
+		Sample sample{.found = found, .first = first, .second = Clock::now() - start};
+		auto written = write(fds[1], &sample, sizeof(sample));
+		_exit(written == sizeof(sample) ? 0 : 1);
+	}
+	close(fds[1]);
+	Sample sample{.found = false};
+	if (child < 0 || read(fds[0], &sample, sizeof(sample)) != sizeof(sample))
+		sample.found = false;
+	close(fds[0]);
+	if (child > 0)
+		waitpid(child, nullptr, 0);
+	return sample;
+}
+
+int main(int argc, char* argv[]) {
+	unsigned iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+	if (argc < 2 || iterations == 0) {
+		std::cerr << "Usage: " << argv[0] << " <username> [iterations]" << std::endl;
+		return -1;
+	}
+	std::string username = argv[1];
+	std::vector<Clock::duration> first, second;
+	for (unsigned i = 0; i < iterations; ++i) {
+		if (!lookup(username)) {
+			std::cerr << "Looking up " << username << " failed before forking" << std::endl;
+			return 1;
+		}
+		auto sample = forkOnce(username);
+		if (!sample.found) {
+			std::cerr << "Looking up " << username << " failed in the forked child" << std::endl;
+			return 1;
+		}
+		first.push_back(sample.first);
+		second.push_back(sample.second);
+	}
+	if (!lookup(username)) {
+		std::cerr << "Looking up " << username << " failed in the parent after forking" << std::endl;
+		return 1;
+	}
+	auto us = [](std::vector<Clock::duration>& samples, std::size_t permille) {
+		std::ranges::sort(samples);
+		return std::chrono::duration<double, std::micro>(samples[samples.size() * permille / 1000]).count();
+	};
+	std::cout << "First lookup in the child: p50 " << us(first, 500) << " us, p99 " << us(first, 990) << " us"
+			  << std::endl;
+	std::cout << "Second lookup in the child: p50 " << us(second, 500) << " us, p99 " << us(second, 990) << " us"
+			  << std::endl;
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+/**
+ * @file rpc_lookup.cpp
+ * @brief Measures the cost of a getUserByName lookup through the daemon with a new connection per call (as the NSS
+ * module used to do) and with the persistent per-thread connection.
+ *
+ * Usage: bench_rpc_lookup <username> [iterations]
+ */
+
+#include <error.hpp>
+#include <rpcclient.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static void report(const char* name, std::vector<Clock::duration>& samples) {
+	std::ranges::sort(samples);
+	auto ns = [](Clock::duration duration) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	};
+	Clock::duration total{};
+	for (auto sample : samples)
+		total += sample;
+	std::cout << name << ": " << samples.size() << " calls, mean " << ns(total) / samples.size() << " ns, p50 "
+			  << ns(samples[samples.size() / 2]) << " ns, p99 " << ns(samples[samples.size() * 99 / 100]) << " ns"
+			  << std::endl;
+}
+
+template <typename F>
+static bool measure(const char* name, unsigned iterations, F&& lookup) {
+	std::vector<Clock::duration> samples;
+	samples.reserve(iterations);
+	for (unsigned i = 0; i < iterations; ++i) {
+		auto start = Clock::now();
+		if (!lookup()) {
+			std::cerr << name << ": lookup failed" << std::endl;
+			return false;
+		}
+		samples.push_back(Clock::now() - start);
+	}
+	report(name, samples);
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <username> [iterations]" << std::endl;
+		return -1;
+	}
+	std::string username = argv[1];
+	unsigned iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000;
+	auto send = [&username](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getUserByNameRequest();
+		request.setName(username.c_str());
+		return request.send();
+	};
+
+	bool ok = measure("connection per call", iterations, [&send]() {
+		try {
+			DaemonConnection connection;
+			auto response = send(connection.daemon).wait(connection.waitScope());
+			return static_cast<Error>(response.getErrcode()) == Error::Ok;
+		} catch (std::exception& e) {
+			return false;
+		}
+	});
+	ok = ok && measure("persistent connection", iterations, [&send]() {
+		auto response = callDaemon(send);
+		return response && static_cast<Error>(response->getErrcode()) == Error::Ok;
+	});
+	return ok ? 0 : -2;
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+/**
+ * @file rpc_scaling.cpp
+ * @brief Measures how the daemon's throughput for lookups that hit its caches grows with the number of concurrent
+ * clients. Each client thread keeps its own persistent connection and repeatedly looks up the same user.
+ *
+ * Usage: bench_rpc_scaling <username> [max clients] [seconds per step]
+ *
+ * The number of clients is doubled from 1 up to max clients (by default the number of CPU cores). Run it against
+ * daemons configured with different numbers of threads to see how throughput scales with them.
+ */
+
+#include <error.hpp>
+#include <rpcclient.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Step {
+	std::size_t lookups;
+	std::size_t failures;
+};
+
+static Step run(const std::string& username, unsigned clients, Clock::duration duration) {
+	std::atomic<std::size_t> lookups = 0, failures = 0;
+	std::atomic<bool> stop = false;
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < clients; ++i)
+		threads.emplace_back([&]() {
+			std::size_t done = 0, failed = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				auto response = callDaemon([&username](GitLabDaemon::Client& daemon) {
+					auto request = daemon.getUserByNameRequest();
+					request.setName(username.c_str());
+					return request.send();
+				});
+				if (response && static_cast<Error>(response->getErrcode()) == Error::Ok)
+					++done;
+				else
+					++failed;
+			}
+			lookups += done;
+			failures += failed;
+		});
+	std::this_thread::sleep_for(duration);
+	stop = true;
+	for (auto& thread : threads)
+		thread.join();
+	return Step{.lookups = lookups, .failures = failures};
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <username> [max clients] [seconds per step]" << std::endl;
+		return -1;
+	}
+	std::string username = argv[1];
+	unsigned maxClients = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+	std::chrono::seconds duration{argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 5};
+	// Warms the daemon's caches such that only hits are measured
+	if (run(username, 1, std::chrono::milliseconds{100}).lookups == 0) {
+		std::cerr << "Looking up " << username << " failed" << std::endl;
+		return -2;
+	}
+	double single = 0;
+	for (unsigned clients = 1; clients <= std::max(maxClients, 1u); clients *= 2) {
+		auto step = run(username, clients, duration);
+		double perSecond = static_cast<double>(step.lookups) / duration.count();
+		if (clients == 1)
+			single = perSecond;
+		std::cout << clients << " clients: " << static_cast<std::size_t>(perSecond) << " lookups/s, "
+				  << (single > 0 ? perSecond / single : 0) << "x of 1 client, " << step.failures << " failures"
+				  << std::endl;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,513 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief When TTLCache::lookup() asks for an entry to be fetched again before it is missing.
+ */
+struct RefreshPolicy {
+	/** How long after it expired an entry is still returned while it is fetched again **/
+	std::chrono::steady_clock::duration maxStale{};
+	/** How long before it expires a hot entry is fetched again **/
+	std::chrono::steady_clock::duration ahead{};
+	/** The number of uses since the entry was put from which on it is hot **/
+	unsigned hotUses = 0;
+	/** How long after reporting an entry as due lookups do so again unless it was put, e.g. as the fetch failed **/
+	std::chrono::steady_clock::duration retry = std::chrono::seconds{30};
+};
+
+/**
+ * @brief A size bounded least-recently-used cache whose entries expire after a fixed time to live.
+ * @details Expired entries are not dropped until they are replaced or evicted such that they can still be served by
+ * getStale() when no fresh value can be obtained.
+ */
+template <typename Key, typename Value>
+class TTLCache final {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Stats {
+		std::size_t hits;
+		std::size_t staleHits;
+		std::size_t misses;
+		std::size_t evictions;
+		/** Lookups that asked for the entry to be fetched again **/
+		std::size_t refreshes;
+		std::size_t size;
+
+		Stats& operator+=(const Stats& other) noexcept {
+			hits += other.hits;
+			staleHits += other.staleHits;
+			misses += other.misses;
+			evictions += other.evictions;
+			refreshes += other.refreshes;
+			size += other.size;
+			return *this;
+		}
+	};
+
+	struct Lookup {
+		Value value;
+		/** Whether the caller should fetch the entry again (in the background) and put it **/
+		bool refresh;
+	};
+
+private:
+	struct Entry {
+		Key key;
+		Value value;
+		Clock::time_point expires;
+		/** Counted since the entry was put **/
+		unsigned uses = 0;
+		/** Until when lookups do not ask for the entry to be fetched again as one already did **/
+		Clock::time_point refreshing{};
+	};
+	using List = std::list<Entry>;
+
+	Clock::duration ttl;
+	std::size_t capacity;
+	RefreshPolicy policy;
+	List entries; // Most recently used first
+	std::unordered_map<Key, typename List::iterator> index;
+	Stats counters{};
+
+public:
+	TTLCache(Clock::duration ttl, std::size_t capacity, RefreshPolicy policy = {}) noexcept
+			: ttl(ttl), capacity(capacity), policy(policy) {}
+
+	std::optional<Value> get(const Key& key) {
+		auto it = index.find(key);
+		if (it == index.end()) {
+			++counters.misses;
+			return std::nullopt;
+		}
+		if (it->second->expires <= Clock::now()) {
+			++counters.misses;
+			return std::nullopt;
+		}
+		entries.splice(entries.begin(), entries, it->second);
+		++counters.hits;
+		return it->second->value;
+	}
+
+	/**
+	 * @brief Looks the entry up according to the refresh policy: Entries that expired less than maxStale ago are
+	 * still returned and hot entries are returned as due for a refresh once they are about to expire. Each entry is
+	 * only reported as due once per RefreshPolicy::retry until it is put again, such that a single background fetch is
+	 * started but a failed one does not keep the entry from ever being refreshed.
+	 */
+	std::optional<Lookup> lookup(const Key& key) {
+		auto it = index.find(key);
+		auto now = Clock::now();
+		if (it == index.end() || it->second->expires + policy.maxStale <= now) {
+			++counters.misses;
+			return std::nullopt;
+		}
+		auto& entry = *it->second;
+		entries.splice(entries.begin(), entries, it->second);
+		++entry.uses;
+		bool expired = entry.expires <= now;
+		++(expired ? counters.staleHits : counters.hits);
+		bool due = expired || (entry.uses >= policy.hotUses && entry.expires - policy.ahead <= now);
+		bool refresh = due && entry.refreshing <= now;
+		if (refresh) {
+			entry.refreshing = now + policy.retry;
+			++counters.refreshes;
+		}
+		return Lookup{.value = entry.value, .refresh = refresh};
+	}
+
+	/**
+	 * @brief Returns the entry even if it expired, as long as it did so less than maxStale ago. The entry is not
+	 * counted as used.
+	 */
+	std::optional<Value> getStale(const Key& key, Clock::duration maxStale) {
+		auto it = index.find(key);
+		if (it == index.end() || it->second->expires + maxStale <= Clock::now())
+			return std::nullopt;
+		++counters.staleHits;
+		return it->second->value;
+	}
+
+	void put(const Key& key, Value value) { put(key, std::move(value), Clock::now() + ttl); }
+
+	/** Inserts an entry that expires at the given time instead of after the time to live **/
+	void put(const Key& key, Value value, Clock::time_point expires) {
+		if (capacity == 0 || ttl <= Clock::duration::zero())
+			return;
+		if (auto it = index.find(key); it != index.end()) {
+			it->second->value = std::move(value);
+			it->second->expires = expires;
+			it->second->uses = 0;
+			it->second->refreshing = {};
+			entries.splice(entries.begin(), entries, it->second);
+			return;
+		}
+		while (index.size() >= capacity) {
+			index.erase(entries.back().key);
+			entries.pop_back();
+			++counters.evictions;
+		}
+		entries.emplace_front(Entry{.key = key, .value = std::move(value), .expires = expires});
+		index.emplace(key, entries.begin());
+	}
+
+	/** @return the erased value, if there was one **/
+	std::optional<Value> erase(const Key& key) {
+		auto it = index.find(key);
+		if (it == index.end())
+			return std::nullopt;
+		auto value = std::move(it->second->value);
+		entries.erase(it->second);
+		index.erase(it);
+		return value;
+	}
+
+	void clear() noexcept {
+		index.clear();
+		entries.clear();
+	}
+
+	/** Calls f(key, value) for every entry that did not expire yet without counting it as a use **/
+	template <typename F>
+	void forEach(F&& f) const {
+		auto now = Clock::now();
+		for (const auto& entry : entries)
+			if (entry.expires > now)
+				f(entry.key, entry.value);
+	}
+
+	/** Calls f(key, value, expires) for every entry, including expired ones, without counting it as a use **/
+	template <typename F>
+	void forEachEntry(F&& f) const {
+		for (const auto& entry : entries)
+			f(entry.key, entry.value, entry.expires);
+	}
+
+	Stats stats() const noexcept {
+		auto stats = counters;
+		stats.size = index.size();
+		return stats;
+	}
+};
+
+/**
+ * @brief Remembers keys that are known not to exist.
+ * @details Recent keys are kept in an exact, size bounded LRU cache. Keys that were pushed out of it are still
+ * remembered approximately by a pair of bloom filters that are rotated every time to live, such that the memory usage
+ * stays constant no matter how many distinct keys are recorded. The filters may report false positives at a rate that
+ * depends on their size and the number of keys recorded within one time to live. A filter that got more keys than it
+ * is designed for is not consulted anymore until it is rotated out, such that a flood of distinct keys cannot make it
+ * report every key.
+ */
+template <typename Key>
+class NegativeCache final {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Stats {
+		std::size_t hits;
+		std::size_t filterHits;
+		std::size_t misses;
+		std::size_t evictions;
+		std::size_t size;
+
+		Stats& operator+=(const Stats& other) noexcept {
+			hits += other.hits;
+			filterHits += other.filterHits;
+			misses += other.misses;
+			evictions += other.evictions;
+			size += other.size;
+			return *this;
+		}
+	};
+
+private:
+	static constexpr unsigned NumHashes = 7;
+
+	struct Entry {
+		Key key;
+		Clock::time_point expires;
+	};
+	using List = std::list<Entry>;
+
+	Clock::duration ttl;
+	std::size_t capacity;
+	List entries; // Most recently recorded first
+	std::unordered_map<Key, typename List::iterator> index;
+
+	std::vector<uint64_t> current;
+	std::vector<uint64_t> previous;
+	/** The keys inserted into each filter **/
+	std::size_t currentKeys = 0;
+	std::size_t previousKeys = 0;
+	/** The number of keys per filter at which the false positive rate is about 0.5^NumHashes **/
+	std::size_t filterCapacity;
+	/** When previous is cleared; current is cleared a time to live later **/
+	Clock::time_point rotates;
+	Stats counters{};
+
+	static uint64_t mix(uint64_t x) noexcept {
+		// splitmix64 finalizer such that the weak std::hash of integers still spreads over all bits
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ull;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebull;
+		x ^= x >> 31;
+		return x;
+	}
+
+	template <typename F>
+	void forEachBit(const Key& key, F&& func) const {
+		const std::size_t bits = current.size() * 64;
+		const uint64_t h1 = mix(std::hash<Key>{}(key));
+		const uint64_t h2 = mix(h1) | 1;
+		for (unsigned i = 0; i < NumHashes; ++i)
+			func((h1 + i * h2) % bits);
+	}
+
+	bool filterContains(const std::vector<uint64_t>& filter, const Key& key) const {
+		bool found = true;
+		forEachBit(key, [&](std::size_t bit) { found = found && (filter[bit / 64] & (uint64_t{1} << (bit % 64))); });
+		return found;
+	}
+
+	bool filterUsable(std::size_t keys) const noexcept { return keys <= filterCapacity; }
+
+	static void filterInsert(std::vector<uint64_t>& filter, std::size_t bit) {
+		filter[bit / 64] |= uint64_t{1} << (bit % 64);
+	}
+
+	/** Remembers an entry that was pushed out of the exact cache in the filter that lives about as long as it would **/
+	void remember(const Entry& entry) {
+		if (current.empty())
+			return;
+		// previous is consulted until rotates, current for another time to live
+		bool early = entry.expires <= rotates;
+		auto& filter = early ? previous : current;
+		forEachBit(entry.key, [&filter](std::size_t bit) { filterInsert(filter, bit); });
+		++(early ? previousKeys : currentKeys);
+	}
+
+	void rotate(Clock::time_point now) {
+		if (current.empty() || now < rotates)
+			return;
+		// If more than two periods passed, everything in previous is outdated as well
+		if (now >= rotates + ttl) {
+			std::ranges::fill(current, 0);
+			currentKeys = 0;
+		}
+		std::swap(current, previous);
+		previousKeys = currentKeys;
+		std::ranges::fill(current, 0);
+		currentKeys = 0;
+		rotates = now + ttl;
+	}
+
+public:
+	/**
+	 * @param ttl How long a key is considered non-existent after it was recorded.
+	 * @param capacity The maximum number of keys remembered exactly.
+	 * @param filterBits The size of each of the two bloom filters. Set to 0 to only use the exact cache.
+	 */
+	NegativeCache(Clock::duration ttl, std::size_t capacity, std::size_t filterBits)
+			: ttl(ttl), capacity(capacity), current((filterBits + 63) / 64), previous(current.size()),
+			  filterCapacity(current.size() * 64 * 0.693 / NumHashes), rotates(Clock::now() + ttl) {}
+
+	bool contains(const Key& key) {
+		if (ttl <= Clock::duration::zero())
+			return false;
+		auto now = Clock::now();
+		if (auto it = index.find(key); it != index.end()) {
+			if (it->second->expires > now) {
+				++counters.hits;
+				return true;
+			}
+			// Expired while remembered exactly, so it was never put into a filter
+			entries.erase(it->second);
+			index.erase(it);
+			++counters.misses;
+			return false;
+		}
+		rotate(now);
+		if (!current.empty() && ((filterUsable(currentKeys) && filterContains(current, key)) ||
+								 (filterUsable(previousKeys) && filterContains(previous, key)))) {
+			++counters.filterHits;
+			return true;
+		}
+		++counters.misses;
+		return false;
+	}
+
+	void put(const Key& key) {
+		if (ttl <= Clock::duration::zero())
+			return;
+		auto now = Clock::now();
+		rotate(now);
+		if (capacity == 0) {
+			remember(Entry{.key = key, .expires = now + ttl});
+			return;
+		}
+		if (auto it = index.find(key); it != index.end()) {
+			it->second->expires = now + ttl;
+			entries.splice(entries.begin(), entries, it->second);
+			return;
+		}
+		while (index.size() >= capacity) {
+			if (entries.back().expires > now)
+				remember(entries.back());
+			index.erase(entries.back().key);
+			entries.pop_back();
+			++counters.evictions;
+		}
+		entries.emplace_front(Entry{.key = key, .expires = now + ttl});
+		index.emplace(key, entries.begin());
+	}
+
+	Stats stats() const noexcept {
+		auto stats = counters;
+		stats.size = index.size();
+		return stats;
+	}
+};
+
+/**
+ * @brief Splits a cache into shards that are locked independently, chosen by the key's hash, such that threads that
+ * look up different keys rarely wait for each other.
+ * @details Each shard gets an equal share of the capacity and evicts on its own, so eviction is only least recently
+ * used within a shard.
+ */
+template <typename Key, typename Cache>
+class Sharded {
+public:
+	static constexpr std::size_t ShardCount = 16;
+
+private:
+	struct alignas(64) Shard {
+		mutable std::mutex mutex;
+		Cache cache;
+
+		explicit Shard(Cache&& cache) : cache(std::move(cache)) {}
+	};
+	std::vector<std::unique_ptr<Shard>> shards;
+
+protected:
+	static std::size_t share(std::size_t capacity) noexcept { return (capacity + ShardCount - 1) / ShardCount; }
+
+	/** @param make returns the cache of one shard **/
+	template <typename F>
+	explicit Sharded(F&& make) {
+		shards.reserve(ShardCount);
+		for (std::size_t i = 0; i < ShardCount; ++i)
+			shards.push_back(std::make_unique<Shard>(make()));
+	}
+
+	/** Calls f with the key's shard while holding its lock **/
+	template <typename F>
+	decltype(auto) with(const Key& key, F&& f) {
+		auto& shard = *shards[std::hash<Key>{}(key) % ShardCount];
+		std::lock_guard lock(shard.mutex);
+		return f(shard.cache);
+	}
+
+	/** Calls f with every shard in turn while holding its lock **/
+	template <typename F>
+	void forEachShard(F&& f) const {
+		for (const auto& shard : shards) {
+			std::lock_guard lock(shard->mutex);
+			f(static_cast<const Cache&>(shard->cache));
+		}
+	}
+
+	template <typename Stats>
+	Stats sumStats() const {
+		Stats stats{};
+		forEachShard([&stats](const Cache& cache) { stats += cache.stats(); });
+		return stats;
+	}
+};
+
+/** @brief A TTLCache that may be used from several threads at once **/
+template <typename Key, typename Value>
+class ShardedTTLCache final : private Sharded<Key, TTLCache<Key, Value>> {
+private:
+	using Base = Sharded<Key, TTLCache<Key, Value>>;
+
+public:
+	using Clock = typename TTLCache<Key, Value>::Clock;
+	using Stats = typename TTLCache<Key, Value>::Stats;
+	using Lookup = typename TTLCache<Key, Value>::Lookup;
+
+	ShardedTTLCache(Clock::duration ttl, std::size_t capacity, RefreshPolicy policy = {})
+			: Base([=]() { return TTLCache<Key, Value>(ttl, Base::share(capacity), policy); }) {}
+
+	std::optional<Value> get(const Key& key) {
+		return this->with(key, [&key](auto& cache) { return cache.get(key); });
+	}
+	std::optional<Lookup> lookup(const Key& key) {
+		return this->with(key, [&key](auto& cache) { return cache.lookup(key); });
+	}
+	std::optional<Value> getStale(const Key& key, Clock::duration maxStale) {
+		return this->with(key, [&key, maxStale](auto& cache) { return cache.getStale(key, maxStale); });
+	}
+	void put(const Key& key, Value value) {
+		this->with(key, [&key, &value](auto& cache) { cache.put(key, std::move(value)); });
+	}
+	void put(const Key& key, Value value, Clock::time_point expires) {
+		this->with(key, [&key, &value, expires](auto& cache) { cache.put(key, std::move(value), expires); });
+	}
+	std::optional<Value> erase(const Key& key) {
+		return this->with(key, [&key](auto& cache) { return cache.erase(key); });
+	}
+
+	/** Like TTLCache::forEach(); f is called while a shard is locked and must not use this cache **/
+	template <typename F>
+	void forEach(F&& f) const {
+		this->forEachShard([&f](const auto& cache) { cache.forEach(f); });
+	}
+	/** Like TTLCache::forEachEntry(); f is called while a shard is locked and must not use this cache **/
+	template <typename F>
+	void forEachEntry(F&& f) const {
+		this->forEachShard([&f](const auto& cache) { cache.forEachEntry(f); });
+	}
+
+	Stats stats() const { return this->template sumStats<Stats>(); }
+};
+
+/** @brief A NegativeCache that may be used from several threads at once **/
+template <typename Key>
+class ShardedNegativeCache final : private Sharded<Key, NegativeCache<Key>> {
+private:
+	using Base = Sharded<Key, NegativeCache<Key>>;
+
+public:
+	using Clock = typename NegativeCache<Key>::Clock;
+	using Stats = typename NegativeCache<Key>::Stats;
+
+	/** The capacity and the filter bits are split between the shards **/
+	ShardedNegativeCache(Clock::duration ttl, std::size_t capacity, std::size_t filterBits)
+			: Base([=]() { return NegativeCache<Key>(ttl, Base::share(capacity), Base::share(filterBits)); }) {}
+
+	bool contains(const Key& key) {
+		return this->with(key, [&key](auto& cache) { return cache.contains(key); });
+	}
+	void put(const Key& key) {
+		this->with(key, [&key](auto& cache) { cache.put(key); });
+	}
+
+	Stats stats() const { return this->template sumStats<Stats>(); }
+};
+
+#endif
\ No newline at end of file
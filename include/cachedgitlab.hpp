@@ -0,0 +1,266 @@
+#ifndef CACHEDGITLAB_HPP
+#define CACHEDGITLAB_HPP
+
+#include "cache.hpp"
+#include "checkpoint.hpp"
+#include "config.hpp"
+#include "directory.hpp"
+#include "error.hpp"
+#include "gitlabapi.hpp"
+#include "singleflight.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gitlab {
+	/**
+	 * @brief Answers lookups from memory where possible and only asks GitLab when an entry is missing or expired.
+	 * @details Users are always returned together with their groups. Lookups that GitLab answered with
+	 * Error::NotFound are remembered separately and answered without asking GitLab again. Concurrent lookups of the
+	 * same key share a single request to GitLab.
+	 *
+	 * If a directory snapshot was published, users and groups are answered from it and GitLab is only asked for
+	 * entries that are missing from the snapshot if the fallback is enabled.
+	 *
+	 * Enumerations and the revalidation fetch the groups of many users at once if the GitLab backend supports it.
+	 *
+	 * Frequently used entries are fetched again in the background shortly before they expire and entries that just
+	 * expired are still returned while they are fetched again, such that lookups rarely wait for GitLab. Expired
+	 * entries are kept around beyond that: If GitLab cannot be asked (e.g. during an outage), they are still served
+	 * for up to the configured time. The cached entries can be saved to and restored from a Checkpoint.
+	 *
+	 * Lookups may be made from any thread that runs a kj event loop. Those that are answered from the snapshot or the
+	 * caches are answered on the calling thread; everything that asks GitLab is done on the thread that created this
+	 * object, whose event loop drives the HTTP client. The remaining methods must only be called from that thread.
+	 *
+	 * Lookups that wait for GitLab are sent with interactive priority; refreshes, revalidation and listings are sent
+	 * with background priority. A lookup that joins a refresh in flight raises the priority of its requests.
+	 */
+	class CachedGitLab final {
+	private:
+		struct Members {
+			std::vector<std::string> usernames;
+			std::chrono::steady_clock::time_point fetched;
+		};
+
+		/** A key of the fingerprint index together with its owner **/
+		struct IndexedKey {
+			std::string username;
+			SSHKey key;
+		};
+
+		/** The entries that are left to revalidate or to refresh before they expire **/
+		struct Revalidation {
+			std::vector<UserID> users;
+			std::vector<GroupID> groups;
+			std::vector<UserID> keys;
+			std::vector<std::string> keyNames;
+			std::vector<GroupID> members;
+			/** How many users are fetched at once **/
+			std::size_t usersPerRequest;
+			std::size_t next = 0;
+		};
+
+		/** The users of an enumerated batch that are left to fetch including their groups **/
+		struct Completion {
+			std::vector<UserID> ids;
+			std::size_t next = 0;
+			std::vector<User> users;
+			std::optional<Error> error;
+		};
+
+	public:
+		/** One batch of an enumeration **/
+		template <typename T>
+		struct Batch {
+			std::vector<T> entries;
+			/** Where the next batch starts **/
+			unsigned next;
+			/** Whether this is the last batch **/
+			bool done;
+		};
+
+		/** Everything that is currently known **/
+		struct Contents {
+			std::vector<User> users;
+			std::vector<Group> groups;
+			/** The members of those groups whose members are known **/
+			std::unordered_map<GroupID, std::vector<std::string>> members;
+			/** Whether these are all users and groups and anything else does not exist **/
+			bool complete;
+			/** Whether these come from a directory snapshot **/
+			bool synced;
+		};
+
+		struct Stats {
+			TTLCache<UserID, User>::Stats usersByID;
+			TTLCache<std::string, User>::Stats usersByName;
+			TTLCache<GroupID, Group>::Stats groupsByID;
+			TTLCache<std::string, Group>::Stats groupsByName;
+			TTLCache<UserID, std::vector<SSHKey>>::Stats keys;
+			TTLCache<std::string, std::vector<SSHKey>>::Stats keysByName;
+			TTLCache<GroupID, Members>::Stats members;
+			TTLCache<std::string, IndexedKey>::Stats fingerprints;
+			NegativeCache<UserID>::Stats unknownUserIDs;
+			NegativeCache<std::string>::Stats unknownUsernames;
+			NegativeCache<GroupID>::Stats unknownGroupIDs;
+			NegativeCache<std::string>::Stats unknownGroupnames;
+			NegativeCache<std::string>::Stats unknownFingerprints;
+			/** Lookups that were answered by a request to GitLab that another lookup started **/
+			std::size_t coalesced;
+		};
+
+	private:
+		const GitLab& gitlab;
+		const SnapshotStore& snapshots;
+		const bool fallback;
+		const std::chrono::seconds membersRefreshAfter;
+		const std::chrono::seconds staleIfError;
+		const std::chrono::seconds keysTTL;
+		/** How many requests an enumerated batch sends at once to complete its users **/
+		const unsigned listingConcurrency;
+		/** The executor of the thread that asks GitLab **/
+		const kj::Executor& home;
+		/** Whether unknown fingerprints are looked up at GitLab; cleared once GitLab refuses that to the token **/
+		bool lookupFingerprints;
+		/** Set while restored entries are revalidated; until then, expired entries are served without asking GitLab **/
+		std::atomic<bool> revalidating = false;
+		ShardedTTLCache<UserID, User> usersByID;
+		ShardedTTLCache<std::string, User> usersByName;
+		ShardedTTLCache<GroupID, Group> groupsByID;
+		ShardedTTLCache<std::string, Group> groupsByName;
+		ShardedTTLCache<UserID, std::vector<SSHKey>> keys;
+		ShardedTTLCache<std::string, std::vector<SSHKey>> keysByName;
+		ShardedTTLCache<GroupID, Members> members;
+		/** The keys that were fetched by their SHA-256 fingerprint **/
+		ShardedTTLCache<std::string, IndexedKey> fingerprints;
+		ShardedNegativeCache<UserID> unknownUserIDs;
+		ShardedNegativeCache<std::string> unknownUsernames;
+		ShardedNegativeCache<GroupID> unknownGroupIDs;
+		ShardedNegativeCache<std::string> unknownGroupnames;
+		/** Fingerprints that are no key of a user, by the username and the fingerprint separated by a space **/
+		ShardedNegativeCache<std::string> unknownFingerprints;
+		SingleFlight<UserID, std::expected<User, Error>, Urgency> userByIDFlights;
+		SingleFlight<std::string, std::expected<User, Error>, Urgency> userByNameFlights;
+		SingleFlight<UserID, std::expected<std::vector<SSHKey>, Error>, Urgency> keyFlights;
+		SingleFlight<std::string, std::expected<std::vector<SSHKey>, Error>, Urgency> keyByNameFlights;
+		SingleFlight<std::string, std::expected<OwnedKey, Error>> fingerprintFlights;
+		SingleFlight<GroupID, std::expected<Group, Error>, Urgency> groupByIDFlights;
+		SingleFlight<std::string, std::expected<Group, Error>, Urgency> groupByNameFlights;
+		SingleFlight<GroupID, std::expected<std::vector<std::string>, Error>, Urgency> memberFlights;
+
+		template <typename F>
+		auto onHome(F&& f) -> decltype(f());
+		template <typename T, typename Key>
+		std::optional<std::expected<T, Error>> fromSnapshot(const Key& key) const;
+		template <typename Key, typename Value, typename F>
+		std::optional<std::expected<Value, Error>> fromCache(
+				ShardedTTLCache<Key, Value>& cache, const Key& key, F&& refresh
+		);
+		void remember(const User& user);
+		void remember(const Group& group);
+		template <typename Key>
+		void remember(ShardedTTLCache<Key, std::vector<SSHKey>>& cache, const Key& key, std::vector<SSHKey> fetched);
+		void index(
+				const std::string& username, const std::vector<SSHKey>& keys,
+				std::chrono::steady_clock::time_point expires
+		);
+		std::optional<std::expected<std::string, Error>> fromIndex(
+				const std::string& username, const std::string& fingerprint
+		);
+		std::expected<std::string, Error> fromKeys(
+				const std::string& username, const std::string& fingerprint, const std::vector<SSHKey>& keys
+		);
+		Result<User> refreshUser(UserID id, Priority priority);
+		Result<User> refreshUser(const std::string& username, Priority priority);
+		Result<std::vector<User>> refreshUsers(std::vector<UserID> ids, Priority priority);
+		Result<std::vector<SSHKey>> refreshKeys(UserID id, Priority priority);
+		Result<std::vector<SSHKey>> refreshKeys(const std::string& username, Priority priority);
+		Result<std::string> refreshKey(const std::string& username, const std::string& fingerprint);
+		Result<Group> refreshGroup(GroupID id, Priority priority);
+		Result<Group> refreshGroup(const std::string& groupname, Priority priority);
+		Result<std::vector<std::string>> refreshMembers(GroupID id, Priority priority);
+		kj::Promise<void> completionWorker(std::shared_ptr<Completion> state);
+		Result<std::vector<User>> complete(std::vector<UserID> ids);
+		Result<Batch<User>> fetchUsers(unsigned cursor, unsigned count);
+		kj::Promise<void> revalidationWorker(std::shared_ptr<Revalidation> state);
+
+	public:
+		CachedGitLab(const Config& config, const GitLab& gitlab, const SnapshotStore& snapshots) noexcept;
+
+		Result<User> getUserByID(UserID id);
+		Result<User> getUserByName(const std::string& username);
+
+		/**
+		 * @brief Returns the user's SSH keys that have not expired.
+		 * @details Keys are cached separately from users, at most until the first of them expires.
+		 */
+		Result<std::vector<std::string>> getAuthorizedKeys(UserID id);
+		/** @brief Returns the keys like getAuthorizedKeys(UserID) without looking up the user **/
+		Result<std::vector<std::string>> getAuthorizedKeys(const std::string& username);
+		/**
+		 * @brief Returns the user's key with the SHA-256 fingerprint that sshd passes to the AuthorizedKeysCommand.
+		 * @details Keys that were seen before are indexed by their fingerprint. For unknown fingerprints, all of the
+		 * user's keys are fetched and indexed, such that attempts with their other keys are answered from memory, or,
+		 * if gitlabapi.fingerprintLookup is set, the fingerprint is looked up at GitLab. Fingerprints that are no key
+		 * of the user are remembered like unknown users, such that repeated probes with foreign keys do not ask GitLab
+		 * again.
+		 */
+		Result<std::string> getAuthorizedKey(const std::string& username, const std::string& fingerprint);
+
+		Result<Group> getGroupByID(GroupID id);
+		Result<Group> getGroupByName(const std::string& groupname);
+		/**
+		 * @brief Returns the usernames of the group's members.
+		 * @details Member lists are fetched page by page and cached separately from the group. Cached lists older
+		 * than the configured refresh time are still returned but fetched again in the background.
+		 */
+		Result<std::vector<std::string>> getGroupMembers(GroupID id);
+		/**
+		 * @brief Returns the usernames of the group's members if they are in the snapshot or cached, without asking
+		 * GitLab, e.g. for listings, which would otherwise fetch the members of every group.
+		 */
+		std::optional<std::vector<std::string>> knownGroupMembers(GroupID id);
+
+		/**
+		 * @brief Enumerates up to count users (including their groups) starting at cursor, which is 0 for the first
+		 * batch and Batch::next for the following ones.
+		 * @details Served from the most recent snapshot if there is one and from GitLab's user listing otherwise. The
+		 * cursors of the two differ; continuing an enumeration on the other one (i.e. once the first snapshot was
+		 * published) fails with Error::GenericError, such that it is started over instead of repeating or skipping
+		 * entries.
+		 */
+		Result<Batch<User>> listUsers(unsigned cursor, unsigned count);
+		/** @brief Enumerates groups like listUsers() **/
+		Result<Batch<Group>> listGroups(unsigned cursor, unsigned count);
+
+		/** @return the most recent snapshot's entries if there is one and the cached entries otherwise **/
+		Contents contents() const;
+
+		/** @return all cached entries that may still be served, including expired ones **/
+		Checkpoint checkpoint() const;
+		/** @brief Adds the checkpoint's entries to the caches, keeping their expiry times **/
+		void restore(Checkpoint&& checkpoint);
+		/**
+		 * @brief Fetches all cached entries again with at most concurrency requests in flight at once. Until done,
+		 * lookups are answered from expired entries instead of waiting for GitLab.
+		 */
+		kj::Promise<void> revalidate(unsigned concurrency);
+		/**
+		 * @brief Fetches the users, groups and member lists that contents() returns again if they expire within the
+		 * given time, with at most concurrency requests in flight at once.
+		 * @details Lookups answered from the shared table never reach the cache, so its hottest entries would never
+		 * be refreshed ahead and drop out of the table once they expire. Nothing is fetched while a snapshot is used.
+		 */
+		kj::Promise<void> refreshExpiring(std::chrono::steady_clock::duration within, unsigned concurrency);
+
+		Stats stats() const noexcept;
+	};
+} // namespace gitlab
+
+#endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "gitlabapi.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace gitlab {
+	/**
+	 * @brief The daemon's cached users, groups, keys and group members as written to disk, such that a restarted
+	 * daemon starts with warm caches and can keep answering while GitLab is unreachable.
+	 * @details The file is a versioned header followed by length prefixed records in host byte order. It is mapped
+	 * and decoded in a single pass; a file with another magic or version or that is truncated is ignored as a whole.
+	 * Expiry times are stored as seconds since the epoch such that they stay meaningful across restarts.
+	 */
+	struct Checkpoint {
+		struct Header {
+			static constexpr uint32_t Magic = 0x434e4c47; // "GLNC"
+			static constexpr uint32_t Version = 3;
+
+			uint32_t magic;
+			uint32_t version;
+			uint32_t userCount;
+			uint32_t groupCount;
+			uint32_t keyCount;
+			uint32_t namedKeyCount;
+			uint32_t memberCount;
+			/** Fills what would otherwise be padding before written, such that the header is written out in full **/
+			uint32_t reserved = 0;
+			/** Seconds since the epoch at which the checkpoint was written **/
+			int64_t written;
+		};
+
+		template <typename T>
+		struct Entry {
+			T value;
+			/** Seconds since the epoch at which the entry expired or expires **/
+			int64_t expires;
+		};
+		struct Keys {
+			UserID id;
+			std::vector<SSHKey> keys;
+		};
+		/** Keys that were looked up by username **/
+		struct NamedKeys {
+			std::string username;
+			std::vector<SSHKey> keys;
+		};
+		struct Members {
+			GroupID id;
+			std::vector<std::string> usernames;
+		};
+
+		std::vector<Entry<User>> users;
+		std::vector<Entry<Group>> groups;
+		std::vector<Entry<Keys>> keys;
+		std::vector<Entry<NamedKeys>> namedKeys;
+		std::vector<Entry<Members>> members;
+
+		/**
+		 * @brief Reads the checkpoint at path.
+		 * @return std::nullopt if there is none or it is not a valid checkpoint owned by and only writable by the
+		 * current user.
+		 */
+		static std::optional<Checkpoint> load(const std::filesystem::path& path);
+
+		/**
+		 * @brief Atomically replaces the checkpoint at path, creating its directory if needed. Blocks until the
+		 * checkpoint is on disk.
+		 * @return the error of the call that failed if the checkpoint could not be written
+		 */
+		std::error_code save(const std::filesystem::path& path) const;
+	};
+} // namespace gitlab
+
+#endif
\ No newline at end of file
@@ -1,18 +1,72 @@
 #ifndef CONFIG_HPP
 #define CONFIG_HPP
 
+#include <cstddef>
 #include <filesystem>
 #include <string>
+#include <vector>
 
 struct Config {
+	/** Which of GitLab's APIs users and their groups are fetched from **/
+	enum class Backend { REST, GraphQL };
+
 	// general settings
 	static constexpr const char DefaultSocketPath[] = "/var/run/gitlabnss.sock";
 	static constexpr uint16_t DefaultSocketPerms = 0666u;
 	static constexpr const char DefaultSocketOwner[] = "root:root";
+	static constexpr unsigned DefaultThreads = 4;
 	// gitlabapi settings
-	// (no defaults)
+	static constexpr unsigned DefaultMaxConnections = 8;
+	static constexpr unsigned DefaultIdleTimeout = 60;
+	static constexpr unsigned DefaultConnectTimeout = 10;
+	static constexpr unsigned DefaultRequestTimeout = 30;
+	static constexpr bool DefaultHTTP2 = true;
+	static constexpr unsigned DefaultPageConcurrency = 4;
+	static constexpr unsigned DefaultRateLimit = 1200;
+	static constexpr unsigned DefaultRateBurst = 50;
+	static constexpr unsigned DefaultMaxAttempts = 4;
+	static constexpr unsigned DefaultQueueTimeout = 5;
+	static constexpr bool DefaultFingerprintLookup = false;
+	static constexpr Backend DefaultBackend = Backend::REST;
+	// cache settings
+	static constexpr unsigned DefaultUserCacheTTL = 300;
+	static constexpr unsigned DefaultGroupCacheTTL = 300;
+	static constexpr unsigned DefaultKeyCacheTTL = 60;
+	static constexpr unsigned DefaultMemberCacheTTL = 3600;
+	static constexpr unsigned DefaultMemberCacheRefresh = 300;
+	static constexpr std::size_t DefaultCacheEntries = 10000;
+	static constexpr unsigned DefaultNegativeCacheTTL = 30;
+	static constexpr std::size_t DefaultNegativeCacheEntries = 100000;
+	static constexpr std::size_t DefaultNegativeCacheFilterBits = 1u << 24;
+	static constexpr unsigned DefaultStaleIfError = 86400;
+	static constexpr unsigned DefaultMaxStale = 60;
+	static constexpr unsigned DefaultRefreshAhead = 30;
+	static constexpr unsigned DefaultHotUses = 3;
+	// sync settings
+	static constexpr bool DefaultSyncEnabled = false;
+	static constexpr unsigned DefaultSyncInterval = 600;
+	static constexpr unsigned MinSyncInterval = 60; // a sync enumerates all of GitLab, never start them back to back
+	static constexpr unsigned DefaultSyncConcurrency = 4;
+	static constexpr bool DefaultSyncFallback = true;
+	// shared table settings
+	static constexpr bool DefaultSharedTableEnabled = true;
+	static constexpr const char DefaultSharedTablePath[] = "/var/run/gitlabnss.table";
+	static constexpr unsigned DefaultSharedTableInterval = 30;
+	// checkpoint settings
+	static constexpr bool DefaultCheckpointEnabled = true;
+	static constexpr const char DefaultCheckpointPath[] = "/var/cache/gitlabnss/cache.bin";
+	static constexpr unsigned DefaultCheckpointInterval = 300;
+	static constexpr unsigned DefaultCheckpointConcurrency = 4;
+	// metrics settings
+	static constexpr bool DefaultMetricsEnabled = false;
+	static constexpr const char DefaultMetricsAddress[] = "unix:/var/run/gitlabnss.metrics.sock";
+	// logging settings
+	static constexpr const char DefaultLogLevel[] = "info";
+	static constexpr const char DefaultNSSLogLevel[] = "error";
+	static constexpr unsigned DefaultLogRepeatInterval = 60;
 	// nss settings
 	static constexpr uint16_t DefaultHomePerms = 0700u;
+	static constexpr bool DefaultProvisionHomes = true;
 	static constexpr unsigned DefaultUIDOffset = 0;
 	static constexpr unsigned DefaultGIDOffset = 0;
 	static constexpr const char DefaultShell[] = "/usr/bin/bash";
@@ -21,19 +75,86 @@ struct Config {
 		std::filesystem::path socketPath;
 		uint16_t socketPerms;
 		std::string socketOwner;
+		unsigned threads; // that answer lookups; 0 for one per CPU core
 	} general;
 	struct {
 		std::string baseUrl;
 		std::string apikey;
+		unsigned maxConnections;
+		unsigned idleTimeout;	 // in seconds
+		unsigned connectTimeout; // in seconds; 0 for curl's default
+		unsigned requestTimeout; // in seconds, including the connect; 0 for none
+		bool http2;
+		unsigned pageConcurrency; // pages of a listing that are fetched at once
+		unsigned rateLimit;		  // requests per minute; 0 to only follow GitLab's rate limit headers
+		unsigned rateBurst;		  // requests that may be sent at once after a quiet period
+		unsigned maxAttempts;	  // per request that GitLab answers with 429 Too Many Requests
+		unsigned queueTimeout;	  // in seconds that interactive requests may wait to be sent; 0 for no limit
+		bool fingerprintLookup;	  // whether SSH keys are looked up by fingerprint, which needs an administrator's token
+		Backend backend;
 	} gitlabapi;
+	struct CacheSettings {
+		unsigned ttl; // in seconds; 0 disables the cache
+		std::size_t maxEntries;
+	};
+	struct MemberCacheSettings {
+		unsigned ttl;		   // in seconds; 0 disables the cache
+		unsigned refreshAfter; // in seconds; older entries are still served but refreshed in the background
+		std::size_t maxEntries;
+	};
+	struct NegativeCacheSettings {
+		unsigned ttl; // in seconds; 0 disables the cache
+		std::size_t maxEntries;
+		std::size_t filterBits;
+	};
+	struct {
+		CacheSettings users;
+		CacheSettings groups;
+		CacheSettings keys;
+		MemberCacheSettings members;
+		NegativeCacheSettings negative;
+		unsigned staleIfError; // in seconds; how long expired entries are served if GitLab cannot be asked
+		unsigned maxStale;	   // in seconds; how long expired entries are served while they are fetched again
+		unsigned refreshAhead; // in seconds before expiry at which hot entries are fetched again
+		unsigned hotUses;	   // uses per time to live from which on an entry is hot
+	} cache;
+	struct {
+		bool enabled;
+		unsigned interval; // in seconds
+		unsigned concurrency;
+		bool fallback;
+	} sync;
+	struct {
+		bool enabled;
+		std::filesystem::path path;
+		unsigned interval; // in seconds
+	} sharedTable;
+	struct {
+		bool enabled;
+		std::filesystem::path path;
+		unsigned interval; // in seconds
+		unsigned concurrency;
+	} checkpoint;
+	struct {
+		bool enabled;
+		std::string address; // host:port or unix:path
+	} metrics;
+	struct {
+		std::string level;		 // of the daemon: trace, debug, info, warn, error, critical or off
+		std::string nssLevel;	 // of the NSS module, which logs to the standard error of the process that looks up
+		unsigned repeatInterval; // in seconds; identical warnings and errors within it are logged once
+	} logging;
 	struct {
 		std::filesystem::path homesRoot;
 		uint16_t homePerms;
+		bool provisionHomes; // by the daemon, for users that it answered lookups for
 		unsigned uidOffset;
 		unsigned gidOffset;
 		std::string groupPrefix;
 		std::string shell;
 	} nss;
+	/** What is wrong with the file, e.g. values that were replaced by defaults; for the caller to report **/
+	std::vector<std::string> problems;
 
 	static Config fromFile(const std::filesystem::path& file) noexcept;
 };
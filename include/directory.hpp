@@ -0,0 +1,90 @@
+#ifndef DIRECTORY_HPP
+#define DIRECTORY_HPP
+
+#include "config.hpp"
+#include "error.hpp"
+#include "gitlabapi.hpp"
+
+#include <kj/async.h>
+#include <kj/timer.h>
+
+#include <atomic>
+#include <chrono>
+#include <expected>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gitlab {
+	/**
+	 * @brief An immutable copy of all users (including their groups) and groups known to GitLab, indexed by id and
+	 * by name.
+	 */
+	class Snapshot final {
+	private:
+		std::vector<User> users;
+		std::vector<Group> groups;
+		std::unordered_map<UserID, std::size_t> userByID;
+		std::unordered_map<std::string, std::size_t> userByName;
+		std::unordered_map<GroupID, std::size_t> groupByID;
+		std::unordered_map<std::string, std::size_t> groupByName;
+		std::unordered_map<GroupID, std::vector<std::string>> membersByGroup;
+
+	public:
+		/** When the data was fetched from GitLab **/
+		const std::chrono::system_clock::time_point created;
+
+		Snapshot(std::vector<User>&& users, std::vector<Group>&& groups);
+
+		const User* findUser(UserID id) const noexcept;
+		const User* findUser(const std::string& username) const noexcept;
+		const Group* findGroup(GroupID id) const noexcept;
+		const Group* findGroup(const std::string& groupname) const noexcept;
+		/** @return the usernames of the group's members or nullptr if the group is unknown **/
+		const std::vector<std::string>* findMembers(GroupID id) const noexcept;
+
+		const std::vector<User>& allUsers() const noexcept { return users; }
+		const std::vector<Group>& allGroups() const noexcept { return groups; }
+	};
+
+	/**
+	 * @brief Holds the most recent Snapshot. Publishing a new one atomically replaces it for all readers while those
+	 * that still use the previous one keep it alive.
+	 */
+	class SnapshotStore final {
+	private:
+		std::atomic<std::shared_ptr<const Snapshot>> current;
+
+	public:
+		/** @return the most recent snapshot or nullptr if none was published yet **/
+		std::shared_ptr<const Snapshot> get() const noexcept { return current.load(std::memory_order_acquire); }
+		void publish(std::shared_ptr<const Snapshot> snapshot) noexcept {
+			current.store(std::move(snapshot), std::memory_order_release);
+		}
+	};
+
+	/**
+	 * @brief Periodically enumerates all users, their memberships and all groups and publishes them as a
+	 * new Snapshot.
+	 */
+	class DirectorySync final {
+	private:
+		const Config& config;
+		const GitLab& gitlab;
+		SnapshotStore& store;
+		kj::Timer& timer;
+
+		kj::Promise<std::expected<void, Error>> fetchMemberships(std::shared_ptr<std::vector<User>> users);
+
+	public:
+		DirectorySync(const Config& config, const GitLab& gitlab, SnapshotStore& store, kj::Timer& timer) noexcept;
+
+		/** Fetches the whole directory once and publishes it **/
+		kj::Promise<std::expected<void, Error>> sync();
+		/** Syncs now and then every configured interval, forever **/
+		kj::Promise<void> run();
+	};
+} // namespace gitlab
+
+#endif
\ No newline at end of file
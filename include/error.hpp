@@ -8,6 +8,8 @@ enum class Error {
 	ServerError,
 	ResponseFormatError,
 	GenericError,
+	/** GitLab kept answering with 429 Too Many Requests or its rate limit held up a lookup for too long **/
+	RateLimited,
 };
 
 #endif
\ No newline at end of file
@@ -3,7 +3,12 @@
 
 #include "config.hpp"
 #include "error.hpp"
+#include "scheduler.hpp"
 
+#include <kj/async.h>
+
+#include <cstdint>
+#include <expected>
 #include <string>
 #include <vector>
 
@@ -24,21 +29,95 @@ namespace gitlab {
 		std::vector<Group> groups;
 	};
 
+	/** An SSH key of a user that is usable for authentication **/
+	struct SSHKey {
+		std::string key;
+		/** Seconds since the epoch from which on GitLab no longer accepts the key; 0 if it does not expire **/
+		int64_t expires;
+
+		bool expired(int64_t now) const noexcept { return expires != 0 && expires <= now; }
+	};
+
+	/** An SSH key together with the user it belongs to **/
+	struct OwnedKey {
+		SSHKey key;
+		UserID user;
+		std::string username;
+	};
+
+	template <typename T>
+	using Result = kj::Promise<std::expected<T, Error>>;
+
+	/**
+	 * @brief GitLab's REST API and, if gitlabapi.backend says so, its GraphQL API for users and their groups.
+	 * @details Listings are fetched in full: The first page tells how many there are and the remaining pages are then
+	 * fetched concurrently, at most gitlabapi.pageConcurrency at once. Listings of all users or groups are sent with
+	 * background priority.
+	 *
+	 * Through the GraphQL API, a user is fetched together with their groups in one request and up to 100 users are
+	 * fetched at once. The groups of users who are members of more than 100 groups are fetched through the REST API.
+	 */
 	class GitLab final {
 	private:
 		const Config& config;
+		Scheduler& scheduler;
+		const std::string graphqlUrl;
+
+		Result<User> withGroups(std::expected<User, Error>&& user, Urgency urgency) const;
+		Result<std::vector<User>> queryUsers(std::string query, Urgency urgency) const;
 
 	public:
-		explicit GitLab(const Config& config) noexcept;
+		GitLab(const Config& config, Scheduler& scheduler) noexcept;
+
+		/** Fetches the user without their groups **/
+		Result<User> fetchUserByUsername(std::string username, Urgency urgency = Priority::Interactive) const;
+		/** Fetches the user without their groups **/
+		Result<User> fetchUserByID(UserID id, Urgency urgency = Priority::Interactive) const;
+		/** Fetches the user including their groups **/
+		Result<User> fetchUserWithGroups(std::string username, Urgency urgency = Priority::Interactive) const;
+		/** Fetches the user including their groups **/
+		Result<User> fetchUserWithGroups(UserID id, Urgency urgency = Priority::Interactive) const;
+		/** Fetches the users including their groups; users that do not exist are left out **/
+		Result<std::vector<User>> fetchUsersWithGroups(
+				std::vector<UserID> ids, Urgency urgency = Priority::Background
+		) const;
+		/** @return how many users fetchUsersWithGroups() fetches with one request **/
+		unsigned usersPerRequest() const noexcept;
+		/** Raises the urgency of requests that were started with it, see Scheduler::raise() **/
+		void raise(const Urgency& urgency, Priority priority) const;
 
-		Error fetchUserByUsername(std::string username, User& user) const;
-		Error fetchUserByID(UserID id, User& user) const;
+		Result<std::vector<SSHKey>> fetchAuthorizedKeys(UserID id, Urgency urgency = Priority::Interactive) const;
+		/**
+		 * @brief Fetches the keys by username with a single request, without looking up the user first.
+		 * @details Usernames that GitLab does not allow (which may not be put into a URL path as they are) are
+		 * Error::NotFound without asking.
+		 */
+		Result<std::vector<SSHKey>> fetchAuthorizedKeys(
+				const std::string& username, Urgency urgency = Priority::Interactive
+		) const;
+		/**
+		 * @brief Fetches the key with the SHA-256 fingerprint (as `ssh-keygen -l` prints it) together with its owner.
+		 * @details GitLab only answers administrators; keys that are not usable for authentication are
+		 * Error::NotFound.
+		 */
+		Result<OwnedKey> fetchKeyByFingerprint(
+				const std::string& fingerprint, Urgency urgency = Priority::Interactive
+		) const;
+		Result<std::vector<Group>> fetchGroups(UserID id, Urgency urgency = Priority::Interactive) const;
 
-		Error fetchAuthorizedKeys(UserID id, std::vector<std::string>& keys) const;
-		Error fetchGroups(User& user) const;
+		Result<Group> fetchGroupByName(std::string groupname, Urgency urgency = Priority::Interactive) const;
+		Result<Group> fetchGroupByID(GroupID id, Urgency urgency = Priority::Interactive) const;
+		/** Lists the usernames of the group's direct members **/
+		Result<std::vector<std::string>> fetchGroupMembers(GroupID id, Urgency urgency = Priority::Interactive) const;
 
-		Error fetchGroupByName(std::string groupname, Group& group) const;
-		Error fetchGroupByID(GroupID id, Group& group) const;
+		/** Lists one page of all users (without their groups); pages are counted from 1 **/
+		Result<std::vector<User>> fetchUserPage(unsigned page, unsigned perPage) const;
+		/** Lists one page of all groups; pages are counted from 1 **/
+		Result<std::vector<Group>> fetchGroupPage(unsigned page, unsigned perPage) const;
+		/** Lists all users (without their groups) **/
+		Result<std::vector<User>> fetchAllUsers() const;
+		/** Lists all groups **/
+		Result<std::vector<Group>> fetchAllGroups() const;
 	};
 } // namespace gitlab
 
@@ -0,0 +1,59 @@
+#ifndef GITLABJSON_HPP
+#define GITLABJSON_HPP
+
+#include "error.hpp"
+#include "gitlabapi.hpp"
+
+#include <expected>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Decoders for the bodies of GitLab's API responses and encoders for GraphQL requests.
+ * @details The bodies are parsed in place with rapidjson's SAX reader: Only the fields that are needed are picked from
+ * the stream and copied into the result, no DOM is built and unescaped strings are not copied in between. Since
+ * parsing in place modifies the body, it is taken by rvalue reference. Responses of an unexpected shape or that lack a
+ * needed field are reported as Error::ResponseFormatError.
+ */
+namespace gitlab::json {
+	/** A user of a GraphQL response **/
+	struct QueriedUser {
+		/** Including the groups that the response contained **/
+		User user;
+		/** Whether the user is a member of more groups than the response contained **/
+		bool moreGroups;
+	};
+
+	/** The maximum number of users, and of groups per user, that a GraphQL response contains **/
+	inline constexpr unsigned MaxQueriedUsers = 100;
+
+	/** A single user object (without groups) **/
+	std::expected<User, Error> parseUser(std::string&& body);
+	/** An array of user objects (without groups) **/
+	std::expected<std::vector<User>, Error> parseUsers(std::string&& body);
+	/** A single group object **/
+	std::expected<Group, Error> parseGroup(std::string&& body);
+	/** An array of group objects **/
+	std::expected<std::vector<Group>, Error> parseGroups(std::string&& body);
+	/** An array of a user's memberships, of which those in groups (not projects) are returned **/
+	std::expected<std::vector<Group>, Error> parseMemberships(std::string&& body);
+	/** An array of SSH keys, of which those usable for authentication are returned (expired ones included) **/
+	std::expected<std::vector<SSHKey>, Error> parseKeys(std::string&& body);
+	/**
+	 * A single key object including its user, as GitLab returns it when looked up by fingerprint; std::nullopt if the
+	 * key is not usable for authentication
+	 */
+	std::expected<std::optional<OwnedKey>, Error> parseOwnedKey(std::string&& body);
+	/** An array of members, of which the usernames are returned **/
+	std::expected<std::vector<std::string>, Error> parseUsernames(std::string&& body);
+
+	/** A GraphQL request for the users with the IDs (at most MaxQueriedUsers) including their groups **/
+	std::string queryUsersByID(const std::vector<UserID>& ids);
+	/** A GraphQL request for the users with the usernames (at most MaxQueriedUsers) including their groups **/
+	std::string queryUsersByUsername(const std::vector<std::string>& usernames);
+	/** The response to a request built by queryUsersByID() or queryUsersByUsername() **/
+	std::expected<std::vector<QueriedUser>, Error> parseQueriedUsers(std::string&& body);
+} // namespace gitlab::json
+
+#endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef HOMES_HPP
+#define HOMES_HPP
+
+#include "config.hpp"
+#include "gitlabapi.hpp"
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace gitlab {
+	/**
+	 * @brief Creates the home directories of the users that the daemon answered lookups for, such that neither the
+	 * NSS module nor the daemon's event loop ever waits on the (possibly remote) file system.
+	 * @details Each user's home is requested at most once per run of the daemon. Requests are queued and a worker
+	 * thread creates the queued homes in batches. Homes that exist already are left as they are; a home whose creation
+	 * failed is requested again with the user's next lookup.
+	 */
+	class HomeProvisioner final {
+	private:
+		struct Home {
+			UserID id;
+			std::filesystem::path path;
+			uid_t uid;
+			gid_t gid;
+		};
+
+		const Config& config;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		/** The users whose home is queued or was provisioned **/
+		std::unordered_set<UserID> known;
+		std::vector<Home> pending;
+		bool stopping = false;
+		std::thread worker;
+
+		void run();
+
+	public:
+		/** Starts the worker thread if provisioning is enabled in the config **/
+		explicit HomeProvisioner(const Config& config);
+		/** Stops the worker thread after its current batch; homes that are still queued are not created **/
+		~HomeProvisioner();
+		HomeProvisioner(const HomeProvisioner&) = delete;
+		HomeProvisioner& operator=(const HomeProvisioner&) = delete;
+
+		/** Queues the creation of the user's home unless it was requested before **/
+		void request(const User& user);
+	};
+} // namespace gitlab
+
+#endif
\ No newline at end of file
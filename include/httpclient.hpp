@@ -0,0 +1,79 @@
+#ifndef HTTPCLIENT_HPP
+#define HTTPCLIENT_HPP
+
+#include "config.hpp"
+
+#include <curl/curl.h>
+#include <kj/async-io.h>
+#include <kj/async-unix.h>
+#include <kj/timer.h>
+#include <kj/vector.h>
+
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gitlab {
+	struct Response {
+		/** The HTTP status code or 0 if no response was received **/
+		long status;
+		std::string body;
+		/** Response headers by lower case name **/
+		std::map<std::string, std::string> headers;
+	};
+
+	/**
+	 * @brief Non-blocking HTTP client that drives libcurl's multi interface from the kj event loop.
+	 * @details Any number of requests can be in flight at once. Sockets are watched through the loop's UnixEventPort
+	 * and curl's timeouts are scheduled on the loop's timer, so waiting for GitLab never blocks other RPCs. Dropping
+	 * the promise returned by get() aborts the request.
+	 *
+	 * Connections are kept alive and reused by all requests of a client, optionally multiplexing requests over HTTP/2.
+	 * DNS results and TLS sessions are shared between all clients in the process such that reconnecting skips the
+	 * lookup and full handshake. Easy handles are recycled instead of set up for every request.
+	 */
+	class HttpClient final : private kj::TaskSet::ErrorHandler {
+	private:
+		class Transfer;
+		class Socket;
+
+		const Config& config;
+		kj::UnixEventPort& eventPort;
+		kj::Timer& timer;
+		CURLM* multi;
+		std::vector<CURL*> idleHandles;
+		std::unordered_map<curl_socket_t, kj::Own<Socket>> sockets;
+		kj::Vector<kj::Own<Socket>> retired;
+		std::optional<kj::Promise<void>> timeout;
+		bool inTimeout = false;
+		std::optional<long> deferredTimeout;
+		kj::TaskSet tasks;
+
+		CURL* acquireHandle();
+		void releaseHandle(CURL* easy);
+
+		static int onSocketUpdate(CURL* easy, curl_socket_t fd, int what, void* userp, void* socketp);
+		static int onTimerUpdate(CURLM* multi, long timeoutMs, void* userp);
+		kj::Promise<void> waitTimeout(long timeoutMs);
+		kj::Promise<void> onTimeout();
+		void act(curl_socket_t fd, int events);
+		void taskFailed(kj::Exception&& exception) override;
+
+	public:
+		HttpClient(const Config& config, kj::UnixEventPort& eventPort, kj::Timer& timer);
+		~HttpClient();
+		HttpClient(const HttpClient&) = delete;
+		HttpClient& operator=(const HttpClient&) = delete;
+
+		kj::Promise<Response> get(const std::string& url, const std::string& bearer);
+		/** POSTs the JSON document body, which is copied right away **/
+		kj::Promise<Response> post(const std::string& url, const std::string& bearer, const std::string& body);
+
+		/** @return the number of connections to GitLab that requests are currently sent over **/
+		std::size_t connections() const noexcept { return sockets.size(); }
+	};
+} // namespace gitlab
+
+#endif
\ No newline at end of file
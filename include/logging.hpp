@@ -0,0 +1,96 @@
+#ifndef LOGGING_HPP
+#define LOGGING_HPP
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief The daemon's logging, which must not slow down lookups.
+ * @details Lines are formatted by the thread that logs and written to the log file by a background thread that takes
+ * them from a bounded queue. If the queue runs full, the oldest lines are dropped rather than blocking the thread that
+ * logs. Warnings and errors that repeat with every lookup, e.g. while GitLab is unreachable, are logged through
+ * limited() at most once per interval.
+ */
+namespace logging {
+	/** @return the level called name in gitlabnss.conf or std::nullopt if there is no such level **/
+	inline std::optional<spdlog::level::level_enum> levelFrom(std::string_view name) noexcept {
+		// spdlog itself calls it "warning"
+		if (name == "warn")
+			return spdlog::level::warn;
+		for (int level = spdlog::level::trace; level < spdlog::level::n_levels; ++level)
+			if (spdlog::level::to_string_view(static_cast<spdlog::level::level_enum>(level)) == name)
+				return static_cast<spdlog::level::level_enum>(level);
+		return std::nullopt;
+	}
+
+	/**
+	 * @brief Sets up the asynchronous logger writing to file (and to the console in debug builds) as the default
+	 * logger.
+	 * @details It starts out at the info level until configure() is called with the config.
+	 */
+	void init(const std::filesystem::path& file);
+
+	/**
+	 * @brief Sets the level and the interval of limited() from gitlabnss.conf's `[logging]`; unknown levels are
+	 * logged and replaced by info.
+	 */
+	void configure(std::string_view level, std::chrono::seconds repeatInterval);
+
+	/** Writes out the lines still queued and stops the background thread **/
+	void shutdown();
+
+	/** Lets through one of any number of identical messages per interval **/
+	class Limiter final {
+	private:
+		using Clock = std::chrono::steady_clock;
+		/** Beyond this many distinct messages, those not logged within the interval are forgotten **/
+		static constexpr std::size_t MaxMessages = 1024;
+
+		struct Entry {
+			Clock::time_point logged;
+			std::size_t suppressed;
+		};
+		std::mutex mutex;
+		std::unordered_map<std::string, Entry> entries;
+		Clock::duration interval{std::chrono::seconds{60}};
+
+	public:
+		void setInterval(Clock::duration interval);
+		/**
+		 * @return the number of identical messages that were suppressed since it was last logged if message is to be
+		 * logged now and std::nullopt otherwise
+		 **/
+		std::optional<std::size_t> admit(const std::string& message);
+	};
+
+	Limiter& limiter() noexcept;
+
+	/**
+	 * @brief Logs the message at most once per interval and counts the identical ones in between.
+	 * @details Meant for warnings and errors that may come up with every lookup. Messages below the logger's level are
+	 * neither formatted nor counted.
+	 */
+	template <typename... Args>
+	void limited(spdlog::level::level_enum level, spdlog::format_string_t<Args...> format, Args&&... args) {
+		if (!spdlog::should_log(level))
+			return;
+		auto message = fmt::format(format, std::forward<Args>(args)...);
+		if (auto suppressed = limiter().admit(message)) {
+			if (*suppressed > 0)
+				spdlog::log(level, "{} ({} identical messages suppressed)", message, *suppressed);
+			else
+				spdlog::log(level, "{}", message);
+		}
+	}
+} // namespace logging
+
+#endif
\ No newline at end of file
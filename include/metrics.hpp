@@ -0,0 +1,123 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <kj/async-io.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Metrics that any thread can record cheaply and that are exposed in Prometheus' text format.
+ * @details Each thread records into one of a fixed number of slots, each on its own cache line, with relaxed atomic
+ * operations. The slots are only summed up when the metrics are scraped.
+ */
+namespace metrics {
+	/** The number of slots that threads record into **/
+	inline constexpr std::size_t Slots = 16;
+
+	/** @return the slot of the calling thread **/
+	std::size_t slot() noexcept;
+
+	class Counter final {
+	private:
+		struct alignas(64) Slot {
+			std::atomic<uint64_t> value{0};
+		};
+		std::array<Slot, Slots> slots;
+
+	public:
+		void add(uint64_t n = 1) noexcept { slots[slot()].value.fetch_add(n, std::memory_order_relaxed); }
+		uint64_t value() const noexcept;
+	};
+
+	class Gauge final {
+	private:
+		struct alignas(64) Slot {
+			std::atomic<int64_t> value{0};
+		};
+		std::array<Slot, Slots> slots;
+
+	public:
+		/** A thread may add to the gauge what another thread subtracts **/
+		void add(int64_t n) noexcept { slots[slot()].value.fetch_add(n, std::memory_order_relaxed); }
+		int64_t value() const noexcept;
+	};
+
+	/** A histogram of durations in seconds **/
+	class Histogram final {
+	public:
+		/** The upper bounds of the buckets in seconds, from cache hits to slow requests to GitLab **/
+		static constexpr std::array<double, 17> Bounds{
+				0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+		};
+
+		struct Snapshot {
+			/** Per bucket, the last one being for durations above all bounds; not cumulative **/
+			std::array<uint64_t, Bounds.size() + 1> counts;
+			double sum;
+			uint64_t count;
+		};
+
+	private:
+		struct alignas(64) Slot {
+			std::array<std::atomic<uint64_t>, Bounds.size() + 1> counts{};
+			std::atomic<uint64_t> nanoseconds{0};
+		};
+		std::array<Slot, Slots> slots;
+
+	public:
+		void observe(std::chrono::steady_clock::duration duration) noexcept;
+		Snapshot snapshot() const noexcept;
+	};
+
+	/**
+	 * @brief Writes metrics in Prometheus' text exposition format.
+	 * @details Labels are passed formatted, e.g. method="getUserByID", and have to be escaped by the caller.
+	 */
+	class Exposition final {
+	private:
+		std::string text;
+
+	public:
+		/** Starts a metric family; its samples have to follow **/
+		void family(std::string_view name, std::string_view type, std::string_view help);
+		void sample(std::string_view name, std::string_view labels, double value);
+		/** Writes the samples of a histogram family **/
+		void histogram(std::string_view name, std::string_view labels, const Histogram::Snapshot& snapshot);
+
+		std::string str() && { return std::move(text); }
+	};
+
+	/**
+	 * @brief Answers every connection with an HTTP response of the current metrics, whatever was requested, such that
+	 * Prometheus and curl can scrape them.
+	 * @details Connections that do not send their request in time are closed, as are those beyond a handful that are
+	 * open at once, such that clients that connect and never speak do not pile up.
+	 */
+	class Server final : private kj::TaskSet::ErrorHandler {
+	private:
+		kj::ConnectionReceiver& listener;
+		kj::Timer& timer;
+		std::function<std::string()> render;
+		std::size_t open = 0;
+		kj::TaskSet connections;
+
+		kj::Promise<void> respond(kj::Own<kj::AsyncIoStream>&& connection);
+		void taskFailed(kj::Exception&& exception) override;
+
+	public:
+		/** @param render returns the metrics in Prometheus' text exposition format **/
+		Server(kj::ConnectionReceiver& listener, kj::Timer& timer, std::function<std::string()> render);
+
+		/** Accepts connections until the promise is dropped **/
+		kj::Promise<void> run();
+	};
+} // namespace metrics
+
+#endif
\ No newline at end of file
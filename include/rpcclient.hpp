@@ -8,26 +8,118 @@
 #include <filesystem>
 #include <format>
 #include <memory>
+#include <optional>
+#include <unistd.h>
+#include <utility>
 
-static std::shared_ptr<GitLabDaemon::Client> initClient(kj::AsyncIoContext& io) {
-	try {
-		auto& waitScope = io.waitScope;
+/**
+ * @brief A connection to the daemon together with the event loop it is driven by. Each thread lazily opens one and
+ * keeps it for all later calls instead of connecting anew for every lookup.
+ */
+class DaemonConnection final {
+private:
+	struct PerThread {
+		pid_t pid = 0;
+		std::unique_ptr<DaemonConnection> connection;
+	};
+
+	kj::AsyncIoContext io;
+	kj::Own<kj::AsyncIoStream> stream;
+	capnp::TwoPartyClient client;
+
+	static kj::Own<kj::AsyncIoStream> connect(kj::AsyncIoContext& io) {
 		auto socketPath = std::filesystem::current_path().root_path() / "var" / "run" / "gitlabnss.sock";
 		auto addrstr = std::format("unix:{}", socketPath.string());
 		kj::Network& network = io.provider->getNetwork();
-		kj::Own<kj::NetworkAddress> addr = network.parseAddress(kj::StringPtr{addrstr.c_str()}).wait(waitScope);
-		struct Anon {
-			kj::Own<kj::AsyncIoStream> conn;
-			capnp::TwoPartyClient client;
-			GitLabDaemon::Client daemon = client.bootstrap().castAs<GitLabDaemon>();
-			explicit Anon(kj::Own<kj::AsyncIoStream>&& conn)
-					: conn(std::move(conn)), client(*(this->conn)), daemon(client.bootstrap().castAs<GitLabDaemon>()) {}
-		};
-		auto anon = std::make_shared<Anon>(std::move(addr->connect().wait(waitScope)));
-		return std::shared_ptr<GitLabDaemon::Client>{anon, &anon->daemon};
-	} catch (std::exception& e) {
-		return nullptr;
+		kj::Own<kj::NetworkAddress> addr = network.parseAddress(kj::StringPtr{addrstr.c_str()}).wait(io.waitScope);
+		return addr->connect().wait(io.waitScope);
+	}
+
+	/**
+	 * @brief Gives up a connection that a forked process inherited. Its socket and the event loop's epoll instance are
+	 * shared with the parent, which still uses them, so nothing may write to, shut down or deregister them: All of the
+	 * connection is leaked except for the event loop, which is destroyed to unregister it from the thread. Otherwise,
+	 * setting up a new one would fail with "This thread already has an EventLoop".
+	 */
+	static void abandon(std::unique_ptr<DaemonConnection> inherited) {
+		auto* leaked = inherited.release();
+		try {
+			// Only closes the child's copies of the loop's own file descriptors
+			auto loop = kj::mv(leaked->io.lowLevelProvider);
+		} catch (...) {
+		}
+	}
+
+	static PerThread& perThread() {
+		thread_local PerThread perThread;
+		if (perThread.pid != getpid()) {
+			if (perThread.connection)
+				abandon(std::move(perThread.connection));
+			perThread.pid = getpid();
+		}
+		return perThread;
+	}
+
+public:
+	/** How long a call may take; outlasts the daemon's own request timeouts such that it only hits a hung daemon **/
+	static constexpr kj::Duration Timeout = 90 * kj::SECONDS;
+
+	GitLabDaemon::Client daemon;
+
+	/** Connects to the daemon; throws if it is not reachable **/
+	DaemonConnection()
+			: io(kj::setupAsyncIo()), stream(connect(io)), client(*stream),
+			  daemon(client.bootstrap().castAs<GitLabDaemon>()) {}
+
+	kj::WaitScope& waitScope() noexcept { return io.waitScope; }
+	kj::Timer& timer() noexcept { return io.provider->getTimer(); }
+
+	/**
+	 * @brief The calling thread's connection, which is opened on first use.
+	 * @return nullptr if the daemon is not reachable
+	 */
+	static DaemonConnection* current() {
+		auto& state = perThread();
+		if (!state.connection) {
+			try {
+				state.connection = std::make_unique<DaemonConnection>();
+			} catch (std::exception& e) {
+				return nullptr;
+			}
+		}
+		return state.connection.get();
+	}
+
+	/** Closes the calling thread's connection such that the next call reconnects **/
+	static void reset() { perThread().connection.reset(); }
+};
+
+/**
+ * @brief Sends a request over the calling thread's connection and waits for the response. If the connection broke
+ * (e.g. because the daemon was restarted), it reconnects and sends the request once more. A request that is not
+ * answered within DaemonConnection::Timeout is given up without a second attempt.
+ * @param send Sends the request given the GitLabDaemon::Client and returns the promise for its response
+ * @return the response or std::nullopt if the daemon is not reachable
+ */
+template <typename F>
+static auto callDaemon(F&& send)
+		-> std::optional<decltype(send(std::declval<GitLabDaemon::Client&>()).wait(std::declval<kj::WaitScope&>()))> {
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		auto* connection = DaemonConnection::current();
+		if (!connection)
+			return std::nullopt;
+		try {
+			return connection->timer()
+					.timeoutAfter(DaemonConnection::Timeout, send(connection->daemon))
+					.wait(connection->waitScope());
+		} catch (kj::Exception& e) {
+			// The late response would still arrive on this connection, so it is replaced in either case
+			DaemonConnection::reset();
+			if (e.getType() == kj::Exception::Type::OVERLOADED)
+				return std::nullopt;
+		}
 	}
+	return std::nullopt;
 }
 
 #endif
\ No newline at end of file
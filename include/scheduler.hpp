@@ -0,0 +1,140 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include "config.hpp"
+#include "httpclient.hpp"
+#include "metrics.hpp"
+
+#include <kj/async.h>
+#include <kj/timer.h>
+
+#include <array>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace gitlab {
+	enum class Priority {
+		/** Lookups that someone is waiting for, e.g. during a login **/
+		Interactive = 0,
+		/** Refreshes of cached entries, revalidation and enumerations **/
+		Background = 1,
+	};
+
+	/**
+	 * @brief The priority of the requests that serve one purpose, e.g. refreshing a cache entry. Copies share it, such
+	 * that Scheduler::raise() also affects requests that are already queued.
+	 */
+	class Urgency final {
+	private:
+		std::shared_ptr<Priority> priority;
+
+		friend class Scheduler;
+
+	public:
+		Urgency(Priority priority) : priority(std::make_shared<Priority>(priority)) {}
+
+		Priority get() const noexcept { return *priority; }
+	};
+
+	/**
+	 * @brief Paces the requests to GitLab such that the API token's quota is not exhausted and sends interactive
+	 * requests ahead of background ones.
+	 * @details Requests wait in one queue per priority and are sent while a token bucket has tokens left. The bucket
+	 * refills at the configured rate, which is lowered further whenever GitLab's RateLimit-Remaining and
+	 * RateLimit-Reset headers tell that the quota would otherwise run out before it resets. Once GitLab answers with
+	 * 429 Too Many Requests, nothing is sent until its Retry-After passed (or, without one, an exponentially growing
+	 * backoff) and the request is queued again at the front of its queue, up to the configured number of attempts.
+	 * Interactive requests that stay queued for longer than the configured queue timeout are answered with 429
+	 * themselves, such that the caller can fall back to what it has cached instead of waiting for the pause to end.
+	 */
+	class Scheduler final : private kj::TaskSet::ErrorHandler {
+	public:
+		struct Stats {
+			std::size_t sent;
+			/** Responses with status 429 **/
+			std::size_t rateLimited;
+			std::size_t retries;
+			/** Interactive requests that were given up because they were queued for too long **/
+			std::size_t expired;
+			std::size_t queued;
+			/** Requests that were sent and not answered yet **/
+			std::size_t inFlight;
+		};
+
+		/** What one of GitLab's endpoints was asked **/
+		struct Endpoint {
+			/** Of the attempts, including those that were answered with 429 **/
+			metrics::Histogram latency;
+			/** The number of responses by HTTP status, 0 standing for requests without a response **/
+			std::map<long, std::size_t> statuses;
+		};
+
+	private:
+		struct Request {
+			std::string url;
+			std::string bearer;
+			/** The JSON document to POST if any **/
+			std::optional<std::string> body;
+			Urgency urgency;
+			unsigned attempts;
+			bool queued;
+			kj::Own<kj::PromiseFulfiller<Response>> fulfiller;
+		};
+
+		const Config& config;
+		HttpClient& http;
+		kj::Timer& timer;
+		std::array<std::deque<std::shared_ptr<Request>>, 2> queues;
+		double tokens;
+		kj::TimePoint refilled;
+		/** The rate (per second) at which the quota lasts until it resets, if GitLab told **/
+		std::optional<double> quotaRate;
+		kj::TimePoint pausedUntil;
+		kj::Duration backoff;
+		std::optional<kj::TimePoint> wakeupAt;
+		/** Whether a queued background request may have been raised to interactive **/
+		bool raised = false;
+		Stats counters{};
+		/** By their path with IDs left out, e.g. /users/:id/keys **/
+		std::map<std::string, Endpoint> endpoints;
+		kj::TaskSet tasks;
+
+		double rate() const noexcept;
+		void refill(kj::TimePoint now);
+		void wakeup(kj::TimePoint at);
+		void regroup();
+		void pump();
+		void send(std::shared_ptr<Request> request);
+		void adapt(const Response& response, kj::TimePoint now);
+		void record(const std::string& url, long status, std::chrono::steady_clock::time_point sent);
+		void push(std::shared_ptr<Request> request, bool front);
+		kj::Promise<Response> enqueue(Request&& request);
+		void taskFailed(kj::Exception&& exception) override;
+
+	public:
+		Scheduler(const Config& config, HttpClient& http, kj::Timer& timer);
+		Scheduler(const Scheduler&) = delete;
+		Scheduler& operator=(const Scheduler&) = delete;
+
+		/** Queues a GET request; dropping the returned promise withdraws it if it was not sent yet **/
+		kj::Promise<Response> get(std::string url, std::string bearer, Urgency urgency);
+		/** Queues a POST request of the JSON document body like get() **/
+		kj::Promise<Response> post(std::string url, std::string bearer, std::string body, Urgency urgency);
+		/** Raises urgency to priority if that is higher, e.g. once someone waits for a background refresh **/
+		void raise(const Urgency& urgency, Priority priority);
+
+		Stats stats() const noexcept;
+		/** Calls f(path, endpoint) for each endpoint that was asked **/
+		template <typename F>
+		void forEachEndpoint(F&& f) const {
+			for (const auto& [path, endpoint] : endpoints)
+				f(path, endpoint);
+		}
+	};
+} // namespace gitlab
+
+#endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+#ifndef SHAREDTABLE_HPP
+#define SHAREDTABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A read-only table of users and groups that the daemon publishes as a file in shared memory such that the NSS
+ * module can answer lookups without asking the daemon.
+ * @details Every published table is immutable. A new table is written to a temporary file and renamed over the
+ * previous one, which is then flagged as retired. Readers keep their mapping until they notice the flag and only then
+ * map the new file, so they never see a partially written table.
+ */
+namespace sharedtable {
+	/** The file layout; all offsets are in bytes from the start of the file **/
+	struct Header {
+		static constexpr uint32_t Magic = 0x534e4c47; // "GLNS"
+		static constexpr uint32_t Version = 1;
+		/** Set if the table contains all users and groups such that a miss means that the entry does not exist **/
+		static constexpr uint32_t Complete = 1u << 0;
+
+		uint32_t magic;
+		uint32_t version;
+		/** Set to 1 by the daemon once a newer table replaced this one; accessed atomically **/
+		uint32_t retired;
+		uint32_t flags;
+		/** Seconds since the epoch after which the table must not be used anymore **/
+		int64_t expires;
+		uint32_t userCount;
+		uint32_t groupCount;
+		/** The number of buckets of each index; always a power of two **/
+		uint32_t userBuckets;
+		uint32_t groupBuckets;
+		uint64_t users;
+		uint64_t groups;
+		uint64_t userByID;
+		uint64_t userByName;
+		uint64_t groupByID;
+		uint64_t groupByName;
+		uint64_t members;
+		uint64_t strings;
+		uint64_t size;
+	};
+
+	/** Strings are offsets into the string section and zero terminated **/
+	struct UserEntry {
+		static constexpr uint32_t NoGroup = UINT32_MAX;
+
+		uint32_t id;
+		/** The primary group's ID or NoGroup **/
+		uint32_t group;
+		uint32_t username;
+		uint32_t name;
+	};
+
+	struct GroupEntry {
+		static constexpr uint32_t UnknownMembers = UINT32_MAX;
+
+		uint32_t id;
+		uint32_t name;
+		/** The first of the group's members in the member section or UnknownMembers **/
+		uint32_t members;
+		uint32_t memberCount;
+	};
+
+	/** What the daemon publishes **/
+	struct UserRecord {
+		uint32_t id;
+		std::optional<uint32_t> group;
+		std::string_view username;
+		std::string_view name;
+	};
+
+	struct GroupRecord {
+		uint32_t id;
+		std::string_view name;
+		/** nullptr if the members are not known **/
+		const std::vector<std::string>* members;
+	};
+
+	/** What readers get; valid as long as the Table they came from **/
+	struct User {
+		uint32_t id;
+		std::optional<uint32_t> group;
+		const char* username;
+		const char* name;
+	};
+
+	struct Group {
+		uint32_t id;
+		const char* name;
+		/** Offsets of the members' usernames in strings **/
+		std::span<const uint32_t> members;
+		const char* strings;
+
+		const char* member(std::size_t i) const noexcept { return strings + members[i]; }
+	};
+
+	enum class Lookup {
+		Found,
+		/** The table is complete and does not contain the entry **/
+		NotFound,
+		/** The table does not know; ask the daemon **/
+		Unknown
+	};
+
+	/**
+	 * @brief A mapped table file.
+	 */
+	class Table final {
+	private:
+		const std::byte* data;
+		std::size_t size;
+
+		Table(const std::byte* data, std::size_t size) noexcept : data(data), size(size) {}
+
+		const Header& header() const noexcept { return *reinterpret_cast<const Header*>(data); }
+		template <typename T>
+		const T* section(uint64_t offset) const noexcept {
+			return reinterpret_cast<const T*>(data + offset);
+		}
+		const char* string(uint32_t offset) const noexcept { return section<char>(header().strings) + offset; }
+		User user(uint32_t index) const noexcept;
+		Group group(uint32_t index) const noexcept;
+		Lookup missing() const noexcept;
+
+	public:
+		Table(const Table&) = delete;
+		Table& operator=(const Table&) = delete;
+		~Table();
+
+		/**
+		 * @brief Maps the table at path.
+		 * @return nullptr if there is none or it is not a valid table owned by and only writable by root.
+		 */
+		static std::shared_ptr<const Table> open(const std::filesystem::path& path);
+
+		/** Whether a newer table replaced this one or this one expired **/
+		bool stale() const noexcept;
+
+		Lookup findUser(uint32_t id, User& user) const noexcept;
+		Lookup findUser(std::string_view username, User& user) const noexcept;
+		Lookup findGroup(uint32_t id, Group& group) const noexcept;
+		Lookup findGroup(std::string_view name, Group& group) const noexcept;
+	};
+
+	/**
+	 * @brief The most recent table at path for the calling thread, which is only remapped once it went stale.
+	 * @return nullptr if there is no usable table
+	 */
+	std::shared_ptr<const Table> current(const std::filesystem::path& path);
+
+	/**
+	 * @brief Publishes tables at a path. The last published table is retired and removed on destruction.
+	 */
+	class Writer final {
+	private:
+		std::filesystem::path path;
+		std::byte* published = nullptr;
+		std::size_t publishedSize = 0;
+
+		void retire() noexcept;
+
+	public:
+		explicit Writer(std::filesystem::path path) noexcept;
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+		~Writer();
+
+		/**
+		 * @param complete whether users and groups contain every existing user and group
+		 * @param expires seconds since the epoch after which readers must ignore the table
+		 * @return false if the table could not be written
+		 */
+		bool publish(
+				std::span<const UserRecord> users, std::span<const GroupRecord> groups, bool complete, int64_t expires
+		);
+	};
+} // namespace sharedtable
+
+#endif
\ No newline at end of file
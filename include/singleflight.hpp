@@ -0,0 +1,80 @@
+#ifndef SINGLEFLIGHT_HPP
+#define SINGLEFLIGHT_HPP
+
+#include <kj/async.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+
+/**
+ * @brief Deduplicates concurrent operations by key such that callers asking for the same key while an operation is
+ * still in flight share its result instead of starting their own.
+ * @details The result type must be copyable since every caller receives its own copy. Each operation may keep a
+ * context that the callers who join it can see, e.g. the priority of the requests it sends.
+ */
+template <typename Key, typename T, typename Context = std::monostate>
+class SingleFlight final : private kj::TaskSet::ErrorHandler {
+private:
+	struct Flight {
+		uint64_t id;
+		Context context;
+		kj::ForkedPromise<T> promise;
+	};
+	std::unordered_map<Key, Flight> flights;
+	uint64_t nextID = 0;
+	std::size_t shared = 0;
+	/** Forget the flights once they complete, even if all of their callers went away **/
+	kj::TaskSet landings{*this};
+
+	void forget(const Key& key, uint64_t id) {
+		if (auto it = flights.find(key); it != flights.end() && it->second.id == id)
+			flights.erase(it);
+	}
+
+	/** The flight's own branch, which keeps the forked promise alive while it is erased **/
+	void land(const Key& key, Flight& flight) {
+		landings.add(flight.promise.addBranch().then(
+				[this, key, id = flight.id](T&&) { forget(key, id); },
+				[this, key, id = flight.id](kj::Exception&&) { forget(key, id); }
+		));
+	}
+
+	void taskFailed(kj::Exception&&) override {}
+
+public:
+	/**
+	 * @brief Returns the result of the operation in flight for key or starts a new one by calling start().
+	 */
+	template <typename F>
+	kj::Promise<T> run(const Key& key, F&& start) {
+		return run(key, Context{}, [&start](const Context&) { return start(); }, [](const Context&) {});
+	}
+
+	/**
+	 * @brief Like run(key, start), but a new operation is started by calling start(context) and keeps the context while
+	 * it is in flight. Callers that join an operation in flight call joined(its context) instead.
+	 */
+	template <typename F, typename J>
+	kj::Promise<T> run(const Key& key, Context context, F&& start, J&& joined) {
+		if (auto it = flights.find(key); it != flights.end()) {
+			++shared;
+			joined(std::as_const(it->second.context));
+			return it->second.promise.addBranch();
+		}
+		auto promise = start(std::as_const(context)).fork();
+		auto [it, _] = flights.emplace(
+				key, Flight{.id = nextID++, .context = std::move(context), .promise = kj::mv(promise)}
+		);
+		land(key, it->second);
+		return it->second.promise.addBranch();
+	}
+
+	/** The number of operations that are currently in flight **/
+	std::size_t inflight() const noexcept { return flights.size(); }
+	/** The number of calls that were answered by an operation another caller started **/
+	std::size_t coalesced() const noexcept { return shared; }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef SSHKEYS_HPP
+#define SSHKEYS_HPP
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Fingerprints of SSH public keys as sshd passes them to the AuthorizedKeysCommand (%f) and as GitLab looks
+ * keys up by.
+ */
+namespace sshkeys {
+	/**
+	 * @return the SHA-256 fingerprint of a public key in the format of authorized_keys ("ssh-ed25519 AAAA... comment")
+	 * like `ssh-keygen -l` prints it (SHA256: followed by the unpadded base64 of the hash), or std::nullopt if there is
+	 * no base64 encoded key
+	 */
+	std::optional<std::string> fingerprint(std::string_view key);
+
+	/** @return whether fingerprint has the format of those returned by fingerprint() **/
+	bool isFingerprint(std::string_view fingerprint) noexcept;
+} // namespace sshkeys
+
+#endif
\ No newline at end of file
@@ -1,33 +1,52 @@
 #include <error.hpp>
 #include <rpcclient.hpp>
 
-#include <iostream>
+#include <cstdio>
+#include <string_view>
 
+/**
+ * Prints the SSH keys of the GitLab user, one per line, for sshd's AuthorizedKeysCommand. sshd runs it for every
+ * connection attempt, so the keys are fetched with a single RPC that the daemon answers without looking up the user.
+ *
+ * Usage: fetchgitlabkeys <username> [fingerprint]
+ *
+ * Given the fingerprint of the key that the client offered (sshd's %f), only that key is printed. The daemon then
+ * answers from its fingerprint index, such that attempts with keys of other users do not fetch any user's keys.
+ */
 int main(int argc, char* argv[]) {
-	if (argc != 2)
+	if (argc != 2 && argc != 3)
 		return -1;
-	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+	// Only SHA-256 fingerprints are indexed; with sshd's FingerprintHash set to md5, all keys are printed
+	if (argc == 3 && std::string_view{argv[2]}.starts_with("SHA256:")) {
+		auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+			auto request = daemon.getSSHKeyByFingerprintRequest();
+			request.setName(argv[1]);
+			request.setFingerprint(argv[2]);
+			return request.send();
+		});
+		if (!response)
+			return -2;
+		if (static_cast<Error>(response->getErrcode()) != Error::Ok)
+			return response->getErrcode();
+		auto key = response->getKey();
+		std::fwrite(key.begin(), 1, key.size(), stdout);
+		std::fputc('\n', stdout);
+		return std::fflush(stdout) == 0 ? 0 : -3;
+	}
 
-	if (!daemon)
+	auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getSSHKeysByNameRequest();
+		request.setName(argv[1]);
+		return request.send();
+	});
+	if (!response)
 		return -2;
+	if (static_cast<Error>(response->getErrcode()) != Error::Ok)
+		return response->getErrcode();
 
-	// Get the user ID from the username via RPC to the daemon
-	auto userreq = daemon->getUserByNameRequest();
-	userreq.setName(argv[1]);
-	auto userresp = userreq.send().wait(waitScope);
-	if (static_cast<Error>(userresp.getErrcode()) != Error::Ok)
-		return userresp.getErrcode();
-
-	// Get the ssh public keys from user by ID via RPC to the daemon
-	auto keyreq = daemon->getSSHKeysRequest();
-	keyreq.setId(userresp.getUser().getId());
-	auto keyresp = keyreq.send().wait(waitScope);
-	if (static_cast<Error>(keyresp.getErrcode()) != Error::Ok)
-		return keyresp.getErrcode();
-
-	// Print keys and success
-	std::cout << keyresp.getKeys().cStr() << std::endl;
-	return 0;
+	for (auto key : response->getKeys()) {
+		std::fwrite(key.begin(), 1, key.size(), stdout);
+		std::fputc('\n', stdout);
+	}
+	return std::fflush(stdout) == 0 ? 0 : -3;
 }
\ No newline at end of file
@@ -0,0 +1,904 @@
+#include <cachedgitlab.hpp>
+#include <logging.hpp>
+#include <sshkeys.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <kj/array.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+using gitlab::CachedGitLab;
+using gitlab::Checkpoint;
+using gitlab::GitLab;
+using gitlab::Group;
+using gitlab::GroupID;
+using gitlab::OwnedKey;
+using gitlab::Priority;
+using gitlab::Result;
+using gitlab::SSHKey;
+using gitlab::Urgency;
+using gitlab::User;
+using gitlab::UserID;
+
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+
+/** The maximum page size GitLab allows **/
+static constexpr unsigned PerPage = 100;
+
+static RefreshPolicy refreshPolicy(const Config& config) {
+	return RefreshPolicy{
+			.maxStale = seconds{config.cache.maxStale},
+			.ahead = seconds{config.cache.refreshAhead},
+			.hotUses = config.cache.hotUses
+	};
+}
+
+template <typename Key>
+static ShardedNegativeCache<Key> negativeCache(const Config& config) {
+	const auto& settings = config.cache.negative;
+	return ShardedNegativeCache<Key>(seconds{settings.ttl}, settings.maxEntries, settings.filterBits);
+}
+
+static int64_t toEpochSeconds(steady_clock::time_point time) {
+	auto wall = system_clock::now() + std::chrono::duration_cast<system_clock::duration>(time - steady_clock::now());
+	return std::chrono::duration_cast<seconds>(wall.time_since_epoch()).count();
+}
+
+static steady_clock::time_point fromEpochSeconds(int64_t time) {
+	auto wall = system_clock::time_point{seconds{time}};
+	return steady_clock::now() + std::chrono::duration_cast<steady_clock::duration>(wall - system_clock::now());
+}
+
+static int64_t nowInEpochSeconds() {
+	return std::chrono::duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+}
+
+/** @return the keys that have not expired, also of entries that were cached or restored before they expired **/
+static std::expected<std::vector<std::string>, Error> usableKeys(std::expected<std::vector<SSHKey>, Error>&& keys) {
+	if (!keys.has_value())
+		return std::unexpected(keys.error());
+	auto now = nowInEpochSeconds();
+	std::vector<std::string> usable;
+	usable.reserve(keys->size());
+	for (auto& key : *keys)
+		if (!key.expired(now))
+			usable.push_back(std::move(key.key));
+	return usable;
+}
+
+/**
+ * @brief Falls back to the expired cache entry if GitLab could not be asked and the entry is recent enough.
+ */
+template <typename Key, typename Value>
+static std::expected<Value, Error> orStale(
+		std::expected<Value, Error>&& fetched, ShardedTTLCache<Key, Value>& cache, const Key& key, seconds maxStale
+) {
+	if (fetched.has_value() || fetched.error() == Error::NotFound)
+		return std::move(fetched);
+	if (auto stale = cache.getStale(key, maxStale)) {
+		spdlog::debug(
+				"Asking GitLab failed with error {}; serving an expired entry", static_cast<int>(fetched.error())
+		);
+		return std::move(*stale);
+	}
+	return std::move(fetched);
+}
+
+CachedGitLab::CachedGitLab(const Config& config, const GitLab& gitlab, const SnapshotStore& snapshots) noexcept
+		: gitlab(gitlab), snapshots(snapshots), fallback(!config.sync.enabled || config.sync.fallback),
+		  membersRefreshAfter(config.cache.members.refreshAfter), staleIfError(config.cache.staleIfError),
+		  keysTTL(config.cache.keys.ttl), listingConcurrency(std::max(config.gitlabapi.pageConcurrency, 1u)),
+		  home(kj::getCurrentThreadExecutor()), lookupFingerprints(config.gitlabapi.fingerprintLookup),
+		  usersByID(seconds{config.cache.users.ttl}, config.cache.users.maxEntries, refreshPolicy(config)),
+		  usersByName(seconds{config.cache.users.ttl}, config.cache.users.maxEntries, refreshPolicy(config)),
+		  groupsByID(seconds{config.cache.groups.ttl}, config.cache.groups.maxEntries, refreshPolicy(config)),
+		  groupsByName(seconds{config.cache.groups.ttl}, config.cache.groups.maxEntries, refreshPolicy(config)),
+		  keys(seconds{config.cache.keys.ttl}, config.cache.keys.maxEntries, refreshPolicy(config)),
+		  keysByName(seconds{config.cache.keys.ttl}, config.cache.keys.maxEntries, refreshPolicy(config)),
+		  members(seconds{config.cache.members.ttl}, config.cache.members.maxEntries),
+		  fingerprints(seconds{config.cache.keys.ttl}, config.cache.keys.maxEntries),
+		  unknownUserIDs(negativeCache<UserID>(config)), unknownUsernames(negativeCache<std::string>(config)),
+		  unknownGroupIDs(negativeCache<GroupID>(config)), unknownGroupnames(negativeCache<std::string>(config)),
+		  unknownFingerprints(negativeCache<std::string>(config)) {}
+
+/**
+ * @brief Calls f on the thread that asks GitLab.
+ * @details f has to capture everything by value when called from another thread.
+ */
+template <typename F>
+auto CachedGitLab::onHome(F&& f) -> decltype(f()) {
+	if (&kj::getCurrentThreadExecutor() == &home)
+		return f();
+	return home.executeAsync(std::forward<F>(f));
+}
+
+void CachedGitLab::remember(const User& user) {
+	usersByID.put(user.id, user);
+	usersByName.put(user.username, user);
+}
+
+void CachedGitLab::remember(const Group& group) {
+	groupsByID.put(group.id, group);
+	groupsByName.put(group.name, group);
+}
+
+/** Caches the keys that have not expired until the first of them expires or the time to live is over **/
+template <typename Key>
+void CachedGitLab::remember(
+		ShardedTTLCache<Key, std::vector<SSHKey>>& cache, const Key& key, std::vector<SSHKey> fetched
+) {
+	auto now = nowInEpochSeconds();
+	std::erase_if(fetched, [now](const SSHKey& sshKey) { return sshKey.expired(now); });
+	auto expires = steady_clock::now() + keysTTL;
+	for (const auto& sshKey : fetched)
+		if (sshKey.expires != 0)
+			expires = std::min(expires, fromEpochSeconds(sshKey.expires));
+	cache.put(key, std::move(fetched), expires);
+}
+
+/** Adds the user's keys that have not expired to the fingerprint index, each at most until it expires **/
+void CachedGitLab::index(
+		const std::string& username, const std::vector<SSHKey>& keys, steady_clock::time_point expires
+) {
+	auto now = nowInEpochSeconds();
+	for (const auto& sshKey : keys) {
+		if (sshKey.expired(now))
+			continue;
+		auto fingerprint = sshkeys::fingerprint(sshKey.key);
+		if (!fingerprint)
+			continue;
+		auto until = sshKey.expires != 0 ? std::min(expires, fromEpochSeconds(sshKey.expires)) : expires;
+		fingerprints.put(*fingerprint, IndexedKey{.username = username, .key = sshKey}, until);
+	}
+}
+
+/**
+ * @brief Looks the fingerprint up in the index.
+ * @return std::nullopt if the key is not indexed, Error::NotFound if it belongs to another user or expired.
+ */
+std::optional<std::expected<std::string, Error>> CachedGitLab::fromIndex(
+		const std::string& username, const std::string& fingerprint
+) {
+	auto indexed = fingerprints.get(fingerprint);
+	if (!indexed)
+		return std::nullopt;
+	if (indexed->username != username || indexed->key.expired(nowInEpochSeconds()))
+		return std::expected<std::string, Error>{std::unexpect, Error::NotFound};
+	return std::expected<std::string, Error>{std::move(indexed->key.key)};
+}
+
+/**
+ * @brief Looks the fingerprint up among the user's keys, e.g. if they are cached but their index entries were evicted.
+ * Fingerprints that are none of them are remembered.
+ */
+std::expected<std::string, Error> CachedGitLab::fromKeys(
+		const std::string& username, const std::string& fingerprint, const std::vector<SSHKey>& keys
+) {
+	auto now = nowInEpochSeconds();
+	for (const auto& sshKey : keys)
+		if (!sshKey.expired(now) && sshkeys::fingerprint(sshKey.key) == fingerprint)
+			return sshKey.key;
+	unknownFingerprints.put(username + ' ' + fingerprint);
+	return std::unexpected(Error::NotFound);
+}
+
+/**
+ * @return what a lookup with the given priority does when it joins a refresh in flight: Raising the refresh's
+ * priority, such that a lookup does not wait behind background requests
+ */
+static auto raiseTo(const GitLab& gitlab, Priority priority) {
+	return [&gitlab, priority](const Urgency& urgency) { gitlab.raise(urgency, priority); };
+}
+
+/**
+ * @brief Looks key up in the most recent snapshot.
+ * @return std::nullopt if GitLab should be asked instead.
+ */
+template <typename T, typename Key>
+std::optional<std::expected<T, Error>> CachedGitLab::fromSnapshot(const Key& key) const {
+	auto snapshot = snapshots.get();
+	if (!snapshot)
+		return std::nullopt;
+	const T* found;
+	if constexpr (std::is_same_v<T, User>)
+		found = snapshot->findUser(key);
+	else
+		found = snapshot->findGroup(key);
+	if (found)
+		return std::expected<T, Error>{*found};
+	if (!fallback)
+		return std::expected<T, Error>{std::unexpect, Error::NotFound};
+	return std::nullopt;
+}
+
+/**
+ * @brief Looks key up in one of the caches and fetches the entry again in the background if the cache asks for it.
+ * @return std::nullopt if the entry has to be fetched before it can be returned.
+ */
+template <typename Key, typename Value, typename F>
+std::optional<std::expected<Value, Error>> CachedGitLab::fromCache(
+		ShardedTTLCache<Key, Value>& cache, const Key& key, F&& refresh
+) {
+	auto cached = cache.lookup(key);
+	if (!cached) {
+		if (revalidating)
+			if (auto stale = cache.getStale(key, staleIfError))
+				return std::expected<Value, Error>{std::move(*stale)};
+		return std::nullopt;
+	}
+	if (cached->refresh)
+		onHome(std::forward<F>(refresh)).detach([](kj::Exception&& exception) {
+			logging::limited(
+					spdlog::level::warn, "Refreshing a cache entry failed: {}", exception.getDescription().cStr()
+			);
+		});
+	return std::expected<Value, Error>{std::move(cached->value)};
+}
+
+Result<User> CachedGitLab::getUserByID(UserID id) {
+	if (auto synced = fromSnapshot<User>(id))
+		return std::move(*synced);
+	if (auto cached = fromCache(usersByID, id, [this, id]() { return refreshUser(id, Priority::Background); }))
+		return std::move(*cached);
+	if (unknownUserIDs.contains(id))
+		return std::expected<User, Error>{std::unexpect, Error::NotFound};
+	return onHome([this, id]() { return refreshUser(id, Priority::Interactive); });
+}
+
+Result<User> CachedGitLab::refreshUser(UserID id, Priority priority) {
+	auto start = [this, id](const Urgency& urgency) {
+		return gitlab.fetchUserWithGroups(id, urgency).then([this, id](std::expected<User, Error>&& user) {
+			if (user.has_value()) {
+				remember(*user);
+			} else if (user.error() == Error::NotFound) {
+				unknownUserIDs.put(id);
+				if (auto deleted = usersByID.erase(id))
+					usersByName.erase(deleted->username);
+			}
+			return orStale(std::move(user), usersByID, id, staleIfError);
+		});
+	};
+	return userByIDFlights.run(id, priority, start, raiseTo(gitlab, priority));
+}
+
+Result<User> CachedGitLab::getUserByName(const std::string& username) {
+	if (auto synced = fromSnapshot<User>(username))
+		return std::move(*synced);
+	auto refresh = [this, username]() { return refreshUser(username, Priority::Background); };
+	if (auto cached = fromCache(usersByName, username, refresh))
+		return std::move(*cached);
+	if (unknownUsernames.contains(username))
+		return std::expected<User, Error>{std::unexpect, Error::NotFound};
+	return onHome([this, username]() { return refreshUser(username, Priority::Interactive); });
+}
+
+Result<User> CachedGitLab::refreshUser(const std::string& username, Priority priority) {
+	auto start = [this, &username](const Urgency& urgency) {
+		return gitlab.fetchUserWithGroups(username, urgency).then([this, username](std::expected<User, Error>&& user) {
+			if (user.has_value()) {
+				remember(*user);
+			} else if (user.error() == Error::NotFound) {
+				unknownUsernames.put(username);
+				if (auto deleted = usersByName.erase(username))
+					usersByID.erase(deleted->id);
+			}
+			return orStale(std::move(user), usersByName, username, staleIfError);
+		});
+	};
+	return userByNameFlights.run(username, priority, start, raiseTo(gitlab, priority));
+}
+
+/**
+ * @brief Fetches the users including their groups with as few requests as GitLab's backend allows.
+ * @return the users that exist
+ */
+Result<std::vector<User>> CachedGitLab::refreshUsers(std::vector<UserID> ids, Priority priority) {
+	if (gitlab.usersPerRequest() == 1) {
+		// One by one, such that concurrent lookups of the same users share the requests
+		auto lookups = kj::heapArrayBuilder<Result<User>>(ids.size());
+		for (auto id : ids)
+			lookups.add(refreshUser(id, priority));
+		return kj::joinPromises(lookups.finish())
+				.then([](kj::Array<std::expected<User, Error>>&& lookups) -> std::expected<std::vector<User>, Error> {
+					std::vector<User> users;
+					for (auto& user : lookups) {
+						if (user.has_value())
+							users.emplace_back(std::move(*user));
+						else if (user.error() != Error::NotFound)
+							return std::unexpected(user.error());
+					}
+					return users;
+				});
+	}
+	return gitlab.fetchUsersWithGroups(ids, priority)
+			.then([this, ids = std::move(ids)](std::expected<std::vector<User>, Error>&& users) {
+				if (!users.has_value())
+					return std::move(users);
+				std::unordered_set<UserID> found;
+				for (const auto& user : *users) {
+					remember(user);
+					found.insert(user.id);
+				}
+				for (auto id : ids) {
+					if (found.contains(id))
+						continue;
+					unknownUserIDs.put(id);
+					if (auto deleted = usersByID.erase(id))
+						usersByName.erase(deleted->username);
+				}
+				return std::move(users);
+			});
+}
+
+Result<std::vector<std::string>> CachedGitLab::getAuthorizedKeys(UserID id) {
+	if (auto cached = fromCache(keys, id, [this, id]() { return refreshKeys(id, Priority::Background); }))
+		return usableKeys(std::move(*cached));
+	if (unknownUserIDs.contains(id))
+		return std::expected<std::vector<std::string>, Error>{std::unexpect, Error::NotFound};
+	return onHome([this, id]() { return refreshKeys(id, Priority::Interactive); }).then(usableKeys);
+}
+
+Result<std::vector<SSHKey>> CachedGitLab::refreshKeys(UserID id, Priority priority) {
+	auto start = [this, id](const Urgency& urgency) {
+		return gitlab.fetchAuthorizedKeys(id, urgency)
+				.then([this, id](std::expected<std::vector<SSHKey>, Error>&& fetched) {
+					if (fetched.has_value()) {
+						remember(keys, id, *fetched);
+					} else if (fetched.error() == Error::NotFound) {
+						unknownUserIDs.put(id);
+						keys.erase(id);
+					}
+					return orStale(std::move(fetched), keys, id, staleIfError);
+				});
+	};
+	return keyFlights.run(id, priority, start, raiseTo(gitlab, priority));
+}
+
+Result<std::vector<std::string>> CachedGitLab::getAuthorizedKeys(const std::string& username) {
+	// Users missing from a snapshot that GitLab is not asked about beyond do not exist
+	if (auto synced = fromSnapshot<User>(username); synced && !synced->has_value())
+		return std::expected<std::vector<std::string>, Error>{std::unexpect, synced->error()};
+	auto refresh = [this, username]() { return refreshKeys(username, Priority::Background); };
+	if (auto cached = fromCache(keysByName, username, refresh))
+		return usableKeys(std::move(*cached));
+	if (unknownUsernames.contains(username))
+		return std::expected<std::vector<std::string>, Error>{std::unexpect, Error::NotFound};
+	return onHome([this, username]() { return refreshKeys(username, Priority::Interactive); }).then(usableKeys);
+}
+
+Result<std::vector<SSHKey>> CachedGitLab::refreshKeys(const std::string& username, Priority priority) {
+	auto start = [this, &username](const Urgency& urgency) {
+		return gitlab.fetchAuthorizedKeys(username, urgency)
+				.then([this, username](std::expected<std::vector<SSHKey>, Error>&& fetched) {
+					if (fetched.has_value()) {
+						index(username, *fetched, steady_clock::now() + keysTTL);
+						remember(keysByName, username, *fetched);
+					} else if (fetched.error() == Error::NotFound) {
+						unknownUsernames.put(username);
+						keysByName.erase(username);
+					}
+					return orStale(std::move(fetched), keysByName, username, staleIfError);
+				});
+	};
+	return keyByNameFlights.run(username, priority, start, raiseTo(gitlab, priority));
+}
+
+Result<std::string> CachedGitLab::getAuthorizedKey(const std::string& username, const std::string& fingerprint) {
+	using Found = std::expected<std::string, Error>;
+	if (!sshkeys::isFingerprint(fingerprint))
+		return Found{std::unexpect, Error::NotFound};
+	if (auto synced = fromSnapshot<User>(username); synced && !synced->has_value())
+		return Found{std::unexpect, synced->error()};
+	// Most probes with keys of other users end here
+	if (unknownFingerprints.contains(username + ' ' + fingerprint))
+		return Found{std::unexpect, Error::NotFound};
+	if (auto indexed = fromIndex(username, fingerprint))
+		return std::move(*indexed);
+	auto refresh = [this, username]() { return refreshKeys(username, Priority::Background); };
+	if (auto cached = fromCache(keysByName, username, refresh))
+		return fromKeys(username, fingerprint, **cached);
+	if (unknownUsernames.contains(username))
+		return Found{std::unexpect, Error::NotFound};
+	return onHome([this, username, fingerprint]() { return refreshKey(username, fingerprint); });
+}
+
+Result<std::string> CachedGitLab::refreshKey(const std::string& username, const std::string& fingerprint) {
+	// Indexes all of the user's keys
+	auto fromList = [this, username, fingerprint]() {
+		return refreshKeys(username, Priority::Interactive)
+				.then([this, username, fingerprint](std::expected<std::vector<SSHKey>, Error>&& keys) {
+					if (!keys.has_value())
+						return std::expected<std::string, Error>{std::unexpect, keys.error()};
+					return fromKeys(username, fingerprint, *keys);
+				});
+	};
+	if (!lookupFingerprints)
+		return fromList();
+	auto lookup = fingerprintFlights.run(fingerprint, [this, &fingerprint]() {
+		return gitlab.fetchKeyByFingerprint(fingerprint, Priority::Interactive)
+				.then([this](std::expected<OwnedKey, Error>&& owned) {
+					if (owned.has_value())
+						index(owned->username, {owned->key}, steady_clock::now() + keysTTL);
+					return std::move(owned);
+				});
+	});
+	return lookup.then([this, username, fingerprint, fromList](std::expected<OwnedKey, Error>&& owned
+					   ) -> Result<std::string> {
+		if (owned.has_value() || owned.error() == Error::NotFound) {
+			if (auto indexed = fromIndex(username, fingerprint))
+				return std::move(*indexed);
+			// Either GitLab knows no such key or it was not usable for authentication
+			unknownFingerprints.put(username + ' ' + fingerprint);
+			return std::expected<std::string, Error>{std::unexpect, Error::NotFound};
+		}
+		// Only administrators may look keys up by fingerprint
+		if (owned.error() == Error::AuthenticationError && lookupFingerprints) {
+			spdlog::warn("GitLab does not let the token look up SSH keys by fingerprint; fetching users' keys instead");
+			lookupFingerprints = false;
+		}
+		return fromList();
+	});
+}
+
+Result<Group> CachedGitLab::getGroupByID(GroupID id) {
+	if (auto synced = fromSnapshot<Group>(id))
+		return std::move(*synced);
+	if (auto cached = fromCache(groupsByID, id, [this, id]() { return refreshGroup(id, Priority::Background); }))
+		return std::move(*cached);
+	if (unknownGroupIDs.contains(id))
+		return std::expected<Group, Error>{std::unexpect, Error::NotFound};
+	return onHome([this, id]() { return refreshGroup(id, Priority::Interactive); });
+}
+
+Result<Group> CachedGitLab::refreshGroup(GroupID id, Priority priority) {
+	auto start = [this, id](const Urgency& urgency) {
+		return gitlab.fetchGroupByID(id, urgency).then([this, id](std::expected<Group, Error>&& group) {
+			if (group.has_value()) {
+				remember(*group);
+			} else if (group.error() == Error::NotFound) {
+				unknownGroupIDs.put(id);
+				if (auto deleted = groupsByID.erase(id))
+					groupsByName.erase(deleted->name);
+			}
+			return orStale(std::move(group), groupsByID, id, staleIfError);
+		});
+	};
+	return groupByIDFlights.run(id, priority, start, raiseTo(gitlab, priority));
+}
+
+Result<Group> CachedGitLab::getGroupByName(const std::string& groupname) {
+	if (auto synced = fromSnapshot<Group>(groupname))
+		return std::move(*synced);
+	auto refresh = [this, groupname]() { return refreshGroup(groupname, Priority::Background); };
+	if (auto cached = fromCache(groupsByName, groupname, refresh))
+		return std::move(*cached);
+	if (unknownGroupnames.contains(groupname))
+		return std::expected<Group, Error>{std::unexpect, Error::NotFound};
+	return onHome([this, groupname]() { return refreshGroup(groupname, Priority::Interactive); });
+}
+
+Result<Group> CachedGitLab::refreshGroup(const std::string& groupname, Priority priority) {
+	auto start = [this, &groupname](const Urgency& urgency) {
+		return gitlab.fetchGroupByName(groupname, urgency)
+				.then([this, groupname](std::expected<Group, Error>&& group) {
+					if (group.has_value()) {
+						remember(*group);
+					} else if (group.error() == Error::NotFound) {
+						unknownGroupnames.put(groupname);
+						if (auto deleted = groupsByName.erase(groupname))
+							groupsByID.erase(deleted->id);
+					}
+					return orStale(std::move(group), groupsByName, groupname, staleIfError);
+				});
+	};
+	return groupByNameFlights.run(groupname, priority, start, raiseTo(gitlab, priority));
+}
+
+Result<std::vector<std::string>> CachedGitLab::refreshMembers(GroupID id, Priority priority) {
+	auto start = [this, id](const Urgency& urgency) {
+		return gitlab.fetchGroupMembers(id, urgency)
+				.then([this, id](std::expected<std::vector<std::string>, Error>&& names) {
+					if (names.has_value()) {
+						members.put(id, Members{.usernames = *names, .fetched = steady_clock::now()});
+					} else if (names.error() == Error::NotFound) {
+						members.erase(id);
+					} else if (auto stale = members.getStale(id, staleIfError)) {
+						spdlog::debug(
+								"Asking GitLab failed with error {}; serving expired members",
+								static_cast<int>(names.error())
+						);
+						return std::expected<std::vector<std::string>, Error>{std::move(stale->usernames)};
+					}
+					return std::move(names);
+				});
+	};
+	return memberFlights.run(id, priority, start, raiseTo(gitlab, priority));
+}
+
+std::optional<std::vector<std::string>> CachedGitLab::knownGroupMembers(GroupID id) {
+	if (auto snapshot = snapshots.get())
+		if (auto* found = snapshot->findMembers(id))
+			return *found;
+	return members.get(id).transform([](Members&& cached) { return std::move(cached.usernames); });
+}
+
+Result<std::vector<std::string>> CachedGitLab::getGroupMembers(GroupID id) {
+	if (auto snapshot = snapshots.get()) {
+		if (auto* found = snapshot->findMembers(id))
+			return std::expected<std::vector<std::string>, Error>{*found};
+		if (!fallback)
+			return std::expected<std::vector<std::string>, Error>{std::unexpect, Error::NotFound};
+	}
+	auto cached = members.get(id);
+	if (!cached && revalidating)
+		cached = members.getStale(id, staleIfError);
+	if (cached) {
+		if (steady_clock::now() - cached->fetched >= membersRefreshAfter) {
+			auto refresh = onHome([this, id]() { return refreshMembers(id, Priority::Background); });
+			refresh.detach([id](kj::Exception&& exception) {
+				logging::limited(
+						spdlog::level::warn, "Refreshing the members of group {} failed: {}", id,
+						exception.getDescription().cStr()
+				);
+			});
+		}
+		return std::expected<std::vector<std::string>, Error>{std::move(cached->usernames)};
+	}
+	return onHome([this, id]() { return refreshMembers(id, Priority::Interactive); });
+}
+
+/** Set in the cursors of batches from a snapshot, whose order differs from that of GitLab's listings **/
+static constexpr unsigned SnapshotCursor = 1u << 31;
+
+/** @return whether an enumeration that got to cursor can be continued from a snapshot or, if not, from GitLab **/
+static bool continues(unsigned cursor, bool snapshot) noexcept {
+	return cursor == 0 || ((cursor & SnapshotCursor) != 0) == snapshot;
+}
+
+/**
+ * @brief Returns count entries starting at cursor from a snapshot's listing.
+ */
+template <typename T>
+static CachedGitLab::Batch<T> sliceBatch(const std::vector<T>& all, unsigned cursor, unsigned count) {
+	auto begin = std::min<std::size_t>(cursor & ~SnapshotCursor, all.size());
+	auto end = std::min<std::size_t>(begin + count, all.size());
+	return CachedGitLab::Batch<T>{
+			.entries = {all.begin() + begin, all.begin() + end},
+			.next = static_cast<unsigned>(end) | SnapshotCursor,
+			.done = end == all.size()
+	};
+}
+
+/**
+ * @brief Fetches the entries [cursor, cursor + count) of one of GitLab's listings by requesting all pages that
+ * overlap them at once.
+ */
+template <typename T>
+static Result<CachedGitLab::Batch<T>> fetchBatch(
+		const GitLab& gitlab, Result<std::vector<T>> (GitLab::*fetchPage)(unsigned, unsigned) const, unsigned cursor,
+		unsigned count
+) {
+	auto first = cursor / PerPage;
+	auto last = (cursor + count - 1) / PerPage;
+	auto pages = kj::heapArrayBuilder<Result<std::vector<T>>>(last - first + 1);
+	for (auto page = first; page <= last; ++page)
+		pages.add((gitlab.*fetchPage)(page + 1, PerPage));
+	auto skip = cursor - first * PerPage;
+	return kj::joinPromises(pages.finish())
+			.then([cursor, count, skip](kj::Array<std::expected<std::vector<T>, Error>>&& pages
+				  ) -> std::expected<CachedGitLab::Batch<T>, Error> {
+				CachedGitLab::Batch<T> batch{.next = cursor, .done = false};
+				std::size_t position = 0;
+				bool last = false;
+				for (auto& page : pages) {
+					if (!page.has_value())
+						return std::unexpected(page.error());
+					for (auto& entry : *page)
+						if (position++ >= skip && batch.entries.size() < count)
+							batch.entries.emplace_back(std::move(entry));
+					// A short page is the last one and all pages after it are empty
+					last = last || page->size() < PerPage;
+				}
+				// Unless entries of the last page were left for the next batch
+				batch.done = last && position <= skip + batch.entries.size();
+				batch.next += batch.entries.size();
+				return batch;
+			});
+}
+
+Result<CachedGitLab::Batch<User>> CachedGitLab::listUsers(unsigned cursor, unsigned count) {
+	auto snapshot = snapshots.get();
+	if (!continues(cursor, snapshot != nullptr))
+		return std::expected<Batch<User>, Error>{std::unexpect, Error::GenericError};
+	if (snapshot)
+		return std::expected<Batch<User>, Error>{sliceBatch(snapshot->allUsers(), cursor, count)};
+	if (count == 0)
+		return std::expected<Batch<User>, Error>{Batch<User>{.next = cursor, .done = false}};
+	return onHome([this, cursor, count]() { return fetchUsers(cursor, count); });
+}
+
+kj::Promise<void> CachedGitLab::completionWorker(std::shared_ptr<Completion> state) {
+	if (state->error || state->next >= state->ids.size())
+		return kj::READY_NOW;
+	auto begin = state->ids.begin() + state->next;
+	state->next = std::min<std::size_t>(state->next + gitlab.usersPerRequest(), state->ids.size());
+	return refreshUsers({begin, state->ids.begin() + state->next}, Priority::Background)
+			.then([this, state](std::expected<std::vector<User>, Error>&& fetched) {
+				if (fetched.has_value())
+					std::ranges::move(*fetched, std::back_inserter(state->users));
+				else
+					state->error = fetched.error();
+				return completionWorker(state);
+			});
+}
+
+/**
+ * @brief Fetches the users of an enumerated batch including their groups like refreshUsers(), but sends at most
+ * listingConcurrency requests at once instead of queueing one for each of up to a thousand users. They are sent with
+ * background priority, such that they do not hold up lookups that someone waits for.
+ */
+Result<std::vector<User>> CachedGitLab::complete(std::vector<UserID> ids) {
+	auto state = std::make_shared<Completion>(Completion{.ids = std::move(ids)});
+	auto perRequest = gitlab.usersPerRequest();
+	auto concurrency = std::min<std::size_t>(listingConcurrency, (state->ids.size() + perRequest - 1) / perRequest);
+	auto workers = kj::heapArrayBuilder<kj::Promise<void>>(concurrency);
+	for (std::size_t i = 0; i < concurrency; ++i)
+		workers.add(completionWorker(state));
+	return kj::joinPromises(workers.finish()).then([state]() -> std::expected<std::vector<User>, Error> {
+		if (state->error)
+			return std::unexpected(*state->error);
+		return std::move(state->users);
+	});
+}
+
+Result<CachedGitLab::Batch<User>> CachedGitLab::fetchUsers(unsigned cursor, unsigned count) {
+	return fetchBatch(gitlab, &GitLab::fetchUserPage, cursor, count)
+			.then([this](std::expected<Batch<User>, Error>&& listed) -> Result<Batch<User>> {
+				if (!listed.has_value())
+					return std::move(listed);
+				// GitLab's listing does not contain the groups; the users that are not cached are fetched again
+				auto batch = std::make_shared<Batch<User>>(std::move(*listed));
+				std::vector<UserID> missing;
+				for (auto& user : batch->entries) {
+					if (auto cached = usersByID.get(user.id))
+						user = std::move(*cached);
+					else
+						missing.push_back(user.id);
+				}
+				std::unordered_set<UserID> fetch{missing.begin(), missing.end()};
+				return complete(std::move(missing))
+						.then([batch, fetch = std::move(fetch)](std::expected<std::vector<User>, Error>&& fetched
+							  ) -> std::expected<Batch<User>, Error> {
+							if (!fetched.has_value())
+								return std::unexpected(fetched.error());
+							std::unordered_map<UserID, User> byID;
+							for (auto& user : *fetched)
+								byID.emplace(user.id, std::move(user));
+							std::vector<User> entries;
+							for (auto& user : batch->entries) {
+								if (!fetch.contains(user.id))
+									entries.emplace_back(std::move(user));
+								else if (auto found = byID.find(user.id); found != byID.end())
+									entries.emplace_back(std::move(found->second));
+								// Otherwise, the user was deleted since it was listed
+							}
+							batch->entries = std::move(entries);
+							return std::move(*batch);
+						});
+			});
+}
+
+Result<CachedGitLab::Batch<Group>> CachedGitLab::listGroups(unsigned cursor, unsigned count) {
+	auto snapshot = snapshots.get();
+	if (!continues(cursor, snapshot != nullptr))
+		return std::expected<Batch<Group>, Error>{std::unexpect, Error::GenericError};
+	if (snapshot)
+		return std::expected<Batch<Group>, Error>{sliceBatch(snapshot->allGroups(), cursor, count)};
+	if (count == 0)
+		return std::expected<Batch<Group>, Error>{Batch<Group>{.next = cursor, .done = false}};
+	return onHome([this, cursor, count]() {
+		return fetchBatch(gitlab, &GitLab::fetchGroupPage, cursor, count)
+				.then([this](std::expected<Batch<Group>, Error>&& listed) {
+					if (listed.has_value())
+						for (const auto& group : listed->entries)
+							remember(group);
+					return std::move(listed);
+				});
+	});
+}
+
+CachedGitLab::Contents CachedGitLab::contents() const {
+	if (auto snapshot = snapshots.get()) {
+		Contents contents{
+				.users = snapshot->allUsers(), .groups = snapshot->allGroups(), .complete = !fallback, .synced = true
+		};
+		for (const auto& group : contents.groups)
+			if (auto* found = snapshot->findMembers(group.id))
+				contents.members.emplace(group.id, *found);
+		return contents;
+	}
+	Contents contents{.complete = false, .synced = false};
+	usersByID.forEach([&contents](UserID, const User& user) { contents.users.push_back(user); });
+	groupsByID.forEach([&contents](GroupID, const Group& group) { contents.groups.push_back(group); });
+	members.forEach([&contents](GroupID id, const Members& members) {
+		contents.members.emplace(id, members.usernames);
+	});
+	return contents;
+}
+
+Checkpoint CachedGitLab::checkpoint() const {
+	Checkpoint checkpoint;
+	auto oldest = steady_clock::now() - staleIfError;
+	usersByID.forEachEntry([&checkpoint, oldest](UserID, const User& user, steady_clock::time_point expires) {
+		if (expires > oldest)
+			checkpoint.users.push_back({.value = user, .expires = toEpochSeconds(expires)});
+	});
+	groupsByID.forEachEntry([&checkpoint, oldest](GroupID, const Group& group, steady_clock::time_point expires) {
+		if (expires > oldest)
+			checkpoint.groups.push_back({.value = group, .expires = toEpochSeconds(expires)});
+	});
+	keys.forEachEntry([&checkpoint, oldest](
+							  UserID id, const std::vector<SSHKey>& keys, steady_clock::time_point expires
+					  ) {
+		if (expires > oldest)
+			checkpoint.keys.push_back({.value = {.id = id, .keys = keys}, .expires = toEpochSeconds(expires)});
+	});
+	keysByName.forEachEntry([&checkpoint, oldest](
+									const std::string& username, const std::vector<SSHKey>& keys,
+									steady_clock::time_point expires
+							) {
+		if (expires > oldest)
+			checkpoint.namedKeys.push_back(
+					{.value = {.username = username, .keys = keys}, .expires = toEpochSeconds(expires)}
+			);
+	});
+	members.forEachEntry([&checkpoint, oldest](GroupID id, const Members& members, steady_clock::time_point expires) {
+		if (expires > oldest)
+			checkpoint.members.push_back(
+					{.value = {.id = id, .usernames = members.usernames}, .expires = toEpochSeconds(expires)}
+			);
+	});
+	return checkpoint;
+}
+
+void CachedGitLab::restore(Checkpoint&& checkpoint) {
+	auto oldest = steady_clock::now() - staleIfError;
+	for (auto& [user, expires] : checkpoint.users) {
+		if (auto at = fromEpochSeconds(expires); at > oldest) {
+			usersByName.put(user.username, user, at);
+			usersByID.put(user.id, std::move(user), at);
+		}
+	}
+	for (auto& [group, expires] : checkpoint.groups) {
+		if (auto at = fromEpochSeconds(expires); at > oldest) {
+			groupsByName.put(group.name, group, at);
+			groupsByID.put(group.id, std::move(group), at);
+		}
+	}
+	for (auto& [entry, expires] : checkpoint.keys)
+		if (auto at = fromEpochSeconds(expires); at > oldest)
+			keys.put(entry.id, std::move(entry.keys), at);
+	for (auto& [entry, expires] : checkpoint.namedKeys)
+		if (auto at = fromEpochSeconds(expires); at > oldest) {
+			index(entry.username, entry.keys, at);
+			keysByName.put(entry.username, std::move(entry.keys), at);
+		}
+	// Not knowing when they were fetched, restored member lists are refreshed on their first use
+	for (auto& [entry, expires] : checkpoint.members)
+		if (auto at = fromEpochSeconds(expires); at > oldest)
+			members.put(entry.id, Members{.usernames = std::move(entry.usernames), .fetched = {}}, at);
+}
+
+/**
+ * @brief Refreshes the next entries that are left until all are done; users are fetched in batches if possible.
+ */
+kj::Promise<void> CachedGitLab::revalidationWorker(std::shared_ptr<Revalidation> state) {
+	auto again = [this, state]() { return revalidationWorker(state); };
+	if (state->next < state->users.size()) {
+		auto begin = state->users.begin() + state->next;
+		state->next = std::min(state->next + state->usersPerRequest, state->users.size());
+		return refreshUsers({begin, state->users.begin() + state->next}, Priority::Background)
+				.then([again](std::expected<std::vector<User>, Error>&&) { return again(); });
+	}
+	auto next = state->next++ - state->users.size();
+	if (next < state->groups.size())
+		return refreshGroup(state->groups[next], Priority::Background).then([again](std::expected<Group, Error>&&) {
+			return again();
+		});
+	next -= state->groups.size();
+	if (next < state->keys.size())
+		return refreshKeys(state->keys[next], Priority::Background)
+				.then([again](std::expected<std::vector<SSHKey>, Error>&&) { return again(); });
+	next -= state->keys.size();
+	if (next < state->keyNames.size())
+		return refreshKeys(state->keyNames[next], Priority::Background)
+				.then([again](std::expected<std::vector<SSHKey>, Error>&&) { return again(); });
+	next -= state->keyNames.size();
+	if (next < state->members.size())
+		return refreshMembers(state->members[next], Priority::Background)
+				.then([again](std::expected<std::vector<std::string>, Error>&&) { return again(); });
+	return kj::READY_NOW;
+}
+
+kj::Promise<void> CachedGitLab::revalidate(unsigned concurrency) {
+	auto state = std::make_shared<Revalidation>(Revalidation{.usersPerRequest = gitlab.usersPerRequest()});
+	usersByID.forEachEntry([&state](UserID id, const User&, steady_clock::time_point) { state->users.push_back(id); });
+	groupsByID.forEachEntry([&state](GroupID id, const Group&, steady_clock::time_point) {
+		state->groups.push_back(id);
+	});
+	keys.forEachEntry([&state](UserID id, const std::vector<SSHKey>&, steady_clock::time_point) {
+		state->keys.push_back(id);
+	});
+	keysByName.forEachEntry(
+			[&state](const std::string& username, const std::vector<SSHKey>&, steady_clock::time_point) {
+				state->keyNames.push_back(username);
+			}
+	);
+	revalidating = true;
+	concurrency = std::max(concurrency, 1u);
+	auto workers = kj::heapArrayBuilder<kj::Promise<void>>(concurrency);
+	for (unsigned i = 0; i < concurrency; ++i)
+		workers.add(revalidationWorker(state));
+	return kj::joinPromises(workers.finish())
+			.then([this]() { revalidating = false; },
+				  [this](kj::Exception&& exception) {
+					  revalidating = false;
+					  kj::throwFatalException(kj::mv(exception));
+				  });
+}
+
+kj::Promise<void> CachedGitLab::refreshExpiring(steady_clock::duration within, unsigned concurrency) {
+	if (snapshots.get())
+		return kj::READY_NOW;
+	auto state = std::make_shared<Revalidation>(Revalidation{.usersPerRequest = gitlab.usersPerRequest()});
+	auto now = steady_clock::now(), until = now + within;
+	// Like contents(), only entries that did not expire yet
+	auto expiring = [now, until](steady_clock::time_point expires) { return expires > now && expires <= until; };
+	usersByID.forEachEntry([&state, &expiring](UserID id, const User&, steady_clock::time_point expires) {
+		if (expiring(expires))
+			state->users.push_back(id);
+	});
+	groupsByID.forEachEntry([&state, &expiring](GroupID id, const Group&, steady_clock::time_point expires) {
+		if (expiring(expires))
+			state->groups.push_back(id);
+	});
+	members.forEachEntry([&state, &expiring](GroupID id, const Members&, steady_clock::time_point expires) {
+		if (expiring(expires))
+			state->members.push_back(id);
+	});
+	concurrency = std::max(concurrency, 1u);
+	auto workers = kj::heapArrayBuilder<kj::Promise<void>>(concurrency);
+	for (unsigned i = 0; i < concurrency; ++i)
+		workers.add(revalidationWorker(state));
+	return kj::joinPromises(workers.finish());
+}
+
+CachedGitLab::Stats CachedGitLab::stats() const noexcept {
+	return Stats{
+			.usersByID = usersByID.stats(),
+			.usersByName = usersByName.stats(),
+			.groupsByID = groupsByID.stats(),
+			.groupsByName = groupsByName.stats(),
+			.keys = keys.stats(),
+			.keysByName = keysByName.stats(),
+			.members = members.stats(),
+			.fingerprints = fingerprints.stats(),
+			.unknownUserIDs = unknownUserIDs.stats(),
+			.unknownUsernames = unknownUsernames.stats(),
+			.unknownGroupIDs = unknownGroupIDs.stats(),
+			.unknownGroupnames = unknownGroupnames.stats(),
+			.unknownFingerprints = unknownFingerprints.stats(),
+			.coalesced = userByIDFlights.coalesced() + userByNameFlights.coalesced() + keyFlights.coalesced() +
+						 keyByNameFlights.coalesced() + fingerprintFlights.coalesced() + groupByIDFlights.coalesced() +
+						 groupByNameFlights.coalesced() + memberFlights.coalesced()
+	};
+}
\ No newline at end of file
@@ -0,0 +1,262 @@
+#include <checkpoint.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+using gitlab::Checkpoint;
+
+namespace {
+	class Encoder final {
+	private:
+		std::string& out;
+
+	public:
+		explicit Encoder(std::string& out) noexcept : out(out) {}
+
+		template <typename T>
+		void raw(const T& value) {
+			out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+		void u32(uint32_t value) { raw(value); }
+		void i64(int64_t value) { raw(value); }
+		void string(std::string_view string) {
+			u32(string.size());
+			out.append(string);
+		}
+		void strings(const std::vector<std::string>& strings) {
+			u32(strings.size());
+			for (const auto& string : strings)
+				this->string(string);
+		}
+		void keys(const std::vector<gitlab::SSHKey>& keys) {
+			u32(keys.size());
+			for (const auto& key : keys) {
+				string(key.key);
+				i64(key.expires);
+			}
+		}
+	};
+
+	/** Reads from a mapped file; once anything is out of bounds, all further reads fail **/
+	class Decoder final {
+	private:
+		const char* pos;
+		const char* end;
+		bool failed = false;
+
+	public:
+		Decoder(const char* data, std::size_t size) noexcept : pos(data), end(data + size) {}
+
+		bool ok() const noexcept { return !failed; }
+		bool done() const noexcept { return pos == end; }
+
+		template <typename T>
+		T raw() noexcept {
+			T value{};
+			if (failed || static_cast<std::size_t>(end - pos) < sizeof(T)) {
+				failed = true;
+				return value;
+			}
+			std::memcpy(&value, pos, sizeof(T));
+			pos += sizeof(T);
+			return value;
+		}
+		uint32_t u32() noexcept { return raw<uint32_t>(); }
+		int64_t i64() noexcept { return raw<int64_t>(); }
+		/** A count of records that each take at least one byte; guards allocations against corrupted counts **/
+		uint32_t count() noexcept {
+			auto count = u32();
+			if (count > static_cast<std::size_t>(end - pos))
+				failed = true;
+			return failed ? 0 : count;
+		}
+		std::string string() {
+			auto size = u32();
+			if (failed || static_cast<std::size_t>(end - pos) < size) {
+				failed = true;
+				return {};
+			}
+			std::string string{pos, size};
+			pos += size;
+			return string;
+		}
+		std::vector<std::string> strings() {
+			std::vector<std::string> strings(count());
+			for (auto& string : strings)
+				string = this->string();
+			return strings;
+		}
+		std::vector<gitlab::SSHKey> keys() {
+			std::vector<gitlab::SSHKey> keys(count());
+			for (auto& key : keys) {
+				key.key = string();
+				key.expires = i64();
+			}
+			return keys;
+		}
+	};
+} // namespace
+
+static bool decode(Decoder& in, Checkpoint& checkpoint, const Checkpoint::Header& header) {
+	checkpoint.users.resize(header.userCount);
+	for (auto& [user, expires] : checkpoint.users) {
+		expires = in.i64();
+		user.id = in.u32();
+		user.username = in.string();
+		user.name = in.string();
+		user.groups.resize(in.count());
+		for (auto& group : user.groups) {
+			group.id = in.u32();
+			group.name = in.string();
+		}
+	}
+	checkpoint.groups.resize(header.groupCount);
+	for (auto& [group, expires] : checkpoint.groups) {
+		expires = in.i64();
+		group.id = in.u32();
+		group.name = in.string();
+	}
+	checkpoint.keys.resize(header.keyCount);
+	for (auto& [keys, expires] : checkpoint.keys) {
+		expires = in.i64();
+		keys.id = in.u32();
+		keys.keys = in.keys();
+	}
+	checkpoint.namedKeys.resize(header.namedKeyCount);
+	for (auto& [keys, expires] : checkpoint.namedKeys) {
+		expires = in.i64();
+		keys.username = in.string();
+		keys.keys = in.keys();
+	}
+	checkpoint.members.resize(header.memberCount);
+	for (auto& [members, expires] : checkpoint.members) {
+		expires = in.i64();
+		members.id = in.u32();
+		members.usernames = in.strings();
+	}
+	return in.ok() && in.done();
+}
+
+std::optional<Checkpoint> Checkpoint::load(const std::filesystem::path& path) {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return std::nullopt;
+	struct stat stat;
+	// Restored entries are handed out as they are, so nobody else may have written them
+	if (fstat(fd, &stat) != 0 || stat.st_uid != geteuid() || (stat.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+		static_cast<std::size_t>(stat.st_size) < sizeof(Header)) {
+		close(fd);
+		return std::nullopt;
+	}
+	void* data = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return std::nullopt;
+	Decoder in{static_cast<const char*>(data), static_cast<std::size_t>(stat.st_size)};
+	auto header = in.raw<Header>();
+	std::optional<Checkpoint> checkpoint;
+	// Each record takes more than one byte, so the counts are bounded by the size before anything is allocated
+	auto records = uint64_t{header.userCount} + header.groupCount + header.keyCount + header.namedKeyCount +
+				   header.memberCount;
+	if (header.magic == Header::Magic && header.version == Header::Version &&
+		records <= static_cast<uint64_t>(stat.st_size)) {
+		checkpoint.emplace();
+		if (!decode(in, *checkpoint, header))
+			checkpoint.reset();
+	}
+	munmap(data, stat.st_size);
+	return checkpoint;
+}
+
+// The header is written as it is in memory, so it must not contain padding of indeterminate value
+static_assert(std::has_unique_object_representations_v<Checkpoint::Header>);
+
+std::error_code Checkpoint::save(const std::filesystem::path& path) const {
+	auto written = std::chrono::system_clock::now().time_since_epoch();
+	Header header{
+			.magic = Header::Magic,
+			.version = Header::Version,
+			.userCount = static_cast<uint32_t>(users.size()),
+			.groupCount = static_cast<uint32_t>(groups.size()),
+			.keyCount = static_cast<uint32_t>(keys.size()),
+			.namedKeyCount = static_cast<uint32_t>(namedKeys.size()),
+			.memberCount = static_cast<uint32_t>(members.size()),
+			.written = std::chrono::duration_cast<std::chrono::seconds>(written).count()
+	};
+	std::string buffer;
+	Encoder out{buffer};
+	out.raw(header);
+	for (const auto& [user, expires] : users) {
+		out.i64(expires);
+		out.u32(user.id);
+		out.string(user.username);
+		out.string(user.name);
+		out.u32(user.groups.size());
+		for (const auto& group : user.groups) {
+			out.u32(group.id);
+			out.string(group.name);
+		}
+	}
+	for (const auto& [group, expires] : groups) {
+		out.i64(expires);
+		out.u32(group.id);
+		out.string(group.name);
+	}
+	for (const auto& [userKeys, expires] : keys) {
+		out.i64(expires);
+		out.u32(userKeys.id);
+		out.keys(userKeys.keys);
+	}
+	for (const auto& [userKeys, expires] : namedKeys) {
+		out.i64(expires);
+		out.string(userKeys.username);
+		out.keys(userKeys.keys);
+	}
+	for (const auto& [groupMembers, expires] : members) {
+		out.i64(expires);
+		out.u32(groupMembers.id);
+		out.strings(groupMembers.usernames);
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+	// Written to a fresh file that then atomically replaces the previous checkpoint such that a crash while writing
+	// leaves the previous one intact
+	auto temporary = path;
+	temporary += ".new";
+	unlink(temporary.c_str());
+	int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return {errno, std::system_category()};
+	// Takes errno before cleaning up can overwrite it
+	auto failed = [&temporary](int fd) {
+		std::error_code error{errno, std::system_category()};
+		if (fd >= 0)
+			close(fd);
+		unlink(temporary.c_str());
+		return error;
+	};
+	std::string_view remaining{buffer};
+	while (!remaining.empty()) {
+		auto count = write(fd, remaining.data(), remaining.size());
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return failed(fd);
+		remaining.remove_prefix(count);
+	}
+	if (fsync(fd) != 0)
+		return failed(fd);
+	if (close(fd) != 0 || rename(temporary.c_str(), path.c_str()) != 0)
+		return failed(-1);
+	return {};
+}
\ No newline at end of file
@@ -2,8 +2,10 @@
 
 #include <toml++/toml.hpp>
 
-#include <iostream>
+#include <format>
+#include <fstream>
 #include <string>
+#include <vector>
 
 using namespace std::string_literals;
 
@@ -14,21 +16,52 @@ static std::optional<std::string> tryReadSecret(const std::filesystem::path& pat
 	return std::nullopt;
 }
 
+static Config::Backend readBackend(toml::node_view<toml::node> node, std::vector<std::string>& problems) {
+	auto name = node.value<std::string>();
+	if (!name)
+		return Config::DefaultBackend;
+	if (*name == "graphql")
+		return Config::Backend::GraphQL;
+	if (*name != "rest")
+		problems.push_back(std::format("Unknown backend {}; using the REST API", *name));
+	return Config::Backend::REST;
+}
+
+static unsigned readSyncInterval(toml::node_view<toml::node> node, std::vector<std::string>& problems) {
+	unsigned interval = node.value_or(Config::DefaultSyncInterval);
+	if (interval >= Config::MinSyncInterval)
+		return interval;
+	problems.push_back(std::format(
+			"Sync interval of {} seconds is too short; using {} seconds", interval, Config::MinSyncInterval
+	));
+	return Config::MinSyncInterval;
+}
+
+static Config::CacheSettings readCacheSettings(toml::node_view<toml::node> table, unsigned defaultTTL) {
+	return Config::CacheSettings{
+			.ttl = table["ttl"].value_or(defaultTTL),
+			.maxEntries = table["max_entries"].value_or(Config::DefaultCacheEntries)
+	};
+}
+
 Config Config::fromFile(const std::filesystem::path& file) noexcept {
 	auto config = toml::parse_file(file.string());
 	if (!config) {
-		std::cout << "Not found or invalid TOML: " << config.error() << std::endl;
 		// No config found
-		return Config{}; /** \todo do something sensible **/
+		Config defaults{}; /** \todo do something sensible **/
+		defaults.problems.push_back(std::format("Not found or invalid TOML: {}", config.error().description()));
+		return defaults;
 	} else {
 		auto table = config.table();
-		return Config{
+		std::vector<std::string> problems;
+		Config parsed{
 				.general =
 						{.socketPath = std::filesystem::path{table["general"]["socket_path"].value_or(
 								 Config::DefaultSocketPath
 						 )},
 						 .socketPerms = table["general"]["socket_permissions"].value_or(Config::DefaultSocketPerms),
-						 .socketOwner = table["general"]["socket_owner"].value_or(Config::DefaultSocketOwner)},
+						 .socketOwner = table["general"]["socket_owner"].value_or(Config::DefaultSocketOwner),
+						 .threads = table["general"]["threads"].value_or(Config::DefaultThreads)},
 				.gitlabapi =
 						{.baseUrl = table["gitlabapi"]["base_url"].value_or(""s),
 						 .apikey = table["gitlabapi"]["secret"]
@@ -37,13 +70,82 @@ Config Config::fromFile(const std::filesystem::path& file) noexcept {
 											   return file.parent_path() / path;
 										   })
 										   .and_then(tryReadSecret)
-										   .value_or(""s)},
+										   .value_or(""s),
+						 .maxConnections =
+								 table["gitlabapi"]["max_connections"].value_or(Config::DefaultMaxConnections),
+						 .idleTimeout = table["gitlabapi"]["idle_timeout"].value_or(Config::DefaultIdleTimeout),
+						 .connectTimeout =
+								 table["gitlabapi"]["connect_timeout"].value_or(Config::DefaultConnectTimeout),
+						 .requestTimeout =
+								 table["gitlabapi"]["request_timeout"].value_or(Config::DefaultRequestTimeout),
+						 .http2 = table["gitlabapi"]["http2"].value_or(Config::DefaultHTTP2),
+						 .pageConcurrency =
+								 table["gitlabapi"]["page_concurrency"].value_or(Config::DefaultPageConcurrency),
+						 .rateLimit = table["gitlabapi"]["rate_limit"].value_or(Config::DefaultRateLimit),
+						 .rateBurst = table["gitlabapi"]["rate_burst"].value_or(Config::DefaultRateBurst),
+						 .maxAttempts = table["gitlabapi"]["max_attempts"].value_or(Config::DefaultMaxAttempts),
+						 .queueTimeout = table["gitlabapi"]["queue_timeout"].value_or(Config::DefaultQueueTimeout),
+						 .fingerprintLookup =
+								 table["gitlabapi"]["fingerprint_lookup"].value_or(Config::DefaultFingerprintLookup),
+						 .backend = readBackend(table["gitlabapi"]["backend"], problems)},
+				.cache =
+						{.users = readCacheSettings(table["cache"]["users"], Config::DefaultUserCacheTTL),
+						 .groups = readCacheSettings(table["cache"]["groups"], Config::DefaultGroupCacheTTL),
+						 .keys = readCacheSettings(table["cache"]["keys"], Config::DefaultKeyCacheTTL),
+						 .members =
+								 {.ttl = table["cache"]["members"]["ttl"].value_or(Config::DefaultMemberCacheTTL),
+								  .refreshAfter = table["cache"]["members"]["refresh_after"].value_or(
+										  Config::DefaultMemberCacheRefresh
+								  ),
+								  .maxEntries = table["cache"]["members"]["max_entries"].value_or(
+										  Config::DefaultCacheEntries
+								  )},
+						 .negative =
+								 {.ttl = table["cache"]["negative"]["ttl"].value_or(Config::DefaultNegativeCacheTTL),
+								  .maxEntries = table["cache"]["negative"]["max_entries"].value_or(
+										  Config::DefaultNegativeCacheEntries
+								  ),
+								  .filterBits = table["cache"]["negative"]["filter_bits"].value_or(
+										  Config::DefaultNegativeCacheFilterBits
+								  )},
+						 .staleIfError = table["cache"]["stale_if_error"].value_or(Config::DefaultStaleIfError),
+						 .maxStale = table["cache"]["max_stale"].value_or(Config::DefaultMaxStale),
+						 .refreshAhead = table["cache"]["refresh_ahead"].value_or(Config::DefaultRefreshAhead),
+						 .hotUses = table["cache"]["hot_uses"].value_or(Config::DefaultHotUses)},
+				.sync = {.enabled = table["sync"]["enabled"].value_or(Config::DefaultSyncEnabled),
+						 .interval = readSyncInterval(table["sync"]["interval"], problems),
+						 .concurrency = table["sync"]["concurrency"].value_or(Config::DefaultSyncConcurrency),
+						 .fallback = table["sync"]["fallback"].value_or(Config::DefaultSyncFallback)},
+				.sharedTable = {.enabled = table["shared_table"]["enabled"].value_or(Config::DefaultSharedTableEnabled),
+								.path = std::filesystem::path{table["shared_table"]["path"].value_or(
+										Config::DefaultSharedTablePath
+								)},
+								.interval = table["shared_table"]["interval"].value_or(
+										Config::DefaultSharedTableInterval
+								)},
+				.checkpoint = {.enabled = table["checkpoint"]["enabled"].value_or(Config::DefaultCheckpointEnabled),
+							   .path = std::filesystem::path{table["checkpoint"]["path"].value_or(
+									   Config::DefaultCheckpointPath
+							   )},
+							   .interval = table["checkpoint"]["interval"].value_or(Config::DefaultCheckpointInterval),
+							   .concurrency = table["checkpoint"]["concurrency"].value_or(
+									   Config::DefaultCheckpointConcurrency
+							   )},
+				.metrics = {.enabled = table["metrics"]["enabled"].value_or(Config::DefaultMetricsEnabled),
+							.address = table["metrics"]["address"].value_or(Config::DefaultMetricsAddress)},
+				.logging = {.level = table["logging"]["level"].value_or(Config::DefaultLogLevel),
+							.nssLevel = table["logging"]["nss_level"].value_or(Config::DefaultNSSLogLevel),
+							.repeatInterval =
+									table["logging"]["repeat_interval"].value_or(Config::DefaultLogRepeatInterval)},
 				.nss = {.homesRoot = std::filesystem::path{table["nss"]["homes_root"].value_or("/homes/"s)},
 						.homePerms = table["nss"]["homes_permissions"].value_or(Config::DefaultHomePerms),
+						.provisionHomes = table["nss"]["provision_homes"].value_or(Config::DefaultProvisionHomes),
 						.uidOffset = table["nss"]["uid_offset"].value_or(Config::DefaultUIDOffset),
 						.gidOffset = table["nss"]["gid_offset"].value_or(Config::DefaultGIDOffset),
 						.groupPrefix = table["nss"]["group_prefix"].value_or(""),
 						.shell = table["nss"]["shell"].value_or(Config::DefaultShell)}
 		};
+		parsed.problems = std::move(problems);
+		return parsed;
 	}
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include <directory.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <kj/array.h>
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+using gitlab::DirectorySync;
+using gitlab::GitLab;
+using gitlab::Group;
+using gitlab::GroupID;
+using gitlab::Priority;
+using gitlab::Result;
+using gitlab::Snapshot;
+using gitlab::User;
+using gitlab::UserID;
+
+Snapshot::Snapshot(std::vector<User>&& users, std::vector<Group>&& groups)
+		: users(std::move(users)), groups(std::move(groups)), created(std::chrono::system_clock::now()) {
+	for (std::size_t i = 0; i < this->groups.size(); ++i) {
+		groupByID.emplace(this->groups[i].id, i);
+		groupByName.emplace(this->groups[i].name, i);
+	}
+	for (std::size_t i = 0; i < this->users.size(); ++i) {
+		userByID.emplace(this->users[i].id, i);
+		userByName.emplace(this->users[i].username, i);
+		// Users may be members of groups that are not listed for us
+		for (const auto& group : this->users[i].groups) {
+			membersByGroup[group.id].push_back(this->users[i].username);
+			if (groupByID.emplace(group.id, this->groups.size()).second) {
+				groupByName.emplace(group.name, this->groups.size());
+				this->groups.push_back(group);
+			}
+		}
+	}
+}
+
+const User* Snapshot::findUser(UserID id) const noexcept {
+	auto it = userByID.find(id);
+	return it != userByID.end() ? &users[it->second] : nullptr;
+}
+
+const User* Snapshot::findUser(const std::string& username) const noexcept {
+	auto it = userByName.find(username);
+	return it != userByName.end() ? &users[it->second] : nullptr;
+}
+
+const Group* Snapshot::findGroup(GroupID id) const noexcept {
+	auto it = groupByID.find(id);
+	return it != groupByID.end() ? &groups[it->second] : nullptr;
+}
+
+const Group* Snapshot::findGroup(const std::string& groupname) const noexcept {
+	auto it = groupByName.find(groupname);
+	return it != groupByName.end() ? &groups[it->second] : nullptr;
+}
+
+const std::vector<std::string>* Snapshot::findMembers(GroupID id) const noexcept {
+	static const std::vector<std::string> none;
+	if (!findGroup(id))
+		return nullptr;
+	auto it = membersByGroup.find(id);
+	return it != membersByGroup.end() ? &it->second : &none;
+}
+
+namespace {
+	struct MembershipState {
+		std::shared_ptr<std::vector<User>> users;
+		std::size_t next = 0;
+		std::optional<Error> error;
+	};
+} // namespace
+
+/**
+ * @brief Fetches the groups of the next users without groups until all users are done or an error occurred.
+ * @details Takes as many users at once as GitLab's backend fetches with one request.
+ */
+static kj::Promise<void> membershipWorker(const GitLab& gitlab, std::shared_ptr<MembershipState> state) {
+	if (state->error || state->next >= state->users->size())
+		return kj::READY_NOW;
+	auto begin = state->next;
+	auto end = state->next = std::min<std::size_t>(begin + gitlab.usersPerRequest(), state->users->size());
+	if (end - begin == 1) {
+		auto& user = (*state->users)[begin];
+		return gitlab.fetchGroups(user.id, Priority::Background)
+				.then([&gitlab, state, &user](std::expected<std::vector<Group>, Error>&& groups) {
+					if (groups.has_value())
+						user.groups = std::move(*groups);
+					else if (groups.error() != Error::NotFound) // NotFound: The user was deleted since it was listed
+						state->error = groups.error();
+					return membershipWorker(gitlab, state);
+				});
+	}
+	std::vector<UserID> ids;
+	for (auto i = begin; i < end; ++i)
+		ids.push_back((*state->users)[i].id);
+	return gitlab.fetchUsersWithGroups(std::move(ids), Priority::Background)
+			.then([&gitlab, state, begin, end](std::expected<std::vector<User>, Error>&& fetched) {
+				if (!fetched.has_value()) {
+					state->error = fetched.error();
+					return membershipWorker(gitlab, state);
+				}
+				std::unordered_map<UserID, std::vector<Group>> groups;
+				for (auto& user : *fetched)
+					groups.emplace(user.id, std::move(user.groups));
+				// Users that are missing were deleted since they were listed
+				for (auto i = begin; i < end; ++i)
+					if (auto found = groups.find((*state->users)[i].id); found != groups.end())
+						(*state->users)[i].groups = std::move(found->second);
+				return membershipWorker(gitlab, state);
+			});
+}
+
+DirectorySync::DirectorySync(
+		const Config& config, const GitLab& gitlab, SnapshotStore& store, kj::Timer& timer
+) noexcept
+		: config(config), gitlab(gitlab), store(store), timer(timer) {}
+
+Result<void> DirectorySync::fetchMemberships(std::shared_ptr<std::vector<User>> users) {
+	auto state = std::make_shared<MembershipState>(MembershipState{.users = users});
+	auto concurrency = std::max(config.sync.concurrency, 1u);
+	auto workers = kj::heapArrayBuilder<kj::Promise<void>>(concurrency);
+	for (unsigned i = 0; i < concurrency; ++i)
+		workers.add(membershipWorker(gitlab, state));
+	return kj::joinPromises(workers.finish()).then([state]() -> std::expected<void, Error> {
+		if (state->error)
+			return std::unexpected(*state->error);
+		return {};
+	});
+}
+
+Result<void> DirectorySync::sync() {
+	return gitlab.fetchAllUsers()
+			.then([this](std::expected<std::vector<User>, Error>&& users) -> Result<void> {
+				if (!users.has_value())
+					return std::expected<void, Error>{std::unexpect, users.error()};
+				auto shared = std::make_shared<std::vector<User>>(std::move(*users));
+				return fetchMemberships(shared).then([this, shared](std::expected<void, Error>&& memberships
+													 ) -> Result<void> {
+					if (!memberships.has_value())
+						return std::move(memberships);
+					return gitlab.fetchAllGroups()
+							.then([this, shared](std::expected<std::vector<Group>, Error>&& groups
+								  ) -> std::expected<void, Error> {
+								if (!groups.has_value())
+									return std::unexpected(groups.error());
+								store.publish(std::make_shared<const Snapshot>(std::move(*shared), std::move(*groups)));
+								return {};
+							});
+				});
+			});
+}
+
+kj::Promise<void> DirectorySync::run() {
+	auto started = std::chrono::steady_clock::now();
+	return sync().then([this, started](std::expected<void, Error>&& synced) {
+		if (synced.has_value()) {
+			auto snapshot = store.get();
+			auto took = std::chrono::steady_clock::now() - started;
+			spdlog::info(
+					"Synced {} users and {} groups from GitLab in {} ms", snapshot->allUsers().size(),
+					snapshot->allGroups().size(), std::chrono::duration_cast<std::chrono::milliseconds>(took).count()
+			);
+		} else {
+			spdlog::warn(
+					"Syncing with GitLab failed with error {}; keeping the previous snapshot",
+					static_cast<int>(synced.error())
+			);
+		}
+		return timer.afterDelay(config.sync.interval * kj::SECONDS).then([this]() { return run(); });
+	});
+}
\ No newline at end of file
@@ -1,117 +1,509 @@
 #include <gitlabapi.hpp>
+#include <gitlabjson.hpp>
 
-#include <cpr/cpr.h>
-#include <rapidjson/document.h>
+#include <kj/array.h>
 
+#include <algorithm>
+#include <charconv>
 #include <expected>
 #include <format>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string_view>
 
 using gitlab::GitLab;
 using gitlab::Group;
 using gitlab::GroupID;
+using gitlab::OwnedKey;
+using gitlab::Priority;
+using gitlab::Response;
+using gitlab::Result;
+using gitlab::Scheduler;
+using gitlab::SSHKey;
+using gitlab::Urgency;
 using gitlab::User;
 using gitlab::UserID;
+namespace json = gitlab::json;
 
-static std::expected<rapidjson::Document, Error> fetch(const Config& config, std::string url) noexcept {
-	auto resp = cpr::Get(cpr::Url{url}, cpr::Bearer{config.gitlabapi.apikey});
-	if (resp.status_code == 404)
+/** The maximum page size GitLab allows **/
+static constexpr unsigned PerPage = 100;
+/** Beyond this many pages, X-Total-Pages is not trusted and pages are fetched until one is short **/
+static constexpr unsigned MaxTotalPages = 10000;
+/** How many pages of a substring search are looked through for an exact match before it is taken as missing **/
+static constexpr unsigned MaxSearchPages = 5;
+
+/** @return the response if GitLab answered with success **/
+static std::expected<Response, Error> checkStatus(Response&& resp) {
+	if (resp.status == 0)
+		return std::unexpected(Error::ServerError);
+	else if (resp.status == 404)
 		return std::unexpected(Error::NotFound);
-	else if (resp.status_code == 401)
+	else if (resp.status == 401 || resp.status == 403)
 		return std::unexpected(Error::AuthenticationError);
-	else if (resp.status_code >= 400)
-		return std::unexpected(Error::GenericError);
-	else if (resp.status_code >= 500)
+	else if (resp.status == 429)
+		return std::unexpected(Error::RateLimited);
+	else if (resp.status >= 500)
 		return std::unexpected(Error::ServerError);
-	rapidjson::Document json;
-	json.Parse(resp.text.c_str());
-	if (json.HasParseError())
+	else if (resp.status >= 400)
+		return std::unexpected(Error::GenericError);
+	return std::move(resp);
+}
+
+static std::expected<std::string, Error> toBody(std::expected<Response, Error>&& resp) {
+	if (!resp.has_value())
+		return std::unexpected(resp.error());
+	return std::move(resp->body);
+}
+
+/** @return the response if GitLab answered with success **/
+static Result<Response> request(const Config& config, Scheduler& scheduler, std::string url, Urgency urgency) {
+	return scheduler.get(std::move(url), config.gitlabapi.apikey, urgency).then(checkStatus);
+}
+
+/** @return the response body if GitLab answered with success **/
+static Result<std::string> fetch(const Config& config, Scheduler& scheduler, std::string url, Urgency urgency) {
+	return request(config, scheduler, std::move(url), urgency).then(toBody);
+}
+
+/** @return the response body if GitLab answered the GraphQL request with success **/
+static Result<std::string> post(
+		const Config& config, Scheduler& scheduler, const std::string& url, std::string body, Urgency urgency
+) {
+	return scheduler.post(url, config.gitlabapi.apikey, std::move(body), urgency).then(checkStatus).then(toBody);
+}
+
+/** @return GitLab's GraphQL endpoint, which is next to the REST API at .../api/v4 **/
+static std::string graphqlEndpoint(std::string_view baseUrl) {
+	while (baseUrl.ends_with('/'))
+		baseUrl.remove_suffix(1);
+	if (baseUrl.ends_with("/v4"))
+		baseUrl.remove_suffix(3);
+	return std::format("{}/graphql", baseUrl);
+}
+
+/** Decodes the body with parse unless fetching it failed **/
+template <typename F>
+static auto decode(std::expected<std::string, Error>&& body, F&& parse) -> decltype(parse(std::move(*body))) {
+	if (!body.has_value())
+		return std::unexpected(body.error());
+	return parse(std::move(*body));
+}
+
+/**
+ * @brief Expects exactly one entry in a listing that was filtered by name.
+ */
+template <typename T>
+static std::expected<T, Error> onlyEntry(std::expected<std::vector<T>, Error>&& entries) {
+	if (!entries.has_value())
+		return std::unexpected(entries.error());
+	if (entries->empty())
+		return std::unexpected(Error::NotFound);
+	if (entries->size() != 1)
 		return std::unexpected(Error::ResponseFormatError);
-	return json;
-}
-
-GitLab::GitLab(const Config& config) noexcept : config(config) {}
-
-Error GitLab::fetchUserByUsername(std::string username, User& user) const {
-	/**  \todo should not hurt to apply url-encoding of the username **/
-	auto fetched = fetch(config, std::format("{}/users?username={}", config.gitlabapi.baseUrl, username));
-	if (!fetched.has_value())
-		return fetched.error();
-	auto& json = fetched.value();
-	if (!json.IsArray() || json.Size() != 1)
-		return Error::ResponseFormatError;
-	auto& userJson = json[0];
-	user.id = userJson["id"].Get<decltype(user.id)>();
-	user.username = userJson["username"].GetString();
-	user.name = userJson["name"].GetString();
-	return Error::Ok;
-}
-
-Error GitLab::fetchUserByID(UserID id, User& user) const {
-	auto fetched = fetch(config, std::format("{}/users/{}", config.gitlabapi.baseUrl, id));
-	if (!fetched.has_value())
-		return fetched.error();
-	auto& json = fetched.value();
-	if (!json.IsObject())
-		return Error::ResponseFormatError;
-	auto& userJson = json;
-	user.id = userJson["id"].Get<decltype(user.id)>();
-	user.username = userJson["username"].GetString();
-	user.name = userJson["name"].GetString();
-	return Error::Ok;
-}
-
-Error GitLab::fetchAuthorizedKeys(UserID id, std::vector<std::string>& keys) const {
-	auto fetched = fetch(config, std::format("{}/users/{}/keys", config.gitlabapi.baseUrl, id));
-	if (!fetched.has_value())
-		return fetched.error();
-	auto& json = fetched.value();
-	if (!json.IsArray())
-		return Error::ResponseFormatError;
-	for (const auto& key : json.GetArray())
-		/** \todo adhere to expires_at **/
-		if (key["usage_type"] == "auth_and_signing")
-			keys.emplace_back(key["key"].GetString());
-	return Error::Ok;
-}
-
-Error GitLab::fetchGroups(User& user) const {
-	auto fetched = fetch(config, std::format("{}/users/{}/memberships", config.gitlabapi.baseUrl, user.id));
-	if (!fetched.has_value())
-		return fetched.error();
-	auto& json = fetched.value();
-	if (!json.IsArray())
-		return Error::ResponseFormatError;
-	user.groups.clear();
-	for (const auto& group : json.GetArray())
-		user.groups.emplace_back(
-				Group{.id = group["source_id"].Get<decltype(user.id)>(), .name = group["source_name"].GetString()}
-		);
-	return Error::Ok;
-}
-
-Error GitLab::fetchGroupByName(std::string groupname, Group& group) const {
-	/**  \todo should not hurt to apply url-encoding of the groupname **/
-	auto fetched = fetch(config, std::format("{}/groups?name={}", config.gitlabapi.baseUrl, groupname));
-	if (!fetched.has_value())
-		return fetched.error();
-	auto& json = fetched.value();
-	if (!json.IsArray() || json.Size() != 1)
-		return Error::ResponseFormatError;
-	auto& groupJson = json[0];
-	group.id = groupJson["id"].Get<decltype(group.id)>();
-	group.name = groupJson["name"].GetString();
-	return Error::Ok;
-}
-
-Error GitLab::fetchGroupByID(GroupID id, Group& group) const {
-	auto fetched = fetch(config, std::format("{}/groups/{}", config.gitlabapi.baseUrl, id));
-	if (!fetched.has_value())
-		return fetched.error();
-	auto& json = fetched.value();
-	if (!json.IsObject())
-		return Error::ResponseFormatError;
-	auto& groupJson = json;
-	group.id = groupJson["id"].Get<decltype(group.id)>();
-	group.name = groupJson["name"].GetString();
-	return Error::Ok;
+	return std::move(entries->front());
+}
+
+/** @return whether GitLab allows username, which is then safe to use as a segment of a URL's path **/
+static bool validUsername(std::string_view username) {
+	auto allowed = [](char c) {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' ||
+			   c == '-';
+	};
+	return !username.empty() && username.front() != '.' && username.front() != '-' &&
+		   std::ranges::all_of(username, allowed);
+}
+
+/** @return text with everything but unreserved characters percent-encoded for a URL's query **/
+static std::string percentEncode(std::string_view text) {
+	std::string encoded;
+	encoded.reserve(text.size());
+	for (char c : text) {
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.' ||
+			c == '_' || c == '~')
+			encoded += c;
+		else
+			encoded += std::format("%{:02X}", static_cast<unsigned>(static_cast<unsigned char>(c)));
+	}
+	return encoded;
+}
+
+/** @return whether two ASCII names are equal when ignoring case, as GitLab compares usernames **/
+static bool sameName(std::string_view a, std::string_view b) {
+	auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; };
+	return std::ranges::equal(a, b, {}, lower, lower);
+}
+
+static std::string pageURL(const std::string& url, unsigned page) {
+	return std::format("{}{}page={}&per_page={}", url, url.contains('?') ? '&' : '?', page, PerPage);
+}
+
+static std::optional<unsigned> parseNumber(std::string_view text) {
+	unsigned number;
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+	if (error != std::errc{} || end == text.data())
+		return std::nullopt;
+	return number;
+}
+
+/**
+ * @return the number of pages of the listing that resp is a page of or std::nullopt if GitLab does not tell, which it
+ * does not for listings of more than 10,000 entries
+ */
+static std::optional<unsigned> totalPages(const Response& resp) {
+	if (auto total = resp.headers.find("x-total-pages"); total != resp.headers.end())
+		if (auto pages = parseNumber(total->second))
+			return pages;
+	// Link: <https://...&page=1&per_page=100>; rel="first", <https://...&page=7&per_page=100>; rel="last"
+	auto link = resp.headers.find("link");
+	if (link == resp.headers.end())
+		return std::nullopt;
+	std::string_view links{link->second};
+	auto rel = links.find("rel=\"last\"");
+	if (rel == std::string_view::npos)
+		return std::nullopt;
+	auto begin = links.rfind('<', rel), end = links.rfind('>', rel);
+	if (begin == std::string_view::npos || end == std::string_view::npos || end < begin)
+		return std::nullopt;
+	auto last = links.substr(begin + 1, end - begin - 1);
+	for (std::string_view parameter : {"?page=", "&page="})
+		if (auto at = last.find(parameter); at != std::string_view::npos)
+			return parseNumber(last.substr(at + parameter.size()));
+	return std::nullopt;
+}
+
+namespace {
+	template <typename T>
+	using Decoder = std::expected<std::vector<T>, Error> (*)(std::string&&);
+
+	/** The pages from the second one on of a listing whose number of pages is known **/
+	template <typename T>
+	struct Pages {
+		std::string url;
+		Decoder<T> decoder;
+		Urgency urgency;
+		std::vector<std::vector<T>> pages;
+		std::size_t next = 0;
+		std::optional<Error> error;
+	};
+} // namespace
+
+/**
+ * @brief Fetches the next page that is left until all are done or an error occurred.
+ */
+template <typename T>
+static kj::Promise<void> pageWorker(const Config& config, Scheduler& scheduler, std::shared_ptr<Pages<T>> state) {
+	if (state->error || state->next >= state->pages.size())
+		return kj::READY_NOW;
+	auto index = state->next++;
+	return fetch(config, scheduler, pageURL(state->url, index + 2), state->urgency)
+			.then([&config, &scheduler, state, index](std::expected<std::string, Error>&& body) {
+				auto entries = decode(std::move(body), state->decoder);
+				if (entries.has_value())
+					state->pages[index] = std::move(*entries);
+				else
+					state->error = entries.error();
+				return pageWorker(config, scheduler, state);
+			});
+}
+
+/**
+ * @brief Fetches pages one after the other for as long as they are full. Used if GitLab does not tell the number of
+ * pages.
+ */
+template <typename T>
+static Result<std::vector<T>> fetchSequentially(
+		const Config& config, Scheduler& scheduler, std::string url, Decoder<T> decoder, Urgency urgency,
+		unsigned page, std::vector<T>&& entries
+) {
+	return fetch(config, scheduler, pageURL(url, page), urgency)
+			.then([&config, &scheduler, url = std::move(url), decoder, urgency, page, entries = std::move(entries)](
+						  std::expected<std::string, Error>&& body
+				  ) mutable -> Result<std::vector<T>> {
+				auto fetched = decode(std::move(body), decoder);
+				if (!fetched.has_value())
+					return std::move(fetched);
+				bool last = fetched->size() < PerPage;
+				std::ranges::move(*fetched, std::back_inserter(entries));
+				if (last)
+					return std::expected<std::vector<T>, Error>{std::move(entries)};
+				return fetchSequentially(
+						config, scheduler, std::move(url), decoder, urgency, page + 1, std::move(entries)
+				);
+			});
+}
+
+/**
+ * @brief Fetches the pages of a search one after the other until one holds the entry that matches() or the search
+ * ends, but at most MaxSearchPages of them.
+ * @return Error::NotFound if no entry matched within those pages
+ */
+template <typename T, typename F>
+static Result<T> findSequentially(
+		const Config& config, Scheduler& scheduler, std::string url, Decoder<T> decoder, Urgency urgency, F matches,
+		unsigned page = 1
+) {
+	return fetch(config, scheduler, pageURL(url, page), urgency)
+			.then([&config, &scheduler, url = std::move(url), decoder, urgency, matches, page](
+						  std::expected<std::string, Error>&& body
+				  ) mutable -> Result<T> {
+				auto fetched = decode(std::move(body), decoder);
+				if (!fetched.has_value())
+					return std::expected<T, Error>{std::unexpect, fetched.error()};
+				if (auto found = std::ranges::find_if(*fetched, matches); found != fetched->end())
+					return std::expected<T, Error>{std::move(*found)};
+				if (fetched->size() < PerPage || page >= MaxSearchPages)
+					return std::expected<T, Error>{std::unexpect, Error::NotFound};
+				return findSequentially(config, scheduler, std::move(url), decoder, urgency, matches, page + 1);
+			});
+}
+
+/**
+ * @brief Fetches all pages of a listing with the largest page size. The first page's headers tell how many pages
+ * there are. The remaining ones are then fetched with at most the configured number of requests in flight at once
+ * and appended in order.
+ */
+template <typename T>
+static Result<std::vector<T>> fetchAll(
+		const Config& config, Scheduler& scheduler, std::string url, Decoder<T> decoder, Urgency urgency
+) {
+	auto first = pageURL(url, 1);
+	return request(config, scheduler, std::move(first), urgency)
+			.then([&config, &scheduler, url = std::move(url), decoder, urgency](std::expected<Response, Error>&& resp
+				  ) mutable -> Result<std::vector<T>> {
+				if (!resp.has_value())
+					return std::expected<std::vector<T>, Error>{std::unexpect, resp.error()};
+				auto total = totalPages(*resp);
+				auto entries = decoder(std::move(resp->body));
+				if (!entries.has_value() || (total && *total <= 1) || (!total && entries->size() < PerPage))
+					return std::move(entries);
+				if (!total || *total > MaxTotalPages)
+					return fetchSequentially(
+							config, scheduler, std::move(url), decoder, urgency, 2, std::move(*entries)
+					);
+				auto state = std::make_shared<Pages<T>>(
+						Pages<T>{.url = std::move(url), .decoder = decoder, .urgency = urgency}
+				);
+				state->pages.resize(*total - 1);
+				auto concurrency = std::clamp(config.gitlabapi.pageConcurrency, 1u, *total - 1);
+				auto workers = kj::heapArrayBuilder<kj::Promise<void>>(concurrency);
+				for (unsigned i = 0; i < concurrency; ++i)
+					workers.add(pageWorker(config, scheduler, state));
+				return kj::joinPromises(workers.finish())
+						.then([state, entries = std::move(*entries)]() mutable -> std::expected<std::vector<T>, Error> {
+							if (state->error)
+								return std::unexpected(*state->error);
+							for (auto& page : state->pages)
+								std::ranges::move(page, std::back_inserter(entries));
+							return std::move(entries);
+						});
+			});
+}
+
+GitLab::GitLab(const Config& config, Scheduler& scheduler) noexcept
+		: config(config), scheduler(scheduler), graphqlUrl(graphqlEndpoint(config.gitlabapi.baseUrl)) {}
+
+unsigned GitLab::usersPerRequest() const noexcept {
+	return config.gitlabapi.backend == Config::Backend::GraphQL ? json::MaxQueriedUsers : 1;
+}
+
+void GitLab::raise(const Urgency& urgency, Priority priority) const {
+	scheduler.raise(urgency, priority);
+}
+
+Result<User> GitLab::withGroups(std::expected<User, Error>&& user, Urgency urgency) const {
+	if (!user.has_value())
+		return std::move(user);
+	return fetchGroups(user->id, urgency)
+			.then([user = std::move(*user)](std::expected<std::vector<Group>, Error>&& groups
+				  ) mutable -> std::expected<User, Error> {
+				// The user was found, so GitLab not finding their groups (e.g. as they were just deleted) must not
+				// make them unknown; whether they still exist is up to the next lookup
+				if (!groups.has_value())
+					return std::unexpected(groups.error() == Error::NotFound ? Error::GenericError : groups.error());
+				user.groups = std::move(*groups);
+				return std::move(user);
+			});
+}
+
+/**
+ * @brief Sends a GraphQL request built by json::queryUsersByID() or json::queryUsersByUsername().
+ */
+Result<std::vector<User>> GitLab::queryUsers(std::string query, Urgency urgency) const {
+	return post(config, scheduler, graphqlUrl, std::move(query), urgency)
+			.then([this, urgency](std::expected<std::string, Error>&& body) -> Result<std::vector<User>> {
+				auto queried = decode(std::move(body), json::parseQueriedUsers);
+				if (!queried.has_value())
+					return std::expected<std::vector<User>, Error>{std::unexpect, queried.error()};
+				auto users = kj::heapArrayBuilder<Result<User>>(queried->size());
+				for (auto& [user, moreGroups] : *queried)
+					users.add(moreGroups ? withGroups(std::move(user), urgency)
+										 : Result<User>{std::expected<User, Error>{std::move(user)}});
+				return kj::joinPromises(users.finish())
+						.then([](kj::Array<std::expected<User, Error>>&& users
+							  ) -> std::expected<std::vector<User>, Error> {
+							std::vector<User> complete;
+							complete.reserve(users.size());
+							for (auto& user : users) {
+								if (!user.has_value())
+									return std::unexpected(user.error());
+								complete.emplace_back(std::move(*user));
+							}
+							return complete;
+						});
+			});
+}
+
+Result<User> GitLab::fetchUserByUsername(std::string username, Urgency urgency) const {
+	if (!validUsername(username))
+		return std::expected<User, Error>{std::unexpect, Error::NotFound};
+	auto url = std::format("{}/users?username={}", config.gitlabapi.baseUrl, percentEncode(username));
+	// Usernames are unique, so there is at most one page
+	return fetch(config, scheduler, std::move(url), urgency)
+			.then([username = std::move(username)](std::expected<std::string, Error>&& body
+				  ) -> std::expected<User, Error> {
+				auto user = onlyEntry(decode(std::move(body), json::parseUsers));
+				// Never hand out another user than the one asked for, whatever GitLab made of the parameter
+				if (user.has_value() && !sameName(user->username, username))
+					return std::unexpected(Error::NotFound);
+				return user;
+			});
+}
+
+Result<User> GitLab::fetchUserByID(UserID id, Urgency urgency) const {
+	return fetch(config, scheduler, std::format("{}/users/{}", config.gitlabapi.baseUrl, id), urgency)
+			.then([](std::expected<std::string, Error>&& body) { return decode(std::move(body), json::parseUser); });
+}
+
+Result<User> GitLab::fetchUserWithGroups(std::string username, Urgency urgency) const {
+	if (usersPerRequest() > 1)
+		return queryUsers(json::queryUsersByUsername({username}), urgency)
+				.then([](std::expected<std::vector<User>, Error>&& users) { return onlyEntry(std::move(users)); });
+	return fetchUserByUsername(std::move(username), urgency).then([this, urgency](std::expected<User, Error>&& user) {
+		return withGroups(std::move(user), urgency);
+	});
+}
+
+Result<User> GitLab::fetchUserWithGroups(UserID id, Urgency urgency) const {
+	if (usersPerRequest() > 1)
+		return queryUsers(json::queryUsersByID({id}), urgency)
+				.then([](std::expected<std::vector<User>, Error>&& users) { return onlyEntry(std::move(users)); });
+	return fetchUserByID(id, urgency).then([this, urgency](std::expected<User, Error>&& user) {
+		return withGroups(std::move(user), urgency);
+	});
+}
+
+Result<std::vector<User>> GitLab::fetchUsersWithGroups(std::vector<UserID> ids, Urgency urgency) const {
+	auto batch = usersPerRequest();
+	auto parts = kj::heapArrayBuilder<Result<std::vector<User>>>((ids.size() + batch - 1) / batch);
+	if (batch > 1) {
+		for (std::size_t begin = 0; begin < ids.size(); begin += batch) {
+			std::vector<UserID> part{ids.begin() + begin, ids.begin() + std::min(begin + batch, ids.size())};
+			parts.add(queryUsers(json::queryUsersByID(part), urgency));
+		}
+	} else {
+		for (auto id : ids)
+			parts.add(fetchUserWithGroups(id, urgency)
+							  .then([](std::expected<User, Error>&& user) -> std::expected<std::vector<User>, Error> {
+								  if (user.has_value())
+									  return std::vector<User>{std::move(*user)};
+								  if (user.error() == Error::NotFound)
+									  return std::vector<User>{};
+								  return std::unexpected(user.error());
+							  }));
+	}
+	return kj::joinPromises(parts.finish())
+			.then([](kj::Array<std::expected<std::vector<User>, Error>>&& parts
+				  ) -> std::expected<std::vector<User>, Error> {
+				std::vector<User> users;
+				for (auto& part : parts) {
+					if (!part.has_value())
+						return std::unexpected(part.error());
+					std::ranges::move(*part, std::back_inserter(users));
+				}
+				return users;
+			});
+}
+
+Result<std::vector<SSHKey>> GitLab::fetchAuthorizedKeys(UserID id, Urgency urgency) const {
+	auto url = std::format("{}/users/{}/keys", config.gitlabapi.baseUrl, id);
+	return fetchAll<SSHKey>(config, scheduler, std::move(url), json::parseKeys, urgency);
+}
+
+Result<std::vector<SSHKey>> GitLab::fetchAuthorizedKeys(const std::string& username, Urgency urgency) const {
+	if (!validUsername(username))
+		return std::expected<std::vector<SSHKey>, Error>{std::unexpect, Error::NotFound};
+	// users/:id_or_username/keys would take a username made of digits for an ID, so the user is looked up first
+	if (std::ranges::all_of(username, [](char c) { return c >= '0' && c <= '9'; }))
+		return fetchUserByUsername(username, urgency)
+				.then([this, urgency](std::expected<User, Error>&& user) -> Result<std::vector<SSHKey>> {
+					if (!user.has_value())
+						return std::expected<std::vector<SSHKey>, Error>{std::unexpect, user.error()};
+					return fetchAuthorizedKeys(user->id, urgency);
+				});
+	auto url = std::format("{}/users/{}/keys", config.gitlabapi.baseUrl, username);
+	return fetchAll<SSHKey>(config, scheduler, std::move(url), json::parseKeys, urgency);
+}
+
+Result<OwnedKey> GitLab::fetchKeyByFingerprint(const std::string& fingerprint, Urgency urgency) const {
+	auto url = std::format("{}/keys?fingerprint={}", config.gitlabapi.baseUrl, percentEncode(fingerprint));
+	return fetch(config, scheduler, std::move(url), urgency)
+			.then([](std::expected<std::string, Error>&& body) -> std::expected<OwnedKey, Error> {
+				auto owned = decode(std::move(body), json::parseOwnedKey);
+				if (!owned.has_value())
+					return std::unexpected(owned.error());
+				if (!*owned)
+					return std::unexpected(Error::NotFound);
+				return std::move(**owned);
+			});
+}
+
+Result<std::vector<Group>> GitLab::fetchGroups(UserID id, Urgency urgency) const {
+	// Direct memberships in groups only, not in projects
+	auto url = std::format("{}/users/{}/memberships?type=Namespace", config.gitlabapi.baseUrl, id);
+	return fetchAll<Group>(config, scheduler, std::move(url), json::parseMemberships, urgency);
+}
+
+Result<Group> GitLab::fetchGroupByName(std::string groupname, Urgency urgency) const {
+	auto url = std::format(
+			"{}/groups?all_available=true&search={}", config.gitlabapi.baseUrl, percentEncode(groupname)
+	);
+	// The search also matches groups whose name merely contains the groupname. Looking through all of them would cost
+	// a request per page for a short or made up name, so a group behind too many partial matches is not found.
+	return findSequentially<Group>(
+			config, scheduler, std::move(url), json::parseGroups, urgency,
+			[groupname = std::move(groupname)](const Group& group) { return group.name == groupname; }
+	);
+}
+
+Result<Group> GitLab::fetchGroupByID(GroupID id, Urgency urgency) const {
+	return fetch(config, scheduler, std::format("{}/groups/{}", config.gitlabapi.baseUrl, id), urgency)
+			.then([](std::expected<std::string, Error>&& body) { return decode(std::move(body), json::parseGroup); });
+}
+
+Result<std::vector<std::string>> GitLab::fetchGroupMembers(GroupID id, Urgency urgency) const {
+	auto url = std::format("{}/groups/{}/members", config.gitlabapi.baseUrl, id);
+	return fetchAll<std::string>(config, scheduler, std::move(url), json::parseUsernames, urgency);
+}
+
+Result<std::vector<User>> GitLab::fetchUserPage(unsigned page, unsigned perPage) const {
+	auto url = std::format("{}/users?page={}&per_page={}", config.gitlabapi.baseUrl, page, perPage);
+	return fetch(config, scheduler, std::move(url), Priority::Background)
+			.then([](std::expected<std::string, Error>&& body) { return decode(std::move(body), json::parseUsers); });
+}
+
+Result<std::vector<Group>> GitLab::fetchGroupPage(unsigned page, unsigned perPage) const {
+	auto url = std::format("{}/groups?all_available=true&page={}&per_page={}", config.gitlabapi.baseUrl, page, perPage);
+	return fetch(config, scheduler, std::move(url), Priority::Background)
+			.then([](std::expected<std::string, Error>&& body) { return decode(std::move(body), json::parseGroups); });
+}
+
+Result<std::vector<User>> GitLab::fetchAllUsers() const {
+	auto url = std::format("{}/users", config.gitlabapi.baseUrl);
+	return fetchAll<User>(config, scheduler, std::move(url), json::parseUsers, Priority::Background);
+}
+
+Result<std::vector<Group>> GitLab::fetchAllGroups() const {
+	auto url = std::format("{}/groups?all_available=true", config.gitlabapi.baseUrl);
+	return fetchAll<Group>(config, scheduler, std::move(url), json::parseGroups, Priority::Background);
 }
\ No newline at end of file
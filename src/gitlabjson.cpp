@@ -0,0 +1,598 @@
+#include <gitlabjson.hpp>
+
+#include <rapidjson/reader.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+using gitlab::Group;
+using gitlab::GroupID;
+using gitlab::OwnedKey;
+using gitlab::json::QueriedUser;
+using gitlab::SSHKey;
+using gitlab::User;
+using gitlab::UserID;
+
+namespace {
+	using Field = std::variant<std::monostate, uint64_t, std::string_view>;
+
+	/**
+	 * @brief Collects the values of the named fields of either a single object or each object in an array. Values of
+	 * other fields and of nested objects and arrays are skipped.
+	 * @details Strings point into the parsed body.
+	 */
+	template <std::size_t N>
+	class FieldCollector final : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, FieldCollector<N>> {
+	public:
+		using Record = std::array<Field, N>;
+
+	private:
+		const std::array<std::string_view, N>& names;
+		unsigned depth = 0;
+		/** The depth of the objects whose fields are collected **/
+		unsigned recordDepth = 1;
+		/** The field that the next value belongs to, if it is collected **/
+		std::optional<std::size_t> field;
+
+		bool set(Field value) {
+			if (field && depth == recordDepth)
+				records.back()[*field] = value;
+			field.reset();
+			return true;
+		}
+
+	public:
+		bool array = false;
+		std::vector<Record> records;
+
+		explicit FieldCollector(const std::array<std::string_view, N>& names) noexcept : names(names) {}
+
+		bool StartObject() {
+			field.reset();
+			if (++depth == recordDepth)
+				records.emplace_back();
+			return true;
+		}
+		bool EndObject(rapidjson::SizeType) {
+			--depth;
+			return true;
+		}
+		bool StartArray() {
+			field.reset();
+			if (depth++ == 0) {
+				array = true;
+				recordDepth = 2;
+			}
+			return true;
+		}
+		bool EndArray(rapidjson::SizeType) {
+			--depth;
+			return true;
+		}
+		bool Key(const char* str, rapidjson::SizeType length, bool) {
+			field.reset();
+			if (depth != recordDepth)
+				return true;
+			std::string_view key{str, length};
+			for (std::size_t i = 0; i < N; ++i)
+				if (names[i] == key)
+					field = i;
+			return true;
+		}
+		bool Uint(unsigned value) { return set(uint64_t{value}); }
+		bool Uint64(uint64_t value) { return set(value); }
+		bool String(const char* str, rapidjson::SizeType length, bool) { return set(std::string_view{str, length}); }
+		/** Anything else (null, booleans, negative and floating point numbers) is skipped **/
+		bool Default() { return set(std::monostate{}); }
+	};
+
+	template <typename T>
+	std::optional<T> get(const Field& field);
+
+	template <>
+	std::optional<unsigned> get<unsigned>(const Field& field) {
+		auto* value = std::get_if<uint64_t>(&field);
+		if (!value || *value > std::numeric_limits<unsigned>::max())
+			return std::nullopt;
+		return static_cast<unsigned>(*value);
+	}
+
+	template <>
+	std::optional<std::string_view> get<std::string_view>(const Field& field) {
+		auto* value = std::get_if<std::string_view>(&field);
+		return value ? std::optional{*value} : std::nullopt;
+	}
+
+	/** A user of a GraphQL response; strings point into the parsed body **/
+	struct QueriedRecord {
+		Field id;
+		Field username;
+		Field name;
+		/** The IDs and names of the groups **/
+		std::vector<std::pair<Field, Field>> groups;
+		bool moreGroups = false;
+	};
+
+	/**
+	 * @brief Collects the users of a response to UsersQuery. Values are told apart by their path from the root,
+	 * where "[]" stands for any element of an array.
+	 */
+	class QueryCollector final : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, QueryCollector> {
+	private:
+		static constexpr std::array<std::string_view, 4> UserPath{"data", "users", "nodes", "[]"};
+		static constexpr std::array<std::string_view, 8> GroupPath{
+				"data", "users", "nodes", "[]", "groupMemberships", "nodes", "[]", "group"
+		};
+		static constexpr std::array<std::string_view, 7> MoreGroupsPath{
+				"data", "users", "nodes", "[]", "groupMemberships", "pageInfo", "hasNextPage"
+		};
+
+		/** An array or an object together with the key of its current field **/
+		struct Frame {
+			bool array;
+			std::string_view key;
+		};
+		std::vector<Frame> frames;
+
+		/** @return whether the path from the root to the current position is path **/
+		bool at(std::span<const std::string_view> path) const {
+			if (frames.size() != path.size())
+				return false;
+			for (std::size_t i = 0; i < path.size(); ++i)
+				if ((frames[i].array ? std::string_view{"[]"} : frames[i].key) != path[i])
+					return false;
+			return true;
+		}
+		/** @return the key of the current field if it is a field of the object at path **/
+		std::optional<std::string_view> fieldOf(std::span<const std::string_view> path) const {
+			if (frames.size() != path.size() + 1 || frames.back().array)
+				return std::nullopt;
+			for (std::size_t i = 0; i < path.size(); ++i)
+				if ((frames[i].array ? std::string_view{"[]"} : frames[i].key) != path[i])
+					return std::nullopt;
+			return frames.back().key;
+		}
+
+		bool set(Field value) {
+			if (users.empty())
+				return true;
+			auto& user = users.back();
+			if (auto key = fieldOf(UserPath)) {
+				if (*key == "id")
+					user.id = value;
+				else if (*key == "username")
+					user.username = value;
+				else if (*key == "name")
+					user.name = value;
+			} else if (auto key = fieldOf(GroupPath); key && !user.groups.empty()) {
+				if (*key == "id")
+					user.groups.back().first = value;
+				else if (*key == "name")
+					user.groups.back().second = value;
+			}
+			return true;
+		}
+
+	public:
+		/** Whether the response reports errors **/
+		bool errors = false;
+		std::vector<QueriedRecord> users;
+
+		bool StartObject() {
+			if (at(UserPath))
+				users.emplace_back();
+			else if (at(GroupPath) && !users.empty())
+				users.back().groups.emplace_back();
+			frames.push_back(Frame{.array = false, .key = {}});
+			return true;
+		}
+		bool EndObject(rapidjson::SizeType) {
+			frames.pop_back();
+			return true;
+		}
+		bool StartArray() {
+			frames.push_back(Frame{.array = true, .key = {}});
+			return true;
+		}
+		bool EndArray(rapidjson::SizeType) {
+			frames.pop_back();
+			return true;
+		}
+		bool Key(const char* str, rapidjson::SizeType length, bool) {
+			frames.back().key = std::string_view{str, length};
+			errors = errors || (frames.size() == 1 && frames.back().key == "errors");
+			return true;
+		}
+		bool Bool(bool value) {
+			if (value && at(MoreGroupsPath) && !users.empty())
+				users.back().moreGroups = true;
+			return true;
+		}
+		bool String(const char* str, rapidjson::SizeType length, bool) { return set(std::string_view{str, length}); }
+		/** Anything else is skipped; GitLab's GraphQL API returns IDs as strings **/
+		bool Default() { return set(std::monostate{}); }
+	};
+
+	/**
+	 * @brief Collects the fields of a single key object and the ID and username of the user object nested in it under
+	 * "user". Values of other fields are skipped.
+	 */
+	class OwnedKeyCollector final : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, OwnedKeyCollector> {
+	private:
+		unsigned depth = 0;
+		/** Whether the object at depth 2 is the key's user **/
+		bool inUser = false;
+		/** Whether the value of the current field of the key object is the user **/
+		bool userNext = false;
+		/** The field that the next value belongs to, if it is collected **/
+		Field* field = nullptr;
+
+		bool set(Field value) {
+			if (field)
+				*field = value;
+			field = nullptr;
+			return true;
+		}
+
+	public:
+		bool object = false;
+		Field key;
+		Field usage;
+		Field expiresAt;
+		Field userID;
+		Field username;
+
+		bool StartObject() {
+			field = nullptr;
+			object = object || depth == 0;
+			if (++depth == 2)
+				inUser = userNext;
+			userNext = false;
+			return true;
+		}
+		bool EndObject(rapidjson::SizeType) {
+			if (depth-- == 2)
+				inUser = false;
+			return true;
+		}
+		bool StartArray() {
+			field = nullptr;
+			userNext = false;
+			++depth;
+			return true;
+		}
+		bool EndArray(rapidjson::SizeType) {
+			--depth;
+			return true;
+		}
+		bool Key(const char* str, rapidjson::SizeType length, bool) {
+			field = nullptr;
+			std::string_view name{str, length};
+			if (depth == 1) {
+				userNext = name == "user";
+				if (name == "key")
+					field = &key;
+				else if (name == "usage_type")
+					field = &usage;
+				else if (name == "expires_at")
+					field = &expiresAt;
+			} else if (depth == 2 && inUser) {
+				if (name == "id")
+					field = &userID;
+				else if (name == "username")
+					field = &username;
+			}
+			return true;
+		}
+		bool Uint(unsigned value) { return set(uint64_t{value}); }
+		bool Uint64(uint64_t value) { return set(value); }
+		bool String(const char* str, rapidjson::SizeType length, bool) { return set(std::string_view{str, length}); }
+		/** Anything else (null, booleans, negative and floating point numbers) is skipped **/
+		bool Default() { return set(std::monostate{}); }
+	};
+} // namespace
+
+/**
+ * @brief Parses body in place and converts each collected record with convert, which returns std::nullopt for
+ * records that lack a needed field and a std::optional<std::optional<T>> for records that may be skipped.
+ * @param array whether the body is expected to be an array of objects instead of a single object
+ */
+template <typename T, std::size_t N, typename F>
+static std::expected<std::vector<T>, Error> collect(
+		std::string&& body, const std::array<std::string_view, N>& names, bool array, F&& convert
+) {
+	FieldCollector<N> collector{names};
+	rapidjson::Reader reader;
+	rapidjson::InsituStringStream stream{body.data()};
+	if (reader.Parse<rapidjson::kParseInsituFlag>(stream, collector).IsError() || collector.array != array)
+		return std::unexpected(Error::ResponseFormatError);
+	std::vector<T> results;
+	results.reserve(collector.records.size());
+	for (const auto& record : collector.records) {
+		auto converted = convert(record);
+		if (!converted)
+			return std::unexpected(Error::ResponseFormatError);
+		if (*converted)
+			results.emplace_back(std::move(**converted));
+	}
+	return results;
+}
+
+template <typename T>
+static std::expected<T, Error> single(std::expected<std::vector<T>, Error>&& collected) {
+	if (!collected.has_value())
+		return std::unexpected(collected.error());
+	if (collected->size() != 1)
+		return std::unexpected(Error::ResponseFormatError);
+	return std::move(collected->front());
+}
+
+static constexpr std::array<std::string_view, 3> UserFields{"id", "username", "name"};
+static constexpr std::array<std::string_view, 2> GroupFields{"id", "name"};
+static constexpr std::array<std::string_view, 3> MembershipFields{"source_id", "source_name", "source_type"};
+static constexpr std::array<std::string_view, 3> KeyFields{"key", "usage_type", "expires_at"};
+static constexpr std::array<std::string_view, 1> UsernameFields{"username"};
+
+static std::optional<std::optional<User>> toUser(const FieldCollector<3>::Record& record) {
+	auto id = get<UserID>(record[0]);
+	auto username = get<std::string_view>(record[1]);
+	auto name = get<std::string_view>(record[2]);
+	if (!id || !username || !name)
+		return std::nullopt;
+	return User{.id = *id, .username = std::string{*username}, .name = std::string{*name}};
+}
+
+static std::optional<std::optional<Group>> toGroup(const FieldCollector<2>::Record& record) {
+	auto id = get<GroupID>(record[0]);
+	auto name = get<std::string_view>(record[1]);
+	if (!id || !name)
+		return std::nullopt;
+	return Group{.id = *id, .name = std::string{*name}};
+}
+
+/** Memberships have the same shape as groups under other names, but also list projects, which are skipped **/
+static std::optional<std::optional<Group>> toMembership(const FieldCollector<3>::Record& record) {
+	auto type = get<std::string_view>(record[2]);
+	if (!type)
+		return std::nullopt;
+	if (*type != "Namespace")
+		return std::optional<Group>{};
+	return toGroup({record[0], record[1]});
+}
+
+std::expected<User, Error> gitlab::json::parseUser(std::string&& body) {
+	return single(collect<User>(std::move(body), UserFields, false, toUser));
+}
+
+std::expected<std::vector<User>, Error> gitlab::json::parseUsers(std::string&& body) {
+	return collect<User>(std::move(body), UserFields, true, toUser);
+}
+
+std::expected<Group, Error> gitlab::json::parseGroup(std::string&& body) {
+	return single(collect<Group>(std::move(body), GroupFields, false, toGroup));
+}
+
+std::expected<std::vector<Group>, Error> gitlab::json::parseGroups(std::string&& body) {
+	return collect<Group>(std::move(body), GroupFields, true, toGroup);
+}
+
+std::expected<std::vector<Group>, Error> gitlab::json::parseMemberships(std::string&& body) {
+	return collect<Group>(std::move(body), MembershipFields, true, toMembership);
+}
+
+/**
+ * @return the seconds since the epoch of a date or time as GitLab writes them, e.g. 2025-01-31 or
+ * 2025-01-31T12:00:00.000Z, or std::nullopt if text is neither
+ */
+static std::optional<int64_t> parseTimestamp(std::string_view text) {
+	auto number = [&text](std::size_t digits) -> std::optional<unsigned> {
+		unsigned value;
+		auto end = text.data() + std::min(digits, text.size());
+		if (text.size() < digits || std::from_chars(text.data(), end, value).ptr != end)
+			return std::nullopt;
+		text.remove_prefix(digits);
+		return value;
+	};
+	auto skip = [&text](char c) {
+		if (!text.starts_with(c))
+			return false;
+		text.remove_prefix(1);
+		return true;
+	};
+	auto year = number(4);
+	auto month = skip('-') ? number(2) : std::nullopt;
+	auto day = skip('-') ? number(2) : std::nullopt;
+	if (!year || !month || !day)
+		return std::nullopt;
+	std::chrono::year_month_day date{
+			std::chrono::year{static_cast<int>(*year)}, std::chrono::month{*month}, std::chrono::day{*day}
+	};
+	if (!date.ok())
+		return std::nullopt;
+	std::chrono::sys_seconds time = std::chrono::sys_days{date};
+	if (skip('T')) {
+		auto hours = number(2);
+		auto minutes = skip(':') ? number(2) : std::nullopt;
+		auto seconds = skip(':') ? number(2) : std::nullopt;
+		if (!hours || !minutes || !seconds)
+			return std::nullopt;
+		time += std::chrono::hours{*hours} + std::chrono::minutes{*minutes} + std::chrono::seconds{*seconds};
+		// Fractions of a second are ignored
+		if (skip('.'))
+			while (!text.empty() && text.front() >= '0' && text.front() <= '9')
+				text.remove_prefix(1);
+		// The time is either UTC or local time at an offset like +01:00
+		if (!skip('Z') && !text.empty()) {
+			bool east = skip('+');
+			if (!east && !skip('-'))
+				return std::nullopt;
+			auto offsetHours = number(2);
+			auto offsetMinutes = skip(':') || !text.empty() ? number(2) : std::optional{0u};
+			if (!offsetHours || !offsetMinutes)
+				return std::nullopt;
+			auto offset = std::chrono::hours{*offsetHours} + std::chrono::minutes{*offsetMinutes};
+			time += east ? -offset : offset;
+		}
+	}
+	if (!text.empty())
+		return std::nullopt;
+	return time.time_since_epoch().count();
+}
+
+/**
+ * @return the key, std::optional<SSHKey>{} if it is not usable for authentication or std::nullopt if it lacks a needed
+ * field
+ */
+static std::optional<std::optional<SSHKey>> toKey(const Field& key, const Field& usage, const Field& expiresAt) {
+	auto text = get<std::string_view>(key);
+	auto usageType = get<std::string_view>(usage);
+	if (!text || !usageType)
+		return std::nullopt;
+	if (*usageType != "auth" && *usageType != "auth_and_signing")
+		return std::optional<SSHKey>{};
+	// null if the key does not expire
+	int64_t expires = 0;
+	if (auto expiry = get<std::string_view>(expiresAt)) {
+		auto parsed = parseTimestamp(*expiry);
+		// A key whose expiry is not understood is left out rather than accepted forever
+		if (!parsed)
+			return std::optional<SSHKey>{};
+		expires = *parsed;
+	}
+	return SSHKey{.key = std::string{*text}, .expires = expires};
+}
+
+std::expected<std::vector<SSHKey>, Error> gitlab::json::parseKeys(std::string&& body) {
+	return collect<SSHKey>(std::move(body), KeyFields, true, [](const FieldCollector<3>::Record& record) {
+		return toKey(record[0], record[1], record[2]);
+	});
+}
+
+std::expected<std::optional<OwnedKey>, Error> gitlab::json::parseOwnedKey(std::string&& body) {
+	OwnedKeyCollector collector;
+	rapidjson::Reader reader;
+	rapidjson::InsituStringStream stream{body.data()};
+	if (reader.Parse<rapidjson::kParseInsituFlag>(stream, collector).IsError() || !collector.object)
+		return std::unexpected(Error::ResponseFormatError);
+	auto key = toKey(collector.key, collector.usage, collector.expiresAt);
+	// Read as const since std::get would otherwise be the better match
+	auto user = get<UserID>(std::as_const(collector.userID));
+	auto username = get<std::string_view>(std::as_const(collector.username));
+	if (!key || !user || !username)
+		return std::unexpected(Error::ResponseFormatError);
+	if (!*key)
+		return std::optional<OwnedKey>{};
+	return OwnedKey{.key = std::move(**key), .user = *user, .username = std::string{*username}};
+}
+
+std::expected<std::vector<std::string>, Error> gitlab::json::parseUsernames(std::string&& body) {
+	return collect<std::string>(
+			std::move(body), UsernameFields, true,
+			[](const FieldCollector<1>::Record& record) -> std::optional<std::optional<std::string>> {
+				auto username = get<std::string_view>(record[0]);
+				if (!username)
+					return std::nullopt;
+				return std::string{*username};
+			}
+	);
+}
+
+/** The numeric ID of a GraphQL global ID like gid://gitlab/User/42 of the given type **/
+static std::optional<unsigned> fromGlobalID(const Field& field, std::string_view type) {
+	auto gid = get<std::string_view>(field);
+	auto prefix = std::format("gid://gitlab/{}/", type);
+	if (!gid || !gid->starts_with(prefix))
+		return std::nullopt;
+	gid->remove_prefix(prefix.size());
+	unsigned id;
+	auto [end, error] = std::from_chars(gid->data(), gid->data() + gid->size(), id);
+	if (error != std::errc{} || end != gid->data() + gid->size())
+		return std::nullopt;
+	return id;
+}
+
+/**
+ * @brief Asks for up to MaxQueriedUsers users with the first MaxQueriedUsers of their group memberships each. The page
+ * sizes follow the constant such that a batch of that many users is never cut short.
+ */
+static const std::string UsersQuery = std::format(
+		"query($ids: [ID!], $usernames: [String!]) {{ users(ids: $ids, usernames: $usernames, first: {}) {{ nodes {{ "
+		"id username name groupMemberships(first: {}) {{ pageInfo {{ hasNextPage }} nodes {{ group {{ id name }} }} }} "
+		"}} }} }}",
+		gitlab::json::MaxQueriedUsers, gitlab::json::MaxQueriedUsers
+);
+
+/**
+ * @brief Builds a request for UsersQuery with variable set to the values.
+ */
+template <typename T, typename F>
+static std::string queryUsers(const char* variable, const std::vector<T>& values, F&& toString) {
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer{buffer};
+	writer.StartObject();
+	writer.Key("query");
+	writer.String(UsersQuery.data(), static_cast<rapidjson::SizeType>(UsersQuery.size()));
+	writer.Key("variables");
+	writer.StartObject();
+	writer.Key(variable);
+	writer.StartArray();
+	for (const auto& value : values) {
+		std::string text = toString(value);
+		writer.String(text.data(), static_cast<rapidjson::SizeType>(text.size()));
+	}
+	writer.EndArray();
+	writer.EndObject();
+	writer.EndObject();
+	return std::string{buffer.GetString(), buffer.GetSize()};
+}
+
+std::string gitlab::json::queryUsersByID(const std::vector<UserID>& ids) {
+	return queryUsers("ids", ids, [](UserID id) { return std::format("gid://gitlab/User/{}", id); });
+}
+
+std::string gitlab::json::queryUsersByUsername(const std::vector<std::string>& usernames) {
+	return queryUsers("usernames", usernames, [](const std::string& username) { return username; });
+}
+
+std::expected<std::vector<QueriedUser>, Error> gitlab::json::parseQueriedUsers(std::string&& body) {
+	QueryCollector collector;
+	rapidjson::Reader reader;
+	rapidjson::InsituStringStream stream{body.data()};
+	if (reader.Parse<rapidjson::kParseInsituFlag>(stream, collector).IsError())
+		return std::unexpected(Error::ResponseFormatError);
+	if (collector.errors)
+		return std::unexpected(Error::GenericError);
+	std::vector<QueriedUser> users;
+	users.reserve(collector.users.size());
+	for (const auto& record : collector.users) {
+		auto id = fromGlobalID(record.id, "User");
+		auto username = get<std::string_view>(record.username);
+		auto name = get<std::string_view>(record.name);
+		if (!id || !username || !name)
+			return std::unexpected(Error::ResponseFormatError);
+		QueriedUser queried{
+				.user = User{.id = *id, .username = std::string{*username}, .name = std::string{*name}},
+				.moreGroups = record.moreGroups
+		};
+		for (const auto& [groupID, groupName] : record.groups) {
+			auto id = fromGlobalID(groupID, "Group");
+			auto name = get<std::string_view>(groupName);
+			if (!id || !name)
+				return std::unexpected(Error::ResponseFormatError);
+			queried.user.groups.push_back(Group{.id = *id, .name = std::string{*name}});
+		}
+		users.emplace_back(std::move(queried));
+	}
+	return users;
+}
\ No newline at end of file
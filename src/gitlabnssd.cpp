@@ -3,177 +3,888 @@
  * @brief The gitlabnss daemon executable
  */
 
+#include <cachedgitlab.hpp>
+#include <checkpoint.hpp>
 #include <config.hpp>
+#include <directory.hpp>
 #include <gitlabapi.hpp>
+#include <homes.hpp>
+#include <logging.hpp>
+#include <metrics.hpp>
+#include <scheduler.hpp>
+#include <sharedtable.hpp>
 
-#include <spdlog/sinks/basic_file_sink.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
-#include <capnp/ez-rpc.h>
+#include <capnp/rpc-twoparty.h>
+#include <kj/array.h>
+#include <kj/async-io.h>
+#include <kj/async-unix.h>
 #include <protocol/messages.capnp.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <csignal>
+#include <expected>
 #include <filesystem>
+#include <format>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <optional>
 #include <ranges>
 #include <string>
+#include <string_view>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
 namespace fs = std::filesystem;
 
-static void initLogger() {
-#if DEBUG
-	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
-#endif
-	auto basic_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>("/var/log/gitlabnss.log");
-	std::vector<spdlog::sink_ptr> sinks{
-#if DEBUG
-			console_sink,
-#endif
-			basic_sink
-	};
-	auto logger = std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end());
-	logger->set_level(spdlog::level::trace);
-	logger->flush_on(spdlog::level::info);
-	spdlog::set_default_logger(logger);
+template <typename T>
+static uint32_t errcode(const std::expected<T, Error>& result) {
+	return static_cast<uint32_t>(result.has_value() ? Error::Ok : result.error());
 }
 
-class GitLabDaemonImpl final : public GitLabDaemon::Server {
+static void copyGroup(const gitlab::Group& group, Group::Builder output) {
+	output.setId(group.id);
+	output.setName(group.name);
+}
+
+static void copyMembers(const std::vector<std::string>& members, Group::Builder output) {
+	auto usernames = output.initMembers(members.size());
+	for (auto i = 0; i < members.size(); ++i)
+		usernames.set(i, members[i].c_str());
+}
+
+static void copyUser(const gitlab::User& user, User::Builder output) {
+	output.setId(user.id);
+	output.setName(user.name);
+	output.setUsername(user.username);
+	auto groups = output.initGroups(user.groups.size());
+	for (auto i = 0; i < user.groups.size(); ++i)
+		copyGroup(user.groups[i], groups[i]);
+}
+
+/** The RPCs as they are measured, in the order of RPCNames **/
+enum class RPC {
+	GetUserByID,
+	GetUserByName,
+	GetSSHKeys,
+	GetSSHKeysByName,
+	GetSSHKeyByFingerprint,
+	GetGroupByID,
+	GetGroupByName,
+	GetGroupIDs,
+	ListUsers,
+	ListGroups,
+};
+static constexpr std::array<std::string_view, 10> RPCNames{
+		"getUserByID",  "getUserByName",  "getSSHKeys",  "getSSHKeysByName", "getSSHKeyByFingerprint",
+		"getGroupByID", "getGroupByName", "getGroupIDs", "listUsers",        "listGroups"
+};
+/** How an RPC turned out: the errcodes of Error in their order, then calls that failed with an exception **/
+static constexpr std::array<std::string_view, 8> ResultNames{
+		"ok", "not_found", "authentication_error", "server_error", "response_format_error", "generic_error",
+		"rate_limited", "failed"
+};
+
+/**
+ * @brief The state that the threads answering RPCs share. GitLab is asked on the thread that created it.
+ */
+class Daemon final {
+	friend class GitLabDaemonImpl;
+
 private:
+	/** What is measured of the calls of one RPC **/
+	struct RPCMetrics {
+		/** Of the calls that were answered or failed; cancelled calls are only counted as in flight **/
+		metrics::Histogram duration;
+		metrics::Gauge inFlight;
+		/** By the index in ResultNames **/
+		std::array<metrics::Counter, ResultNames.size()> results;
+	};
+
+	gitlab::HttpClient& http;
+	std::array<RPCMetrics, RPCNames.size()> rpcMetrics;
+	metrics::Gauge openConnections;
+	metrics::Counter acceptedConnections;
 	Config config;
+	gitlab::Scheduler scheduler;
 	gitlab::GitLab gitlab;
+	gitlab::SnapshotStore snapshots;
+	gitlab::CachedGitLab cache;
+	gitlab::DirectorySync directorySync;
+	kj::Timer& timer;
+	sharedtable::Writer table;
+	gitlab::HomeProvisioner homes;
+	/** Writes the periodic checkpoints, which fsync, off the event loop **/
+	std::thread checkpointWriter;
 
 public:
-	GitLabDaemonImpl(Config config) : config(config), gitlab(this->config) {}
+	Daemon(Config config, gitlab::HttpClient& http, kj::Timer& timer)
+			: http(http), config(config), scheduler(this->config, http, timer), gitlab(this->config, scheduler),
+			  cache(this->config, gitlab, snapshots),
+			  directorySync(this->config, gitlab, snapshots, timer), timer(timer),
+			  table(this->config.sharedTable.path), homes(this->config) {}
+	~Daemon() {
+		if (checkpointWriter.joinable())
+			checkpointWriter.join();
+	}
 
-	virtual ::kj::Promise<void> getUserByID(GetUserByIDContext context) override {
-		spdlog::info("getUserByID({})", context.getParams().getId());
-		gitlab::User user;
-		Error err;
-		if ((err = gitlab.fetchUserByID(context.getParams().getId(), user)) == Error::Ok &&
-			(err = gitlab.fetchGroups(user)) == Error::Ok) {
-			spdlog::debug("Found");
-			auto output = context.getResults().initUser();
-			output.setId(user.id);
-			output.setName(user.name);
-			output.setUsername(user.username);
-			auto groups = output.initGroups(user.groups.size());
-			for (auto i = 0; i < user.groups.size(); ++i) {
-				groups[i].setId(user.groups[i].id);
-				groups[i].setName(user.groups[i].name);
-			}
+	/** Periodically mirrors the GitLab directory if enabled in the config **/
+	kj::Promise<void> runSync() {
+		if (!config.sync.enabled)
+			return kj::NEVER_DONE;
+		spdlog::info("Syncing with GitLab every {} seconds", config.sync.interval);
+		return directorySync.run();
+	}
+
+	/** Periodically publishes the known users and groups for the NSS module if enabled in the config **/
+	kj::Promise<void> runPublisher() {
+		if (!config.sharedTable.enabled)
+			return kj::NEVER_DONE;
+		publishTable();
+		auto next = timer.afterDelay(config.sharedTable.interval * kj::SECONDS);
+		// Lookups answered from the table are not seen by the caches, so what it holds is kept fresh from here. Those
+		// entries that would expire before the one after the next publication are fetched again.
+		auto within = std::chrono::seconds{2 * config.sharedTable.interval};
+		return cache.refreshExpiring(within, config.gitlabapi.pageConcurrency)
+				.then([]() {},
+					  [](kj::Exception&& exception) {
+						  logging::limited(
+								  spdlog::level::warn, "Refreshing the shared table's entries failed: {}",
+								  exception.getDescription().cStr()
+						  );
+					  })
+				.then([next = kj::mv(next)]() mutable { return kj::mv(next); })
+				.then([this]() { return runPublisher(); });
+	}
+
+	void publishTable() {
+		auto contents = cache.contents();
+		std::vector<sharedtable::UserRecord> users;
+		users.reserve(contents.users.size());
+		for (const auto& user : contents.users)
+			users.push_back(sharedtable::UserRecord{
+					.id = user.id,
+					.group = user.groups.empty() ? std::nullopt : std::optional<uint32_t>{user.groups.front().id},
+					.username = user.username,
+					.name = user.name
+			});
+		std::vector<sharedtable::GroupRecord> groups;
+		groups.reserve(contents.groups.size());
+		for (const auto& group : contents.groups) {
+			auto members = contents.members.find(group.id);
+			groups.push_back(sharedtable::GroupRecord{
+					.id = group.id,
+					.name = group.name,
+					.members = members != contents.members.end() ? &members->second : nullptr
+			});
 		}
-		context.getResults().setErrcode(static_cast<uint32_t>(err));
-		return kj::READY_NOW;
+		// Outlives a missed publication but not a daemon that died
+		auto expires = std::chrono::system_clock::now() + 2 * std::chrono::seconds{config.sharedTable.interval};
+		auto published = table.publish(
+				users, groups, contents.complete,
+				std::chrono::duration_cast<std::chrono::seconds>(expires.time_since_epoch()).count()
+		);
+		if (published)
+			spdlog::debug("Published {} users and {} groups to the shared table", users.size(), groups.size());
+		else
+			spdlog::warn(
+					"Publishing the shared table to {} failed with errno {}", config.sharedTable.path.c_str(), errno
+			);
 	}
-	virtual ::kj::Promise<void> getUserByName(GetUserByNameContext context) override {
-		spdlog::info("getUserByName({})", context.getParams().getName().cStr());
-		gitlab::User user;
-		Error err;
-		if ((err = gitlab.fetchUserByUsername(context.getParams().getName().cStr(), user)) == Error::Ok &&
-			(err = gitlab.fetchGroups(user)) == Error::Ok) {
-			spdlog::debug("Found");
-			auto output = context.getResults().initUser();
-			output.setId(user.id);
-			output.setName(user.name);
-			output.setUsername(user.username);
-			auto groups = output.initGroups(user.groups.size());
-			for (auto i = 0; i < user.groups.size(); ++i) {
-				groups[i].setId(user.groups[i].id);
-				groups[i].setName(user.groups[i].name);
-			}
+
+	/**
+	 * @brief Restores the caches from the last checkpoint if enabled in the config. The returned promise resolves
+	 * once the restored entries were fetched again.
+	 */
+	kj::Promise<void> restoreCheckpoint() {
+		if (!config.checkpoint.enabled)
+			return kj::READY_NOW;
+		auto started = std::chrono::steady_clock::now();
+		auto checkpoint = gitlab::Checkpoint::load(config.checkpoint.path);
+		if (!checkpoint) {
+			spdlog::info("No usable checkpoint at {}; starting with empty caches", config.checkpoint.path.c_str());
+			return kj::READY_NOW;
 		}
-		context.getResults().setErrcode(static_cast<uint32_t>(err));
-		return kj::READY_NOW;
+		auto users = checkpoint->users.size(), groups = checkpoint->groups.size();
+		cache.restore(std::move(*checkpoint));
+		auto took = std::chrono::steady_clock::now() - started;
+		spdlog::info(
+				"Restored {} users and {} groups from {} in {} ms", users, groups, config.checkpoint.path.c_str(),
+				std::chrono::duration_cast<std::chrono::milliseconds>(took).count()
+		);
+		return cache.revalidate(config.checkpoint.concurrency).then([started]() {
+			auto took = std::chrono::steady_clock::now() - started;
+			spdlog::info(
+					"Revalidated the restored entries in {} ms",
+					std::chrono::duration_cast<std::chrono::milliseconds>(took).count()
+			);
+		});
 	}
 
-	virtual ::kj::Promise<void> getSSHKeys(GetSSHKeysContext context) {
-		spdlog::info("getSSHKeys({})", context.getParams().getId());
-		std::vector<std::string> keys;
-		Error err;
-		if ((err = gitlab.fetchAuthorizedKeys(context.getParams().getId(), keys)) == Error::Ok) {
-			spdlog::debug("Found");
-			// When std::ranges::to is finally implemented by GCC:
-			// std::string joined = keys | std::views::join | std::ranges::to<std::string>();
-			std::string joined;
-			for (auto&& key : keys)
-				joined += key;
-
-			context.getResults().setKeys(joined);
+	/** Periodically saves the cached entries if enabled in the config **/
+	kj::Promise<void> runCheckpoints() {
+		if (!config.checkpoint.enabled)
+			return kj::NEVER_DONE;
+		return timer.afterDelay(config.checkpoint.interval * kj::SECONDS)
+				.then([this]() {
+					// The entries are copied on the event loop, which owns the caches, but written by another thread
+					if (checkpointWriter.joinable())
+						checkpointWriter.join();
+					auto [saved, savedFulfiller] = kj::newPromiseAndCrossThreadFulfiller<void>();
+					checkpointWriter = std::thread([checkpoint = cache.checkpoint(), path = config.checkpoint.path,
+													savedFulfiller = kj::mv(savedFulfiller)]() mutable {
+						logSaved(checkpoint, path, checkpoint.save(path));
+						savedFulfiller->fulfill();
+					});
+					return kj::mv(saved);
+				})
+				.then([this]() { return runCheckpoints(); });
+	}
+
+	/** Saves the cached entries at once, e.g. on shutdown, if enabled in the config **/
+	void saveCheckpoint() {
+		if (!config.checkpoint.enabled)
+			return;
+		if (checkpointWriter.joinable())
+			checkpointWriter.join();
+		auto checkpoint = cache.checkpoint();
+		logSaved(checkpoint, config.checkpoint.path, checkpoint.save(config.checkpoint.path));
+	}
+
+	static void logSaved(const gitlab::Checkpoint& checkpoint, const fs::path& path, std::error_code error) {
+		if (!error)
+			spdlog::debug(
+					"Saved {} users and {} groups to the checkpoint", checkpoint.users.size(), checkpoint.groups.size()
+			);
+		else
+			spdlog::warn("Saving the checkpoint to {} failed: {}", path.c_str(), error.message());
+	}
+
+	void logCacheStats() const {
+		auto log = [](const char* name, const auto& stats) {
+			spdlog::info(
+					"Cache {}: {} entries, {} hits, {} expired hits, {} misses, {} evictions, {} background refreshes",
+					name, stats.size, stats.hits, stats.staleHits, stats.misses, stats.evictions, stats.refreshes
+			);
+		};
+		auto stats = cache.stats();
+		log("users by id", stats.usersByID);
+		log("users by name", stats.usersByName);
+		log("groups by id", stats.groupsByID);
+		log("groups by name", stats.groupsByName);
+		log("ssh keys", stats.keys);
+		log("ssh keys by name", stats.keysByName);
+		log("group members", stats.members);
+		log("ssh key fingerprints", stats.fingerprints);
+		auto logNegative = [](const char* name, const auto& stats) {
+			spdlog::info(
+					"Cache {}: {} entries, {} hits, {} filter hits, {} misses, {} evictions", name, stats.size,
+					stats.hits, stats.filterHits, stats.misses, stats.evictions
+			);
+		};
+		logNegative("unknown user ids", stats.unknownUserIDs);
+		logNegative("unknown usernames", stats.unknownUsernames);
+		logNegative("unknown group ids", stats.unknownGroupIDs);
+		logNegative("unknown groupnames", stats.unknownGroupnames);
+		logNegative("unknown fingerprints", stats.unknownFingerprints);
+		spdlog::info("{} lookups shared a request to GitLab with a concurrent lookup", stats.coalesced);
+		auto sent = scheduler.stats();
+		spdlog::info(
+				"GitLab: {} requests sent, {} rate limited, {} retried, {} queued, {} given up in the queue", sent.sent,
+				sent.rateLimited, sent.retries, sent.queued, sent.expired
+		);
+	}
+
+	/** Counts the connection as open until it is destroyed **/
+	kj::Own<kj::AsyncIoStream> track(kj::Own<kj::AsyncIoStream>&& connection) {
+		acceptedConnections.add();
+		openConnections.add(1);
+		return kj::mv(connection).attach(kj::defer([this]() { openConnections.add(-1); }));
+	}
+
+	/** @return the metrics in Prometheus' text exposition format; called on the thread that asks GitLab **/
+	std::string renderMetrics() const {
+		metrics::Exposition out;
+		out.family("gitlabnss_rpc_requests_total", "counter", "RPCs answered by the daemon by how they turned out");
+		for (std::size_t rpc = 0; rpc < RPCNames.size(); ++rpc)
+			for (std::size_t result = 0; result < ResultNames.size(); ++result)
+				out.sample(
+						"gitlabnss_rpc_requests_total",
+						std::format(R"(method="{}",result="{}")", RPCNames[rpc], ResultNames[result]),
+						static_cast<double>(rpcMetrics[rpc].results[result].value())
+				);
+		out.family("gitlabnss_rpc_duration_seconds", "histogram", "How long answering an RPC took");
+		for (std::size_t rpc = 0; rpc < RPCNames.size(); ++rpc)
+			out.histogram(
+					"gitlabnss_rpc_duration_seconds", std::format(R"(method="{}")", RPCNames[rpc]),
+					rpcMetrics[rpc].duration.snapshot()
+			);
+		out.family("gitlabnss_rpc_in_flight", "gauge", "RPCs that are being answered");
+		for (std::size_t rpc = 0; rpc < RPCNames.size(); ++rpc)
+			out.sample(
+					"gitlabnss_rpc_in_flight", std::format(R"(method="{}")", RPCNames[rpc]),
+					static_cast<double>(rpcMetrics[rpc].inFlight.value())
+			);
+		out.family("gitlabnss_connections_open", "gauge", "Open connections of NSS modules and other clients");
+		out.sample("gitlabnss_connections_open", "", static_cast<double>(openConnections.value()));
+		out.family("gitlabnss_connections_total", "counter", "Connections that were accepted");
+		out.sample("gitlabnss_connections_total", "", static_cast<double>(acceptedConnections.value()));
+
+		out.family("gitlabnss_gitlab_requests_total", "counter", "Requests to GitLab by endpoint and HTTP status");
+		scheduler.forEachEndpoint([&out](const std::string& path, const gitlab::Scheduler::Endpoint& endpoint) {
+			for (auto [status, count] : endpoint.statuses)
+				out.sample(
+						"gitlabnss_gitlab_requests_total", std::format(R"(endpoint="{}",status="{}")", path, status),
+						static_cast<double>(count)
+				);
+		});
+		out.family("gitlabnss_gitlab_duration_seconds", "histogram", "How long requests to GitLab took by endpoint");
+		scheduler.forEachEndpoint([&out](const std::string& path, const gitlab::Scheduler::Endpoint& endpoint) {
+			out.histogram(
+					"gitlabnss_gitlab_duration_seconds", std::format(R"(endpoint="{}")", path),
+					endpoint.latency.snapshot()
+			);
+		});
+		auto sent = scheduler.stats();
+		// Writes a family with a single sample
+		auto single = [&out](std::string_view name, std::string_view type, std::string_view help, double value) {
+			out.family(name, type, help);
+			out.sample(name, "", value);
+		};
+		single("gitlabnss_gitlab_in_flight", "gauge", "Requests to GitLab that were not answered yet", sent.inFlight);
+		single("gitlabnss_gitlab_queued", "gauge", "Requests to GitLab that wait to be sent", sent.queued);
+		single("gitlabnss_gitlab_rate_limited_total", "counter", "Responses of GitLab with 429", sent.rateLimited);
+		single("gitlabnss_gitlab_retries_total", "counter", "Requests to GitLab that were sent again", sent.retries);
+		single("gitlabnss_gitlab_expired_total", "counter", "Lookups that were queued for too long", sent.expired);
+		single("gitlabnss_gitlab_connections", "gauge", "Open connections to GitLab", http.connections());
+
+		auto stats = cache.stats();
+		auto caches = [&stats](auto&& each) {
+			each("users_by_id", stats.usersByID);
+			each("users_by_name", stats.usersByName);
+			each("groups_by_id", stats.groupsByID);
+			each("groups_by_name", stats.groupsByName);
+			each("ssh_keys", stats.keys);
+			each("ssh_keys_by_name", stats.keysByName);
+			each("group_members", stats.members);
+			each("ssh_key_fingerprints", stats.fingerprints);
+		};
+		auto negativeCaches = [&stats](auto&& each) {
+			each("unknown_user_ids", stats.unknownUserIDs);
+			each("unknown_usernames", stats.unknownUsernames);
+			each("unknown_group_ids", stats.unknownGroupIDs);
+			each("unknown_groupnames", stats.unknownGroupnames);
+			each("unknown_fingerprints", stats.unknownFingerprints);
+		};
+		// Writes a family with one sample per cache of the given kind
+		auto perCache = [&out](auto&& kind, std::string_view name, std::string_view type, std::string_view help,
+							   auto&& value) {
+			out.family(name, type, help);
+			kind([&](std::string_view cache, const auto& stats) {
+				out.sample(name, std::format(R"(cache="{}")", cache), static_cast<double>(value(stats)));
+			});
+		};
+		perCache(caches, "gitlabnss_cache_entries", "gauge", "Cached entries", [](const auto& s) { return s.size; });
+		perCache(caches, "gitlabnss_cache_hits_total", "counter", "Lookups answered fresh", [](const auto& s) {
+			return s.hits;
+		});
+		perCache(
+				caches, "gitlabnss_cache_expired_hits_total", "counter", "Lookups answered by an expired entry",
+				[](const auto& s) { return s.staleHits; }
+		);
+		perCache(caches, "gitlabnss_cache_misses_total", "counter", "Lookups that asked GitLab", [](const auto& s) {
+			return s.misses;
+		});
+		perCache(
+				caches, "gitlabnss_cache_evictions_total", "counter", "Entries evicted to make room",
+				[](const auto& s) { return s.evictions; }
+		);
+		perCache(
+				caches, "gitlabnss_cache_refreshes_total", "counter", "Entries refreshed in the background",
+				[](const auto& s) { return s.refreshes; }
+		);
+		perCache(
+				negativeCaches, "gitlabnss_negative_cache_entries", "gauge", "Unknown keys remembered exactly",
+				[](const auto& s) { return s.size; }
+		);
+		perCache(
+				negativeCaches, "gitlabnss_negative_cache_hits_total", "counter", "Lookups of keys remembered exactly",
+				[](const auto& s) { return s.hits; }
+		);
+		perCache(
+				negativeCaches, "gitlabnss_negative_cache_filter_hits_total", "counter",
+				"Lookups of keys remembered by the bloom filters", [](const auto& s) { return s.filterHits; }
+		);
+		perCache(
+				negativeCaches, "gitlabnss_negative_cache_misses_total", "counter", "Lookups of keys not remembered",
+				[](const auto& s) { return s.misses; }
+		);
+		perCache(
+				negativeCaches, "gitlabnss_negative_cache_evictions_total", "counter",
+				"Keys pushed out of the exact cache into the bloom filters", [](const auto& s) { return s.evictions; }
+		);
+		single(
+				"gitlabnss_coalesced_lookups_total", "counter",
+				"Lookups that shared a request to GitLab with a concurrent lookup", stats.coalesced
+		);
+		return std::move(out).str();
+	}
+};
+
+/**
+ * @brief Answers the RPCs of the connections that one thread accepted. Each thread has its own instance.
+ */
+class GitLabDaemonImpl final : public GitLabDaemon::Server {
+private:
+	/** Upper bound for the number of entries per enumeration batch **/
+	static constexpr unsigned MaxBatch = 1000;
+	/** The index in ResultNames of calls that failed with an exception **/
+	static constexpr std::size_t Failed = ResultNames.size() - 1;
+
+	Daemon& daemon;
+
+	/**
+	 * @brief Answers a group lookup including the group's members. If the members cannot be fetched, the group is
+	 * returned without them.
+	 */
+	template <typename Context>
+	kj::Promise<void> respondWithMembers(Context context, std::expected<gitlab::Group, Error>&& group) {
+		if (!group.has_value()) {
+			context.getResults().setErrcode(errcode(group));
+			return kj::READY_NOW;
 		}
-		context.getResults().setErrcode(static_cast<uint32_t>(err));
-		return kj::READY_NOW;
+		return daemon.cache.getGroupMembers(group->id)
+				.then([context, group = std::move(*group)](std::expected<std::vector<std::string>, Error>&& members
+						  ) mutable {
+					spdlog::debug("Found");
+					auto output = context.getResults().initGroup();
+					copyGroup(group, output);
+					if (members.has_value()) {
+						copyMembers(*members, output);
+					} else {
+						logging::limited(
+								spdlog::level::warn, "Fetching the members of group {} failed with error {}", group.id,
+								static_cast<int>(members.error())
+						);
+					}
+					context.getResults().setErrcode(static_cast<uint32_t>(Error::Ok));
+				});
+	}
+
+	/**
+	 * @brief Answers an RPC by calling answer() and measures how long that takes and how it turned out.
+	 */
+	template <typename Context, typename F>
+	kj::Promise<void> measure(RPC rpc, Context context, F&& answer) {
+		auto& metrics = daemon.rpcMetrics[static_cast<std::size_t>(rpc)];
+		metrics.inFlight.add(1);
+		auto started = std::chrono::steady_clock::now();
+		return kj::evalNow(std::forward<F>(answer))
+				.then(
+						[&metrics, context, started]() mutable {
+							metrics.duration.observe(std::chrono::steady_clock::now() - started);
+							auto result = std::min<std::size_t>(context.getResults().getErrcode(), Failed);
+							metrics.results[result].add();
+						},
+						[&metrics, started](kj::Exception&& exception) {
+							metrics.duration.observe(std::chrono::steady_clock::now() - started);
+							metrics.results[Failed].add();
+							kj::throwFatalException(kj::mv(exception));
+						}
+				)
+				.attach(kj::defer([&metrics]() { metrics.inFlight.add(-1); }));
+	}
+
+public:
+	explicit GitLabDaemonImpl(Daemon& daemon) noexcept : daemon(daemon) {}
+
+	virtual ::kj::Promise<void> getUserByID(GetUserByIDContext context) override {
+		spdlog::debug("getUserByID({})", context.getParams().getId());
+		return measure(RPC::GetUserByID, context, [&]() {
+			return daemon.cache.getUserByID(context.getParams().getId())
+					.then([this, context](std::expected<gitlab::User, Error>&& user) mutable {
+						if (user.has_value()) {
+							spdlog::debug("Found");
+							copyUser(*user, context.getResults().initUser());
+							daemon.homes.request(*user);
+						}
+						context.getResults().setErrcode(errcode(user));
+					});
+		});
+	}
+	virtual ::kj::Promise<void> getUserByName(GetUserByNameContext context) override {
+		spdlog::debug("getUserByName({})", context.getParams().getName().cStr());
+		return measure(RPC::GetUserByName, context, [&]() {
+			return daemon.cache.getUserByName(context.getParams().getName().cStr())
+					.then([this, context](std::expected<gitlab::User, Error>&& user) mutable {
+						if (user.has_value()) {
+							spdlog::debug("Found");
+							copyUser(*user, context.getResults().initUser());
+							daemon.homes.request(*user);
+						}
+						context.getResults().setErrcode(errcode(user));
+					});
+		});
+	}
+
+	virtual ::kj::Promise<void> getSSHKeys(GetSSHKeysContext context) {
+		spdlog::debug("getSSHKeys({})", context.getParams().getId());
+		return measure(RPC::GetSSHKeys, context, [&]() {
+			return daemon.cache.getAuthorizedKeys(context.getParams().getId())
+					.then([context](std::expected<std::vector<std::string>, Error>&& keys) mutable {
+						if (keys.has_value()) {
+							spdlog::debug("Found");
+							// When std::ranges::to is finally implemented by GCC:
+							// std::string joined = keys | std::views::join_with('\n') | std::ranges::to<std::string>();
+							std::string joined;
+							for (auto&& key : *keys) {
+								if (!joined.empty())
+									joined += '\n';
+								joined += key;
+							}
+							context.getResults().setKeys(joined);
+						}
+						context.getResults().setErrcode(errcode(keys));
+					});
+		});
+	}
+
+	virtual ::kj::Promise<void> getSSHKeysByName(GetSSHKeysByNameContext context) override {
+		spdlog::debug("getSSHKeysByName({})", context.getParams().getName().cStr());
+		return measure(RPC::GetSSHKeysByName, context, [&]() {
+			return daemon.cache.getAuthorizedKeys(context.getParams().getName().cStr())
+					.then([context](std::expected<std::vector<std::string>, Error>&& keys) mutable {
+						if (keys.has_value()) {
+							spdlog::debug("Found {} keys", keys->size());
+							auto output = context.getResults().initKeys(keys->size());
+							for (auto i = 0; i < keys->size(); ++i)
+								output.set(i, (*keys)[i].c_str());
+						}
+						context.getResults().setErrcode(errcode(keys));
+					});
+		});
+	}
+
+	virtual ::kj::Promise<void> getSSHKeyByFingerprint(GetSSHKeyByFingerprintContext context) override {
+		auto params = context.getParams();
+		spdlog::debug("getSSHKeyByFingerprint({}, {})", params.getName().cStr(), params.getFingerprint().cStr());
+		return measure(RPC::GetSSHKeyByFingerprint, context, [&]() {
+			return daemon.cache.getAuthorizedKey(params.getName().cStr(), params.getFingerprint().cStr())
+					.then([context](std::expected<std::string, Error>&& key) mutable {
+						if (key.has_value())
+							context.getResults().setKey(key->c_str());
+						context.getResults().setErrcode(errcode(key));
+					});
+		});
 	}
 
 	virtual ::kj::Promise<void> getGroupByID(GetGroupByIDContext context) override {
-		spdlog::info("getGroupByID({})", context.getParams().getId());
-		gitlab::Group group;
-		Error err;
-		if ((err = gitlab.fetchGroupByID(context.getParams().getId(), group)) == Error::Ok) {
-			spdlog::debug("Found");
-			auto output = context.getResults().initGroup();
-			output.setId(group.id);
-			output.setName(group.name);
-		}
-		context.getResults().setErrcode(static_cast<uint32_t>(err));
-		return kj::READY_NOW;
+		spdlog::debug("getGroupByID({})", context.getParams().getId());
+		return measure(RPC::GetGroupByID, context, [&]() {
+			return daemon.cache.getGroupByID(context.getParams().getId())
+					.then([this, context](std::expected<gitlab::Group, Error>&& group) mutable {
+						return respondWithMembers(context, std::move(group));
+					});
+		});
 	}
 	virtual ::kj::Promise<void> getGroupByName(GetGroupByNameContext context) override {
-		spdlog::info("getGroupByName({})", context.getParams().getName().cStr());
-		gitlab::Group group;
-		Error err;
-		if ((err = gitlab.fetchGroupByName(context.getParams().getName().cStr(), group)) == Error::Ok) {
-			spdlog::debug("Found");
-			auto output = context.getResults().initGroup();
-			output.setId(group.id);
-			output.setName(group.name);
+		spdlog::debug("getGroupByName({})", context.getParams().getName().cStr());
+		return measure(RPC::GetGroupByName, context, [&]() {
+			return daemon.cache.getGroupByName(context.getParams().getName().cStr())
+					.then([this, context](std::expected<gitlab::Group, Error>&& group) mutable {
+						return respondWithMembers(context, std::move(group));
+					});
+		});
+	}
+
+	virtual ::kj::Promise<void> getGroupIDs(GetGroupIDsContext context) override {
+		spdlog::debug("getGroupIDs({})", context.getParams().getName().cStr());
+		return measure(RPC::GetGroupIDs, context, [&]() {
+			return daemon.cache.getUserByName(context.getParams().getName().cStr())
+					.then([this, context](std::expected<gitlab::User, Error>&& user) mutable {
+						if (user.has_value()) {
+							spdlog::debug("Found {} groups", user->groups.size());
+							// Asked for at every login, even if the NSS module answered the passwd lookup by itself
+							daemon.homes.request(*user);
+							auto gids = context.getResults().initGids(user->groups.size());
+							for (auto i = 0; i < user->groups.size(); ++i)
+								gids.set(i, user->groups[i].id + daemon.config.nss.gidOffset);
+						}
+						context.getResults().setErrcode(errcode(user));
+					});
+		});
+	}
+
+	virtual ::kj::Promise<void> listUsers(ListUsersContext context) override {
+		auto params = context.getParams();
+		spdlog::debug("listUsers({}, {})", params.getCursor(), params.getCount());
+		return measure(RPC::ListUsers, context, [&]() {
+			return daemon.cache.listUsers(params.getCursor(), std::min(params.getCount(), MaxBatch))
+					.then([context](std::expected<gitlab::CachedGitLab::Batch<gitlab::User>, Error>&& batch) mutable {
+						if (batch.has_value()) {
+							spdlog::debug("Listed {} users", batch->entries.size());
+							auto results = context.getResults();
+							auto users = results.initUsers(batch->entries.size());
+							for (auto i = 0; i < batch->entries.size(); ++i)
+								copyUser(batch->entries[i], users[i]);
+							results.setCursor(batch->next);
+							results.setDone(batch->done);
+						}
+						context.getResults().setErrcode(errcode(batch));
+					});
+		});
+	}
+	virtual ::kj::Promise<void> listGroups(ListGroupsContext context) override {
+		auto params = context.getParams();
+		spdlog::debug("listGroups({}, {})", params.getCursor(), params.getCount());
+		return measure(RPC::ListGroups, context, [&]() {
+			return daemon.cache.listGroups(params.getCursor(), std::min(params.getCount(), MaxBatch))
+					.then([this, context](std::expected<gitlab::CachedGitLab::Batch<gitlab::Group>, Error>&& batch
+						  ) mutable {
+						if (batch.has_value()) {
+							spdlog::debug("Listed {} groups", batch->entries.size());
+							auto results = context.getResults();
+							auto groups = results.initGroups(batch->entries.size());
+							for (auto i = 0; i < batch->entries.size(); ++i) {
+								copyGroup(batch->entries[i], groups[i]);
+								// Fetching the members of every listed group would take a request per group
+								if (auto members = daemon.cache.knownGroupMembers(batch->entries[i].id))
+									copyMembers(*members, groups[i]);
+							}
+							results.setCursor(batch->next);
+							results.setDone(batch->done);
+						}
+						context.getResults().setErrcode(errcode(batch));
+					});
+		});
+	}
+};
+
+/** The socket is shared by all threads, so none of them takes ownership **/
+static constexpr unsigned ListenFlags =
+		kj::LowLevelAsyncIoProvider::ALREADY_NONBLOCK | kj::LowLevelAsyncIoProvider::ALREADY_CLOEXEC;
+
+/**
+ * @brief Creates the daemon's Unix socket, from which all threads accept connections.
+ * @return the listening socket or -1
+ */
+static int listenOn(const fs::path& path) {
+	sockaddr_un addr{.sun_family = AF_UNIX};
+	if (path.native().size() >= sizeof(addr.sun_path))
+		return -1;
+	std::ranges::copy(path.native(), addr.sun_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Serves the connections accepted from the listener like capnp::TwoPartyServer::listen() but counts them.
+ */
+static kj::Promise<void> serve(capnp::TwoPartyServer& server, kj::ConnectionReceiver& listener, Daemon& daemon) {
+	return listener.accept().then([&server, &listener, &daemon](kj::Own<kj::AsyncIoStream>&& connection) {
+		server.accept(daemon.track(kj::mv(connection)));
+		return serve(server, listener, daemon);
+	});
+}
+
+/**
+ * @brief Serves the daemon's metrics on the address, e.g. 127.0.0.1:9100 or unix:/path, until the promise is dropped.
+ */
+static kj::Promise<void> serveMetrics(
+		kj::Network& network, kj::Timer& timer, const Daemon& daemon, const std::string& address
+) {
+	// A socket left behind by a daemon that did not stop cleanly
+	if (address.starts_with("unix:"))
+		unlink(address.c_str() + 5);
+	auto parsing = network.parseAddress(address.c_str());
+	return parsing.then([&timer, &daemon, &address](kj::Own<kj::NetworkAddress>&& parsed) {
+		auto listener = parsed->listen();
+		auto server = kj::heap<metrics::Server>(*listener, timer, [&daemon]() { return daemon.renderMetrics(); });
+		spdlog::info("Serving metrics on {}", address);
+		auto running = server->run();
+		return running.attach(kj::mv(server), kj::mv(listener));
+	});
+}
+
+/**
+ * @brief A thread with its own event loop that accepts connections from the shared socket and answers their RPCs.
+ * @details Lookups that can be answered from memory are answered on the thread itself; those that need GitLab are
+ * handed to the main thread.
+ */
+class Worker final {
+private:
+	std::thread thread;
+	kj::Own<kj::CrossThreadPromiseFulfiller<void>> stop;
+
+public:
+	/** Resolves on the main thread once the worker's event loop is gone **/
+	kj::Promise<void> finished;
+
+	/** Starts the worker; throws if it cannot set up its event loop **/
+	Worker(Daemon& daemon, int listenFd, unsigned number) : finished(nullptr) {
+		auto [done, doneFulfiller] = kj::newPromiseAndCrossThreadFulfiller<void>();
+		finished = kj::mv(done);
+		std::promise<kj::Own<kj::CrossThreadPromiseFulfiller<void>>> stopper;
+		auto stopping = stopper.get_future();
+		thread = std::thread([&daemon, listenFd, number, &stopper, doneFulfiller = kj::mv(doneFulfiller)]() mutable {
+			bool started = false;
+			try {
+				auto io = kj::setupAsyncIo();
+				auto [stopped, stopFulfiller] = kj::newPromiseAndCrossThreadFulfiller<void>();
+				capnp::TwoPartyServer server{kj::heap<GitLabDaemonImpl>(daemon)};
+				auto listener = io.lowLevelProvider->wrapListenSocketFd(listenFd, ListenFlags);
+				auto listening = serve(server, *listener, daemon).eagerlyEvaluate([number](kj::Exception&& exception) {
+					spdlog::error(
+							"Thread {} stopped accepting connections: {}", number, exception.getDescription().cStr()
+					);
+				});
+				stopper.set_value(kj::mv(stopFulfiller));
+				started = true;
+				stopped.wait(io.waitScope);
+			} catch (std::exception& exception) {
+				// Until the worker started, the constructor waits for it and throws what kept it from starting
+				if (!started)
+					stopper.set_exception(std::current_exception());
+				else
+					spdlog::error("Thread {} stopped: {}", number, exception.what());
+			}
+			doneFulfiller->fulfill();
+		});
+		try {
+			stop = stopping.get();
+		} catch (...) {
+			thread.join();
+			throw;
 		}
-		context.getResults().setErrcode(static_cast<uint32_t>(err));
-		return kj::READY_NOW;
 	}
+	~Worker() {
+		if (thread.joinable())
+			thread.join();
+	}
+	Worker(const Worker&) = delete;
+	Worker& operator=(const Worker&) = delete;
+
+	/** Makes the worker close its connections and return; wait for finished before destroying it **/
+	void shutdown() { stop->fulfill(); }
 };
 
-static auto [promise, fulfiller] = kj::newPromiseAndFulfiller<void>();
 int main(int argc, char* argv[]) {
+	// Optionally given as the only argument, e.g. by bench/loadtest.sh; resolved before daemon() changes to /
+	auto configPath = argc > 1 ? fs::absolute(argv[1])
+							   : fs::current_path().root_path() / "etc" / "gitlabnss" / "gitlabnss.conf";
 	// Daemonize
 	daemon(0, 0);
 	{
 		std::ofstream fstream((std::filesystem::absolute("run") / "gitlabnssd.pid").c_str());
 		fstream << getpid() << std::endl;
 	}
+	// Blocks the signals before any thread (including the logger's) is started such that all of them inherit that and
+	// only the main thread's event loop receives them
+	kj::UnixEventPort::captureSignal(SIGINT);
+	kj::UnixEventPort::captureSignal(SIGTERM);
 
 	// Init
-	auto configPath = fs::current_path().root_path() / "etc" / "gitlabnss" / "gitlabnss.conf";
-	initLogger();
+	logging::init("/var/log/gitlabnss.log");
 	spdlog::info("Starting the GitLab NSS daemon...");
 	spdlog::info("Reading config from {}", configPath.string());
 	auto config = Config::fromFile(configPath);
+	logging::configure(config.logging.level, std::chrono::seconds{config.logging.repeatInterval});
+	for (const auto& problem : config.problems)
+		spdlog::warn("{}", problem);
+	// The NSS modules read the same config but have nowhere to complain to
+	if (!logging::levelFrom(config.logging.nssLevel))
+		spdlog::warn("Unknown log level \"{}\" for the NSS module; it logs errors only", config.logging.nssLevel);
 	auto socketPath = config.general.socketPath;
 	spdlog::info("Success! Will use {} to communicate with GitLab", config.gitlabapi.baseUrl);
 	spdlog::info("Binding socket to {}", socketPath.string());
-	capnp::Capability::Client heap{kj::heap<GitLabDaemonImpl>(config)};
-	auto addr = std::format("unix:{}", socketPath.string());
-	kj::StringPtr bind = addr.c_str();
-	capnp::EzRpcServer server{heap, bind};
-	auto& waitScope = server.getWaitScope();
-
-	waitScope.poll(); /* Poll once to create the socket file. */
+	auto io = kj::setupAsyncIo();
+	auto& waitScope = io.waitScope;
+	gitlab::HttpClient http{config, io.unixEventPort, io.provider->getTimer()};
+	Daemon daemonImpl{config, http, io.provider->getTimer()};
+	int listenFd = listenOn(socketPath);
+	if (listenFd < 0) {
+		spdlog::error("Failed to bind the socket with errno {}", errno);
+		return -1;
+	}
+	capnp::TwoPartyServer server{kj::heap<GitLabDaemonImpl>(daemonImpl)};
+	auto listener = io.lowLevelProvider->wrapListenSocketFd(listenFd, ListenFlags);
+	auto listening = serve(server, *listener, daemonImpl).eagerlyEvaluate([](kj::Exception&& exception) {
+		spdlog::error("Stopped accepting connections: {}", exception.getDescription().cStr());
+	});
+	// The main thread is the first one to accept connections
+	auto threads = config.general.threads > 0 ? config.general.threads : std::thread::hardware_concurrency();
+	spdlog::info("Answering lookups on {} threads", std::max(threads, 1u));
+	std::vector<std::unique_ptr<Worker>> workers;
+	for (unsigned number = 1; number < threads; ++number) {
+		try {
+			workers.push_back(std::make_unique<Worker>(daemonImpl, listenFd, number));
+		} catch (std::exception& exception) {
+			spdlog::error("Failed to start thread {}; continuing with {}: {}", number, number, exception.what());
+			break;
+		}
+	}
 	spdlog::info("Setting socket permissions for {} to 0o{:o}", socketPath.c_str(), config.general.socketPerms);
 	if (chmod(socketPath.c_str(), static_cast<mode_t>(config.general.socketPerms)) != 0)
 		spdlog::warn("Failed to change permissions with errno {}", errno);
 
-	spdlog::info("Instantiating SIGINT handler");
-	std::signal(SIGINT, +[](int signal) { fulfiller->fulfill(); });
+	// Before anything else such that the first lookups are already answered from the restored entries
+	auto restoring = daemonImpl.restoreCheckpoint().eagerlyEvaluate([](kj::Exception&& exception) {
+		spdlog::error("Revalidating the restored entries failed: {}", exception.getDescription().cStr());
+	});
+	auto syncing = daemonImpl.runSync().eagerlyEvaluate([](kj::Exception&& exception) {
+		spdlog::error("Stopped syncing with GitLab: {}", exception.getDescription().cStr());
+	});
+	auto publishing = daemonImpl.runPublisher().eagerlyEvaluate([](kj::Exception&& exception) {
+		spdlog::error("Stopped publishing the shared table: {}", exception.getDescription().cStr());
+	});
+	auto checkpointing = daemonImpl.runCheckpoints().eagerlyEvaluate([](kj::Exception&& exception) {
+		spdlog::error("Stopped saving checkpoints: {}", exception.getDescription().cStr());
+	});
+	auto& timer = io.provider->getTimer();
+	auto serving = config.metrics.enabled
+						   ? serveMetrics(io.provider->getNetwork(), timer, daemonImpl, config.metrics.address)
+						   : kj::Promise<void>(kj::NEVER_DONE);
+	serving = serving.eagerlyEvaluate([](kj::Exception&& exception) {
+		spdlog::error("Stopped serving metrics: {}", exception.getDescription().cStr());
+	});
 
-	// Run until SIGINT is signaled; accept connections and handle requests.
+	// Run until SIGINT or SIGTERM is signaled; accept connections and handle requests.
 	spdlog::info("Listening...");
-	promise.wait(waitScope);
+	auto& events = io.unixEventPort;
+	auto signal = events.onSignal(SIGINT).exclusiveJoin(events.onSignal(SIGTERM)).wait(waitScope);
+	spdlog::info("Received signal {}; shutting down...", signal.si_signo);
+
+	// The main thread's event loop keeps running until then since the workers may wait for lookups handed to it
+	auto finished = kj::heapArrayBuilder<kj::Promise<void>>(workers.size());
+	for (auto& worker : workers) {
+		worker->shutdown();
+		finished.add(kj::mv(worker->finished));
+	}
+	kj::joinPromises(finished.finish()).wait(waitScope);
+	workers.clear();
+
+	daemonImpl.logCacheStats();
+	daemonImpl.saveCheckpoint();
 
-	// A shame that EzRpcServer does not clean up after itself :(
+	// A shame that the listener does not clean up after itself :(
 	unlink(socketPath.string().c_str());
+	if (config.metrics.enabled && config.metrics.address.starts_with("unix:"))
+		unlink(config.metrics.address.c_str() + 5);
 	spdlog::info("Good bye!");
+	logging::shutdown();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include <homes.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <system_error>
+
+using gitlab::HomeProvisioner;
+
+/** How long the worker waits for more requests before it handles a batch, e.g. for a burst of logins **/
+static constexpr std::chrono::milliseconds BatchWindow{100};
+/** The group of users without any group, as in the NSS module **/
+static constexpr gid_t NoGroup = 65534;
+
+namespace {
+	enum class Outcome { Existed, Created, Failed };
+} // namespace
+
+static Outcome provision(const std::filesystem::path& path, uid_t uid, gid_t gid, mode_t perms) {
+	if (mkdir(path.c_str(), perms) != 0)
+		return errno == EEXIST ? Outcome::Existed : Outcome::Failed;
+	// The permissions passed to mkdir are subject to the umask
+	if (chown(path.c_str(), uid, gid) != 0 || chmod(path.c_str(), perms) != 0) {
+		// Removed again such that it is not mistaken for a provisioned home on the next attempt
+		rmdir(path.c_str());
+		return Outcome::Failed;
+	}
+	return Outcome::Created;
+}
+
+HomeProvisioner::HomeProvisioner(const Config& config) : config(config) {
+	if (config.nss.provisionHomes)
+		worker = std::thread([this]() { run(); });
+}
+
+HomeProvisioner::~HomeProvisioner() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	if (worker.joinable())
+		worker.join();
+}
+
+void HomeProvisioner::request(const User& user) {
+	if (!config.nss.provisionHomes)
+		return;
+	{
+		std::lock_guard lock(mutex);
+		if (!known.insert(user.id).second)
+			return;
+		pending.push_back(Home{
+				.id = user.id,
+				.path = config.nss.homesRoot / user.username,
+				.uid = user.id + config.nss.uidOffset,
+				.gid = user.groups.empty() ? NoGroup : user.groups.front().id + config.nss.gidOffset
+		});
+	}
+	wakeup.notify_one();
+}
+
+void HomeProvisioner::run() {
+	std::unique_lock lock(mutex);
+	while (true) {
+		wakeup.wait(lock, [this]() { return stopping || !pending.empty(); });
+		// Lets the lookups of a burst of logins queue up such that they are handled as one batch
+		if (stopping || wakeup.wait_for(lock, BatchWindow, [this]() { return stopping; }))
+			return;
+		auto batch = std::move(pending);
+		pending.clear();
+		lock.unlock();
+		std::error_code error;
+		std::filesystem::create_directories(config.nss.homesRoot, error);
+		std::vector<UserID> failed;
+		unsigned created = 0;
+		for (const auto& home : batch) {
+			switch (provision(home.path, home.uid, home.gid, config.nss.homePerms)) {
+			case Outcome::Created:
+				++created;
+				break;
+			case Outcome::Failed:
+				spdlog::warn("Creating the home {} failed with errno {}", home.path.c_str(), errno);
+				failed.push_back(home.id);
+				break;
+			case Outcome::Existed:
+				break;
+			}
+		}
+		if (created > 0)
+			spdlog::info("Created {} of {} requested homes", created, batch.size());
+		lock.lock();
+		for (auto id : failed)
+			known.erase(id);
+	}
+}
\ No newline at end of file
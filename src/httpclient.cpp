@@ -0,0 +1,317 @@
+#include <httpclient.hpp>
+#include <logging.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cctype>
+#include <array>
+#include <format>
+#include <mutex>
+#include <string_view>
+#include <utility>
+
+using gitlab::HttpClient;
+using gitlab::Response;
+
+/** How long resolved host names are reused, in seconds **/
+static constexpr long DNSCacheTimeout = 300;
+
+/**
+ * @brief The share handle through which all clients of the process reuse DNS results and TLS sessions.
+ */
+static CURLSH* sharedSession() {
+	static std::array<std::mutex, CURL_LOCK_DATA_LAST> locks;
+	static CURLSH* share = [] {
+		auto share = curl_share_init();
+		curl_share_setopt(
+				share, CURLSHOPT_LOCKFUNC,
+				+[](CURL*, curl_lock_data data, curl_lock_access, void*) { locks[data].lock(); }
+		);
+		curl_share_setopt(
+				share, CURLSHOPT_UNLOCKFUNC, +[](CURL*, curl_lock_data data, void*) { locks[data].unlock(); }
+		);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		return share;
+	}();
+	return share;
+}
+
+class HttpClient::Transfer final {
+private:
+	kj::PromiseFulfiller<Response>& fulfiller;
+	HttpClient& client;
+	CURL* easy;
+	curl_slist* headerList;
+	bool active = false;
+	Response response{};
+
+	static size_t onBody(char* data, size_t size, size_t nmemb, void* userp) {
+		static_cast<Transfer*>(userp)->response.body.append(data, size * nmemb);
+		return size * nmemb;
+	}
+
+	static size_t onHeader(char* data, size_t size, size_t nitems, void* userp) {
+		std::string_view line{data, size * nitems};
+		if (auto colon = line.find(':'); colon != std::string_view::npos) {
+			std::string name{line.substr(0, colon)};
+			std::ranges::transform(name, name.begin(), [](unsigned char c) { return std::tolower(c); });
+			auto value = line.substr(colon + 1);
+			value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.size()));
+			value = value.substr(0, value.find_last_not_of(" \t\r\n") + 1);
+			static_cast<Transfer*>(userp)->response.headers.insert_or_assign(std::move(name), std::string{value});
+		}
+		return size * nitems;
+	}
+
+public:
+	/** @param body the JSON document to POST or nullptr to GET **/
+	Transfer(kj::PromiseFulfiller<Response>& fulfiller, HttpClient& client, const std::string& url,
+			 const std::string& bearer, const std::string* body)
+			: fulfiller(fulfiller), client(client), easy(client.acquireHandle()) {
+		auto auth = std::format("Authorization: Bearer {}", bearer);
+		headerList = curl_slist_append(nullptr, auth.c_str());
+		if (body) {
+			headerList = curl_slist_append(headerList, "Content-Type: application/json");
+			curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, static_cast<long>(body->size()));
+			curl_easy_setopt(easy, CURLOPT_COPYPOSTFIELDS, body->c_str());
+		}
+		curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headerList);
+		curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, &Transfer::onBody);
+		curl_easy_setopt(easy, CURLOPT_WRITEDATA, this);
+		curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, &Transfer::onHeader);
+		curl_easy_setopt(easy, CURLOPT_HEADERDATA, this);
+		curl_easy_setopt(easy, CURLOPT_PRIVATE, this);
+		curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+		if (curl_multi_add_handle(client.multi, easy) == CURLM_OK)
+			active = true;
+		else
+			fulfiller.fulfill(Response{.status = 0});
+	}
+
+	~Transfer() {
+		if (active)
+			curl_multi_remove_handle(client.multi, easy);
+		client.releaseHandle(easy);
+		curl_slist_free_all(headerList);
+	}
+
+	void finish(CURLcode result) {
+		active = false;
+		if (result == CURLE_OK) {
+			curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &response.status);
+		} else {
+			const char* url = nullptr;
+			curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+			spdlog::debug("Request to {} failed: {}", url ? url : "?", curl_easy_strerror(result));
+			// By the error only since it is the same for all requests while GitLab is unreachable
+			logging::limited(spdlog::level::warn, "Requests to GitLab failed: {}", curl_easy_strerror(result));
+			response.status = 0;
+		}
+		curl_multi_remove_handle(client.multi, easy);
+		fulfiller.fulfill(kj::mv(response));
+	}
+};
+
+class HttpClient::Socket final {
+public:
+	/** The CURL_POLL_* flags curl is currently interested in **/
+	int events = 0;
+
+private:
+	HttpClient& client;
+	curl_socket_t fd;
+	std::optional<kj::UnixEventPort::FdObserver> observer;
+	kj::Promise<void> readable;
+	kj::Promise<void> writable;
+
+	bool pollReadable() const {
+		pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+		return poll(&pfd, 1, 0) == 1;
+	}
+
+	kj::Promise<void> watchReadable() {
+		return observer->whenBecomesReadable().then([this]() -> kj::Promise<void> {
+			// The observer is edge triggered but curl may leave data in the socket, so keep going until it is drained.
+			while (observer && (events & CURL_POLL_IN)) {
+				client.act(fd, CURL_CSELECT_IN);
+				if (!pollReadable())
+					break;
+			}
+			if (!observer)
+				return kj::NEVER_DONE;
+			return watchReadable();
+		});
+	}
+
+	kj::Promise<void> watchWritable() {
+		return observer->whenBecomesWritable().then([this]() -> kj::Promise<void> {
+			if (events & CURL_POLL_OUT)
+				client.act(fd, CURL_CSELECT_OUT);
+			if (!observer)
+				return kj::NEVER_DONE;
+			return watchWritable();
+		});
+	}
+
+public:
+	Socket(HttpClient& client, curl_socket_t fd)
+			: client(client), fd(fd),
+			  observer(std::in_place, client.eventPort, fd,
+					   kj::UnixEventPort::FdObserver::OBSERVE_READ | kj::UnixEventPort::FdObserver::OBSERVE_WRITE),
+			  readable(watchReadable().eagerlyEvaluate([](kj::Exception&&) {})),
+			  writable(watchWritable().eagerlyEvaluate([](kj::Exception&&) {})) {}
+
+	/** Stops watching the socket before curl closes it. The object itself stays alive until the next turn. **/
+	void close() { observer.reset(); }
+};
+
+HttpClient::HttpClient(const Config& config, kj::UnixEventPort& eventPort, kj::Timer& timer)
+		: config(config), eventPort(eventPort), timer(timer), tasks(*this) {
+	static const auto curlInitialized = curl_global_init(CURL_GLOBAL_DEFAULT);
+	(void)curlInitialized;
+	multi = curl_multi_init();
+	const long maxConnections = std::max(config.gitlabapi.maxConnections, 1u);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, maxConnections);
+	curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, maxConnections);
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, config.gitlabapi.http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, &HttpClient::onSocketUpdate);
+	curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+	curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, &HttpClient::onTimerUpdate);
+	curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+}
+
+HttpClient::~HttpClient() {
+	for (auto& [fd, socket] : sockets)
+		socket->close();
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, nullptr);
+	curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, nullptr);
+	for (auto easy : idleHandles)
+		curl_easy_cleanup(easy);
+	curl_multi_cleanup(multi);
+}
+
+CURL* HttpClient::acquireHandle() {
+	CURL* easy;
+	if (idleHandles.empty()) {
+		easy = curl_easy_init();
+	} else {
+		easy = idleHandles.back();
+		idleHandles.pop_back();
+	}
+	curl_easy_setopt(easy, CURLOPT_SHARE, sharedSession());
+	curl_easy_setopt(easy, CURLOPT_DNS_CACHE_TIMEOUT, DNSCacheTimeout);
+	curl_easy_setopt(easy, CURLOPT_MAXAGE_CONN, static_cast<long>(config.gitlabapi.idleTimeout));
+	curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+	// A GitLab that accepts connections but stalls would otherwise hold up lookups forever; timed out requests have no
+	// status and thus fail with Error::ServerError
+	curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, static_cast<long>(config.gitlabapi.connectTimeout));
+	curl_easy_setopt(easy, CURLOPT_TIMEOUT, static_cast<long>(config.gitlabapi.requestTimeout));
+	curl_easy_setopt(easy, CURLOPT_SSL_SESSIONID_CACHE, 1L);
+	if (config.gitlabapi.http2) {
+		curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		// Rather wait for a connection that can be multiplexed than open another one
+		curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+	}
+	return easy;
+}
+
+void HttpClient::releaseHandle(CURL* easy) {
+	// Keep as many handles around as can be in use at once without multiplexing
+	if (idleHandles.size() >= std::max(config.gitlabapi.maxConnections, 1u)) {
+		curl_easy_cleanup(easy);
+		return;
+	}
+	curl_easy_reset(easy);
+	idleHandles.push_back(easy);
+}
+
+int HttpClient::onSocketUpdate(CURL* easy, curl_socket_t fd, int what, void* userp, void* socketp) {
+	auto& client = *static_cast<HttpClient*>(userp);
+	auto it = client.sockets.find(fd);
+	if (what == CURL_POLL_REMOVE) {
+		if (it != client.sockets.end()) {
+			// We may be running inside one of this socket's continuations, so it can't be destroyed right away.
+			it->second->close();
+			client.retired.add(kj::mv(it->second));
+			client.sockets.erase(it);
+			if (client.retired.size() == 1)
+				client.tasks.add(kj::evalLater([&client]() { client.retired.clear(); }));
+		}
+		return 0;
+	}
+	if (it == client.sockets.end()) {
+		it = client.sockets.emplace(fd, kj::heap<Socket>(client, fd)).first;
+	} else if (auto added = what & ~it->second->events; added & (CURL_POLL_IN | CURL_POLL_OUT)) {
+		// The observer is edge triggered: Data that arrived while curl was not interested, and a socket that already
+		// was writable, do not trigger it again. curl must not be called from within its callback, so it is told on
+		// the next turn.
+		int events = added & CURL_POLL_OUT ? CURL_CSELECT_OUT : 0;
+		client.tasks.add(kj::evalLater([&client, fd, events]() {
+			if (client.sockets.contains(fd))
+				client.act(fd, events);
+		}));
+	}
+	it->second->events = what;
+	return 0;
+}
+
+int HttpClient::onTimerUpdate(CURLM* multi, long timeoutMs, void* userp) {
+	auto& client = *static_cast<HttpClient*>(userp);
+	if (client.inTimeout) {
+		// Replacing the running timeout would destroy it from within its own continuation.
+		client.deferredTimeout = timeoutMs;
+	} else if (timeoutMs < 0) {
+		client.timeout.reset();
+	} else {
+		client.timeout = client.waitTimeout(timeoutMs);
+	}
+	return 0;
+}
+
+kj::Promise<void> HttpClient::waitTimeout(long timeoutMs) {
+	return timer.afterDelay(timeoutMs * kj::MILLISECONDS)
+			.then([this]() { return onTimeout(); })
+			.eagerlyEvaluate([](kj::Exception&& exception) {
+				spdlog::error("HTTP client timeout failed: {}", exception.getDescription().cStr());
+			});
+}
+
+kj::Promise<void> HttpClient::onTimeout() {
+	inTimeout = true;
+	deferredTimeout.reset();
+	act(CURL_SOCKET_TIMEOUT, 0);
+	inTimeout = false;
+	if (auto next = std::exchange(deferredTimeout, std::nullopt); next && *next >= 0)
+		return timer.afterDelay(*next * kj::MILLISECONDS).then([this]() { return onTimeout(); });
+	return kj::NEVER_DONE;
+}
+
+void HttpClient::act(curl_socket_t fd, int events) {
+	int running;
+	curl_multi_socket_action(multi, fd, events, &running);
+	int pending;
+	while (CURLMsg* msg = curl_multi_info_read(multi, &pending)) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		Transfer* transfer;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+		transfer->finish(msg->data.result);
+	}
+}
+
+void HttpClient::taskFailed(kj::Exception&& exception) {
+	spdlog::error("HTTP client task failed: {}", exception.getDescription().cStr());
+}
+
+kj::Promise<Response> HttpClient::get(const std::string& url, const std::string& bearer) {
+	return kj::newAdaptedPromise<Response, Transfer>(*this, url, bearer, nullptr);
+}
+
+kj::Promise<Response> HttpClient::post(const std::string& url, const std::string& bearer, const std::string& body) {
+	return kj::newAdaptedPromise<Response, Transfer>(*this, url, bearer, &body);
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include <logging.hpp>
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include <memory>
+#include <vector>
+
+namespace logging {
+	/** The number of lines that may be queued for the background thread **/
+	static constexpr std::size_t QueueSize = 8192;
+
+	void init(const std::filesystem::path& file) {
+		spdlog::init_thread_pool(QueueSize, 1);
+		std::vector<spdlog::sink_ptr> sinks{
+#if DEBUG
+				std::make_shared<spdlog::sinks::stdout_color_sink_mt>(),
+#endif
+				std::make_shared<spdlog::sinks::basic_file_sink_mt>(file.string())
+		};
+		auto logger = std::make_shared<spdlog::async_logger>(
+				"", sinks.begin(), sinks.end(), spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest
+		);
+		logger->set_level(spdlog::level::info);
+		logger->flush_on(spdlog::level::warn);
+		spdlog::set_default_logger(logger);
+		// Lines below warnings reach the file within a second
+		spdlog::flush_every(std::chrono::seconds{1});
+	}
+
+	void configure(std::string_view level, std::chrono::seconds repeatInterval) {
+		auto parsed = levelFrom(level);
+		spdlog::set_level(parsed.value_or(spdlog::level::info));
+		if (!parsed)
+			spdlog::warn("Unknown log level \"{}\"; logging at the info level", level);
+		limiter().setInterval(repeatInterval);
+	}
+
+	void shutdown() { spdlog::shutdown(); }
+
+	void Limiter::setInterval(Clock::duration interval) {
+		std::lock_guard lock(mutex);
+		this->interval = interval;
+	}
+
+	std::optional<std::size_t> Limiter::admit(const std::string& message) {
+		auto now = Clock::now();
+		std::lock_guard lock(mutex);
+		if (auto it = entries.find(message); it != entries.end()) {
+			auto& entry = it->second;
+			if (now - entry.logged < interval) {
+				++entry.suppressed;
+				return std::nullopt;
+			}
+			return std::exchange(entry, Entry{.logged = now, .suppressed = 0}).suppressed;
+		}
+		if (entries.size() >= MaxMessages)
+			std::erase_if(entries, [this, now](const auto& entry) { return now - entry.second.logged >= interval; });
+		// Too many distinct messages within the interval to keep track of them all; they are simply logged
+		if (entries.size() < MaxMessages)
+			entries.emplace(message, Entry{.logged = now, .suppressed = 0});
+		return 0;
+	}
+
+	Limiter& limiter() noexcept {
+		static Limiter limiter;
+		return limiter;
+	}
+} // namespace logging
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include <metrics.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <format>
+#include <memory>
+
+using metrics::Counter;
+using metrics::Exposition;
+using metrics::Gauge;
+using metrics::Histogram;
+using metrics::Server;
+
+/** Requests are not looked at beyond their header, of which at most this much is read **/
+static constexpr std::size_t MaxRequest = 8192;
+/** How long a connection may take from being accepted until its response was written **/
+static constexpr kj::Duration RequestTimeout = 10 * kj::SECONDS;
+/** Beyond this many open connections, new ones are closed right away **/
+static constexpr std::size_t MaxConnections = 16;
+
+std::size_t metrics::slot() noexcept {
+	static std::atomic<std::size_t> next{0};
+	thread_local std::size_t assigned = next.fetch_add(1, std::memory_order_relaxed) % Slots;
+	return assigned;
+}
+
+uint64_t Counter::value() const noexcept {
+	uint64_t sum = 0;
+	for (const auto& slot : slots)
+		sum += slot.value.load(std::memory_order_relaxed);
+	return sum;
+}
+
+int64_t Gauge::value() const noexcept {
+	int64_t sum = 0;
+	for (const auto& slot : slots)
+		sum += slot.value.load(std::memory_order_relaxed);
+	return sum;
+}
+
+void Histogram::observe(std::chrono::steady_clock::duration duration) noexcept {
+	auto seconds = std::chrono::duration<double>(duration).count();
+	auto bucket = std::ranges::lower_bound(Bounds, seconds) - Bounds.begin();
+	auto& slot = slots[metrics::slot()];
+	slot.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+	auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	slot.nanoseconds.fetch_add(static_cast<uint64_t>(std::max<int64_t>(nanoseconds, 0)), std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const noexcept {
+	Snapshot snapshot{.counts = {}, .sum = 0, .count = 0};
+	uint64_t nanoseconds = 0;
+	for (const auto& slot : slots) {
+		for (std::size_t i = 0; i < slot.counts.size(); ++i)
+			snapshot.counts[i] += slot.counts[i].load(std::memory_order_relaxed);
+		nanoseconds += slot.nanoseconds.load(std::memory_order_relaxed);
+	}
+	for (auto count : snapshot.counts)
+		snapshot.count += count;
+	snapshot.sum = static_cast<double>(nanoseconds) / 1e9;
+	return snapshot;
+}
+
+void Exposition::family(std::string_view name, std::string_view type, std::string_view help) {
+	text += std::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void Exposition::sample(std::string_view name, std::string_view labels, double value) {
+	if (labels.empty())
+		text += std::format("{} {}\n", name, value);
+	else
+		text += std::format("{}{{{}}} {}\n", name, labels, value);
+}
+
+void Exposition::histogram(std::string_view name, std::string_view labels, const Histogram::Snapshot& snapshot) {
+	auto separator = labels.empty() ? "" : ",";
+	uint64_t cumulative = 0;
+	for (std::size_t i = 0; i < Histogram::Bounds.size(); ++i) {
+		cumulative += snapshot.counts[i];
+		auto bound = Histogram::Bounds[i];
+		text += std::format("{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels, separator, bound, cumulative);
+	}
+	text += std::format("{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, separator, snapshot.count);
+	sample(std::format("{}_sum", name), labels, snapshot.sum);
+	sample(std::format("{}_count", name), labels, static_cast<double>(snapshot.count));
+}
+
+namespace {
+	struct Request {
+		std::array<char, MaxRequest> data;
+		std::size_t size = 0;
+	};
+} // namespace
+
+/**
+ * @brief Reads until the end of the request's header, the end of the stream or until MaxRequest bytes were read.
+ */
+static kj::Promise<void> readHeader(kj::AsyncIoStream& stream, std::shared_ptr<Request> request) {
+	auto* free = request->data.data() + request->size;
+	return stream.tryRead(free, 1, request->data.size() - request->size)
+			.then([&stream, request](std::size_t read) -> kj::Promise<void> {
+				request->size += read;
+				std::string_view received{request->data.data(), request->size};
+				if (read == 0 || received.contains("\r\n\r\n") || request->size == request->data.size())
+					return kj::READY_NOW;
+				return readHeader(stream, request);
+			});
+}
+
+Server::Server(kj::ConnectionReceiver& listener, kj::Timer& timer, std::function<std::string()> render)
+		: listener(listener), timer(timer), render(std::move(render)), connections(*this) {}
+
+kj::Promise<void> Server::respond(kj::Own<kj::AsyncIoStream>&& connection) {
+	auto& stream = *connection;
+	auto answered = readHeader(stream, std::make_shared<Request>()).then([this, &stream]() {
+		auto body = render();
+		auto response = std::make_shared<std::string>(std::format(
+				"HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+				"Content-Length: {}\r\nConnection: close\r\n\r\n{}",
+				body.size(), body
+		));
+		return stream.write(response->data(), response->size()).attach(kj::mv(response));
+	});
+	++open;
+	return timer.timeoutAfter(RequestTimeout, kj::mv(answered))
+			.attach(kj::mv(connection), kj::defer([this]() { --open; }));
+}
+
+void Server::taskFailed(kj::Exception&& exception) {
+	spdlog::debug("Answering a metrics request failed: {}", exception.getDescription().cStr());
+}
+
+kj::Promise<void> Server::run() {
+	return listener.accept().then([this](kj::Own<kj::AsyncIoStream>&& connection) {
+		if (open < MaxConnections)
+			connections.add(respond(kj::mv(connection)));
+		else
+			spdlog::debug("Closing a metrics connection since {} are open already", open);
+		return run();
+	});
+}
\ No newline at end of file
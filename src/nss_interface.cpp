@@ -1,235 +1,525 @@
 #include <config.hpp>
 #include <error.hpp>
+#include <logging.hpp>
 #include <rpcclient.hpp>
+#include <sharedtable.hpp>
 
-#include <spdlog/sinks/basic_file_sink.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/sinks/stdout_sinks.h>
 #include <spdlog/spdlog.h>
 
 #include <grp.h>
 #include <nss.h>
 #include <pwd.h>
 #include <shadow.h>
-#include <sys/stat.h>
 
+#include <capnp/message.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
 #include <spanstream>
+#include <string_view>
+#include <type_traits>
 
 namespace fs = std::filesystem;
 
-static auto initLogger() {
-	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
-	std::vector<spdlog::sink_ptr> sinks{console_sink};
-	auto logger = std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end());
-	logger->set_level(spdlog::level::trace);
-	logger->flush_on(spdlog::level::info);
-	SPDLOG_LOGGER_DEBUG(logger, "Logger created");
+/**
+ * The config is only read on the first lookup rather than when glibc loads the module, which it does in every process
+ * that looks up any user or group (most of which are not from GitLab).
+ */
+static const Config& config() {
+	static const Config config =
+			Config::fromFile(fs::current_path().root_path() / "etc" / "gitlabnss" / "gitlabnss.conf");
+	return config;
+}
+
+/**
+ * The module logs synchronously to the standard error of whatever process looks up users and groups; starting a
+ * logging thread in each of them is not worth it for the few lines at the configured level (errors by default). Like
+ * the config, the logger is only created once something is logged.
+ */
+static const std::shared_ptr<spdlog::logger>& logger() {
+	static const auto logger = [] {
+		auto logger = std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::stderr_sink_mt>());
+		// The daemon warns about unknown levels
+		logger->set_level(logging::levelFrom(config().logging.nssLevel).value_or(spdlog::level::err));
+		return logger;
+	}();
 	return logger;
 }
 
-static auto logger = initLogger();
-static auto config = Config::fromFile(fs::current_path().root_path() / "etc" / "gitlabnss" / "gitlabnss.conf");
+/** How many entries are requested from the daemon at once while enumerating **/
+static constexpr unsigned EnumerationBatch = 500;
+
+/**
+ * @brief The state of a set*ent(), get*ent_r(), end*ent() enumeration. Only the current batch is held in memory.
+ */
+struct Enumeration {
+	std::mutex mutex;
+	/** A copy of the daemon's answer for the current batch **/
+	std::unique_ptr<capnp::MallocMessageBuilder> batch;
+	/** The next entry of the current batch to return **/
+	unsigned index = 0;
+	/** Where the next batch starts **/
+	unsigned cursor = 0;
+	/** Whether the current batch is the last one **/
+	bool done = false;
+
+	void reset() {
+		batch.reset();
+		index = cursor = 0;
+		done = false;
+	}
+};
+
+static Enumeration userEnumeration;
+static Enumeration groupEnumeration;
 
-void populatePasswd(passwd& pwd, const User::Reader& user, std::span<char> buffer) {
+/** @return false if the buffer is too small **/
+static bool populatePasswd(
+		passwd& pwd, uint32_t id, std::optional<uint32_t> group, const char* username, const char* name,
+		std::span<char> buffer
+) {
 	auto stream = std::ospanstream(buffer);
 	// Username
 	pwd.pw_name = buffer.data() + stream.tellp();
-	stream << user.getUsername().cStr() << '\0';
+	stream << username << '\0';
 	// Password
 	const char Password[] = "*"; // user can't login with PW: https://www.man7.org/linux/man-pages/man5/shadow.5.html
 	pwd.pw_passwd = buffer.data() + stream.tellp();
 	stream << Password << '\0';
 	// UID
-	pwd.pw_uid = user.getId() + config.nss.uidOffset;
+	pwd.pw_uid = id + config().nss.uidOffset;
 	// GID
-	pwd.pw_gid = user.getGroups().size() > 0 ? (user.getGroups()[0].getId() + config.nss.gidOffset) : 65534 /*nogroup*/;
+	pwd.pw_gid = group ? (*group + config().nss.gidOffset) : 65534 /*nogroup*/;
 	// Real Name
 	pwd.pw_gecos = buffer.data() + stream.tellp();
-	stream << user.getName().cStr() << '\0';
+	stream << name << '\0';
 	// Shell
 	pwd.pw_shell = buffer.data() + stream.tellp();
-	stream << config.nss.shell << '\0';
+	stream << config().nss.shell << '\0';
 	// Home directory
 	pwd.pw_dir = buffer.data() + stream.tellp();
-	std::string homedir = config.nss.homesRoot / user.getUsername().cStr();
-	fs::create_directories(config.nss.homesRoot / user.getUsername().cStr());
-	chown(homedir.c_str(), pwd.pw_uid, pwd.pw_gid);
-	chmod(homedir.c_str(), config.nss.homePerms);
-	stream << homedir << '\0';
+	stream << (config().nss.homesRoot / username).string() << '\0';
+	return stream.good();
+}
+
+bool populatePasswd(passwd& pwd, const User::Reader& user, std::span<char> buffer) {
+	auto groups = user.getGroups();
+	return populatePasswd(
+			pwd, user.getId(), groups.size() > 0 ? std::optional<uint32_t>{groups[0].getId()} : std::nullopt,
+			user.getUsername().cStr(), user.getName().cStr(), buffer
+	);
 }
 
+bool populatePasswd(passwd& pwd, const sharedtable::User& user, std::span<char> buffer) {
+	return populatePasswd(pwd, user.id, user.group, user.username, user.name, buffer);
+}
+
+/**
+ * @brief Makes sure that the current batch of the enumeration has an entry left by requesting more batches.
+ * @tparam Results GitLabDaemon::ListUsersResults or GitLabDaemon::ListGroupsResults
+ * @param request Sends the request for a batch given the daemon, the cursor and the batch size
+ */
+template <typename Results, typename F>
+static nss_status nextBatch(Enumeration& state, F&& request) {
+	auto entries = [&state]() {
+		auto results = state.batch->getRoot<Results>().asReader();
+		if constexpr (std::is_same_v<Results, GitLabDaemon::ListUsersResults>)
+			return results.getUsers().size();
+		else
+			return results.getGroups().size();
+	};
+	while (!state.batch || state.index >= entries()) {
+		if (state.batch && state.done)
+			return nss_status::NSS_STATUS_NOTFOUND;
+		auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+			return request(daemon, state.cursor, EnumerationBatch);
+		});
+		if (!response)
+			return NSS_STATUS_UNAVAIL;
+		if (static_cast<Error>(response->getErrcode()) != Error::Ok) {
+			SPDLOG_LOGGER_ERROR(logger(), "The daemon answered with error {}", response->getErrcode());
+			return nss_status::NSS_STATUS_UNAVAIL;
+		}
+		// Copied such that the batch does not keep the daemon's message alive
+		state.batch = std::make_unique<capnp::MallocMessageBuilder>();
+		typename Results::Reader results = *response;
+		state.batch->setRoot(results);
+		state.index = 0;
+		state.cursor = response->getCursor();
+		state.done = response->getDone();
+	}
+	return nss_status::NSS_STATUS_SUCCESS;
+}
+
+/**
+ * @param member returns the username of the i-th member
+ * @return false if the buffer is too small
+ */
+template <typename F>
+static bool populateGroup(
+		group& group, uint32_t id, const char* name, unsigned memberCount, F&& member, std::span<char> buffer
+) {
+	// Members; the pointer array goes first since it needs to be aligned
+	void* start = buffer.data();
+	auto space = buffer.size();
+	auto pointers = (memberCount + 1) * sizeof(char*);
+	if (!std::align(alignof(char*), pointers, start, space))
+		return false;
+	group.gr_mem = static_cast<char**>(start);
+	auto strings = std::span<char>{static_cast<char*>(start) + pointers, space - pointers};
+	auto stream = std::ospanstream(strings);
+	for (unsigned i = 0; i < memberCount; ++i) {
+		group.gr_mem[i] = strings.data() + stream.tellp();
+		stream << member(i) << '\0';
+	}
+	group.gr_mem[memberCount] = nullptr;
+	// Groupname
+	group.gr_name = strings.data() + stream.tellp();
+	stream << name << '\0';
+	// Password
+	const char Password[] = "*"; // user can't login with PW: https://www.man7.org/linux/man-pages/man5/shadow.5.html
+	group.gr_passwd = strings.data() + stream.tellp();
+	stream << Password << '\0';
+	// GID
+	group.gr_gid = id + config().nss.gidOffset;
+	return stream.good();
+}
+
+bool populateGroup(group& group, const sharedtable::Group& obj, std::span<char> buffer) {
+	return populateGroup(
+			group, obj.id, obj.name, obj.members.size(), [&obj](unsigned i) { return obj.member(i); }, buffer
+	);
+}
+
+/**
+ * @brief Answers a passwd lookup from the shared table if the daemon published one.
+ * @return std::nullopt if the daemon has to be asked
+ */
+template <typename Key>
+static std::optional<nss_status> passwdFromTable(const Key& key, passwd* pwd, char* buf, size_t buflen, int* errnop) {
+	if (!config().sharedTable.enabled)
+		return std::nullopt;
+	auto table = sharedtable::current(config().sharedTable.path);
+	if (!table)
+		return std::nullopt;
+	sharedtable::User user;
+	switch (table->findUser(key, user)) {
+	case sharedtable::Lookup::Found:
+		if (!populatePasswd(*pwd, user, {buf, buflen})) {
+			*errnop = ERANGE;
+			return nss_status::NSS_STATUS_TRYAGAIN;
+		}
+		return nss_status::NSS_STATUS_SUCCESS;
+	case sharedtable::Lookup::NotFound:
+		return nss_status::NSS_STATUS_NOTFOUND;
+	default:
+		return std::nullopt;
+	}
+}
+
+/**
+ * @brief Answers a group lookup from the shared table if the daemon published one.
+ * @return std::nullopt if the daemon has to be asked
+ */
+template <typename Key>
+static std::optional<nss_status> groupFromTable(const Key& key, group* grp, char* buf, size_t buflen, int* errnop) {
+	if (!config().sharedTable.enabled)
+		return std::nullopt;
+	auto table = sharedtable::current(config().sharedTable.path);
+	if (!table)
+		return std::nullopt;
+	sharedtable::Group group;
+	switch (table->findGroup(key, group)) {
+	case sharedtable::Lookup::Found:
+		if (!populateGroup(*grp, group, {buf, buflen})) {
+			*errnop = ERANGE;
+			return nss_status::NSS_STATUS_TRYAGAIN;
+		}
+		return nss_status::NSS_STATUS_SUCCESS;
+	case sharedtable::Lookup::NotFound:
+		return nss_status::NSS_STATUS_NOTFOUND;
+	default:
+		return std::nullopt;
+	}
+}
+
+// The module is built with hidden visibility; only what glibc looks up is exported
+#pragma GCC visibility push(default)
 extern "C" {
 #if 0
 nss_status _nss_gitlab_getspnam_r(const char* name, spwd* spwd, char* buf, size_t buflen, int* errnop) {
-	SPDLOG_LOGGER_DEBUG(logger, "getspnam_r({})", name);
+	SPDLOG_LOGGER_DEBUG(logger(), "getspnam_r({})", name);
 	/** \todo implement **/
 	return nss_status::NSS_STATUS_NOTFOUND;
 };
 #endif
 
 nss_status _nss_gitlab_getpwuid_r(uid_t uid, passwd* pwd, char* buf, size_t buflen, int* errnop) {
-	SPDLOG_LOGGER_DEBUG(logger, "getpwuid_r({})", uid);
-	if (uid < config.nss.uidOffset)
+	SPDLOG_LOGGER_DEBUG(logger(), "getpwuid_r({})", uid);
+	if (uid < config().nss.uidOffset)
 		return nss_status::NSS_STATUS_NOTFOUND;
-	SPDLOG_LOGGER_DEBUG(logger, "Fetching User {}", uid - config.nss.uidOffset);
-	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
-
-	if (!daemon)
+	if (auto status = passwdFromTable(uid - config().nss.uidOffset, pwd, buf, buflen, errnop))
+		return *status;
+	SPDLOG_LOGGER_DEBUG(logger(), "Fetching User {}", uid - config().nss.uidOffset);
+	auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getUserByIDRequest();
+		request.setId(uid - config().nss.uidOffset);
+		return request.send();
+	});
+	if (!response)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getUserByIDRequest();
-	request.setId(uid - config.nss.uidOffset);
-	auto promise = request.send().wait(waitScope);
-
-	auto user = promise.getUser();
-	switch (static_cast<Error>(promise.getErrcode())) {
+	auto user = response->getUser();
+	switch (static_cast<Error>(response->getErrcode())) {
 	case Error::Ok:
-		populatePasswd(*pwd, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
+		if (!populatePasswd(*pwd, user, {buf, buflen})) {
+			*errnop = ERANGE;
+			return nss_status::NSS_STATUS_TRYAGAIN;
+		}
+		SPDLOG_LOGGER_DEBUG(logger(), "Found!");
 		return nss_status::NSS_STATUS_SUCCESS;
 	case Error::NotFound:
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
+		SPDLOG_LOGGER_DEBUG(logger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
 	default:
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
+		SPDLOG_LOGGER_ERROR(logger(), "The daemon answered with error {}", response->getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
 
 nss_status _nss_gitlab_getpwnam_r(const char* name, passwd* pwd, char* buf, size_t buflen, int* errnop) {
-	SPDLOG_LOGGER_DEBUG(logger, "getpwnam_r({})", name);
-	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
-
-	if (!daemon)
+	SPDLOG_LOGGER_DEBUG(logger(), "getpwnam_r({})", name);
+	if (auto status = passwdFromTable(std::string_view{name}, pwd, buf, buflen, errnop))
+		return *status;
+	auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getUserByNameRequest();
+		request.setName(name);
+		return request.send();
+	});
+	if (!response)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getUserByNameRequest();
-	request.setName(name);
-	auto promise = request.send().wait(waitScope);
-
-	auto user = promise.getUser();
-	switch (static_cast<Error>(promise.getErrcode())) {
+	auto user = response->getUser();
+	switch (static_cast<Error>(response->getErrcode())) {
 	case Error::Ok:
-		populatePasswd(*pwd, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
+		if (!populatePasswd(*pwd, user, {buf, buflen})) {
+			*errnop = ERANGE;
+			return nss_status::NSS_STATUS_TRYAGAIN;
+		}
+		SPDLOG_LOGGER_DEBUG(logger(), "Found!");
 		return nss_status::NSS_STATUS_SUCCESS;
 	case Error::NotFound:
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
+		SPDLOG_LOGGER_DEBUG(logger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
 	default:
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
+		SPDLOG_LOGGER_ERROR(logger(), "The daemon answered with error {}", response->getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
 
-#if 0
 nss_status _nss_gitlab_setpwent() {
-	SPDLOG_LOGGER_DEBUG(logger, "setpwent()");
-	/** \todo implement **/
-	return nss_status::NSS_STATUS_NOTFOUND;
+	SPDLOG_LOGGER_DEBUG(logger(), "setpwent()");
+	std::lock_guard lock(userEnumeration.mutex);
+	userEnumeration.reset();
+	return nss_status::NSS_STATUS_SUCCESS;
 }
 
 nss_status _nss_gitlab_getpwent_r(passwd* pwd, char* buf, size_t buflen, int* errnop) {
-	SPDLOG_LOGGER_DEBUG(logger, "getpwent_r()");
-	/** \todo implement **/
-	return nss_status::NSS_STATUS_NOTFOUND;
+	SPDLOG_LOGGER_DEBUG(logger(), "getpwent_r()");
+	std::lock_guard lock(userEnumeration.mutex);
+	auto status = nextBatch<GitLabDaemon::ListUsersResults>(
+			userEnumeration,
+			[](GitLabDaemon::Client& daemon, unsigned cursor, unsigned count) {
+				auto request = daemon.listUsersRequest();
+				request.setCursor(cursor);
+				request.setCount(count);
+				return request.send();
+			}
+	);
+	if (status != nss_status::NSS_STATUS_SUCCESS)
+		return status;
+	auto batch = userEnumeration.batch->getRoot<GitLabDaemon::ListUsersResults>().asReader();
+	if (!populatePasswd(*pwd, batch.getUsers()[userEnumeration.index], {buf, buflen})) {
+		// The caller retries the same entry with a larger buffer
+		*errnop = ERANGE;
+		return nss_status::NSS_STATUS_TRYAGAIN;
+	}
+	++userEnumeration.index;
+	return nss_status::NSS_STATUS_SUCCESS;
 }
 
 nss_status _nss_gitlab_endpwent() {
-	SPDLOG_LOGGER_DEBUG(logger, "endpwent()");
-	/** \todo implement **/
-	return nss_status::NSS_STATUS_NOTFOUND;
+	SPDLOG_LOGGER_DEBUG(logger(), "endpwent()");
+	std::lock_guard lock(userEnumeration.mutex);
+	userEnumeration.reset();
+	return nss_status::NSS_STATUS_SUCCESS;
 }
-#endif
 
 /**********************************************************************************************************************/
 /* GROUPS                                                                                                             */
 /**********************************************************************************************************************/
-void populateGroup(group& group, const Group::Reader& obj, std::span<char> buffer) {
-	auto stream = std::ospanstream(buffer);
-	// Username
-	group.gr_name = buffer.data() + stream.tellp();
-	stream << obj.getName().cStr() << '\0';
-	// Password
-	const char Password[] = "*"; // user can't login with PW: https://www.man7.org/linux/man-pages/man5/shadow.5.html
-	group.gr_passwd = buffer.data() + stream.tellp();
-	stream << Password << '\0';
-	// GID
-	group.gr_gid = obj.getId() + config.nss.gidOffset;
-	// Members
-	group.gr_mem = nullptr;
+bool populateGroup(group& group, const Group::Reader& obj, std::span<char> buffer) {
+	auto members = obj.getMembers();
+	auto member = [&members](unsigned i) { return members[i].cStr(); };
+	return populateGroup(group, obj.getId(), obj.getName().cStr(), members.size(), member, buffer);
 }
 
-nss_status _nss_gitlab_getgrgid_r(gid_t gid, group* result_buf, char* buf, size_t buflen, group** result) {
-	SPDLOG_LOGGER_INFO(logger, "getgrgid_r({})", gid);
-	if (gid < config.nss.gidOffset)
+nss_status _nss_gitlab_getgrgid_r(gid_t gid, group* result_buf, char* buf, size_t buflen, int* errnop) {
+	SPDLOG_LOGGER_DEBUG(logger(), "getgrgid_r({})", gid);
+	if (gid < config().nss.gidOffset)
 		return nss_status::NSS_STATUS_NOTFOUND;
-	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
-
-	if (!daemon)
+	if (auto status = groupFromTable(gid - config().nss.gidOffset, result_buf, buf, buflen, errnop))
+		return *status;
+	auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getGroupByIDRequest();
+		request.setId(gid - config().nss.gidOffset);
+		return request.send();
+	});
+	if (!response)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getGroupByIDRequest();
-	request.setId(gid - config.nss.gidOffset);
-	auto promise = request.send().wait(waitScope);
+	auto group = response->getGroup();
+	switch (static_cast<Error>(response->getErrcode())) {
+	case Error::Ok:
+		if (!populateGroup(*result_buf, group, {buf, buflen})) {
+			*errnop = ERANGE;
+			return nss_status::NSS_STATUS_TRYAGAIN;
+		}
+		SPDLOG_LOGGER_DEBUG(logger(), "Found!");
+		return nss_status::NSS_STATUS_SUCCESS;
+	case Error::NotFound:
+		SPDLOG_LOGGER_DEBUG(logger(), "Not Found");
+		return nss_status::NSS_STATUS_NOTFOUND;
+	default:
+		SPDLOG_LOGGER_ERROR(logger(), "The daemon answered with error {}", response->getErrcode());
+		return nss_status::NSS_STATUS_UNAVAIL;
+	}
+}
+
+nss_status _nss_gitlab_getgrnam_r(const char* name, group* result_buf, char* buf, size_t buflen, int* errnop) {
+	SPDLOG_LOGGER_DEBUG(logger(), "getgrnam_r({})", name);
+	if (auto status = groupFromTable(std::string_view{name}, result_buf, buf, buflen, errnop))
+		return *status;
+	auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getGroupByNameRequest();
+		request.setName(name);
+		return request.send();
+	});
+	if (!response)
+		return NSS_STATUS_UNAVAIL;
 
-	auto user = promise.getGroup();
-	switch (static_cast<Error>(promise.getErrcode())) {
+	auto group = response->getGroup();
+	switch (static_cast<Error>(response->getErrcode())) {
 	case Error::Ok:
-		populateGroup(*result_buf, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
-		*result = result_buf;
+		if (!populateGroup(*result_buf, group, {buf, buflen})) {
+			*errnop = ERANGE;
+			return nss_status::NSS_STATUS_TRYAGAIN;
+		}
+		SPDLOG_LOGGER_DEBUG(logger(), "Found!");
 		return nss_status::NSS_STATUS_SUCCESS;
 	case Error::NotFound:
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
-		*result = nullptr;
+		SPDLOG_LOGGER_DEBUG(logger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
 	default:
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
-		*result = nullptr;
+		SPDLOG_LOGGER_ERROR(logger(), "The daemon answered with error {}", response->getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
 
-nss_status _nss_gitlab_getgrnam_r(const char* name, group* result_buf, char* buf, size_t buflen, group** result) {
-	SPDLOG_LOGGER_INFO(logger, "getgrnam_r({})", name);
-	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+nss_status _nss_gitlab_setgrent() {
+	SPDLOG_LOGGER_DEBUG(logger(), "setgrent()");
+	std::lock_guard lock(groupEnumeration.mutex);
+	groupEnumeration.reset();
+	return nss_status::NSS_STATUS_SUCCESS;
+}
 
-	if (!daemon)
-		return NSS_STATUS_UNAVAIL;
+nss_status _nss_gitlab_getgrent_r(group* result_buf, char* buf, size_t buflen, int* errnop) {
+	SPDLOG_LOGGER_DEBUG(logger(), "getgrent_r()");
+	std::lock_guard lock(groupEnumeration.mutex);
+	auto status = nextBatch<GitLabDaemon::ListGroupsResults>(
+			groupEnumeration,
+			[](GitLabDaemon::Client& daemon, unsigned cursor, unsigned count) {
+				auto request = daemon.listGroupsRequest();
+				request.setCursor(cursor);
+				request.setCount(count);
+				return request.send();
+			}
+	);
+	if (status != nss_status::NSS_STATUS_SUCCESS)
+		return status;
+	auto batch = groupEnumeration.batch->getRoot<GitLabDaemon::ListGroupsResults>().asReader();
+	if (!populateGroup(*result_buf, batch.getGroups()[groupEnumeration.index], {buf, buflen})) {
+		// The caller retries the same entry with a larger buffer
+		*errnop = ERANGE;
+		return nss_status::NSS_STATUS_TRYAGAIN;
+	}
+	++groupEnumeration.index;
+	return nss_status::NSS_STATUS_SUCCESS;
+}
 
-	auto request = daemon->getGroupByNameRequest();
-	request.setName(name);
-	auto promise = request.send().wait(waitScope);
+nss_status _nss_gitlab_endgrent() {
+	SPDLOG_LOGGER_DEBUG(logger(), "endgrent()");
+	std::lock_guard lock(groupEnumeration.mutex);
+	groupEnumeration.reset();
+	return nss_status::NSS_STATUS_SUCCESS;
+}
+
+/**
+ * @brief Appends the supplementary groups of user to *groupsp, growing it up to limit (if positive) as needed.
+ * @details Answered by a single request instead of glibc enumerating all groups.
+ */
+nss_status _nss_gitlab_initgroups_dyn(
+		const char* user, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop
+) {
+	SPDLOG_LOGGER_DEBUG(logger(), "initgroups_dyn({})", user);
+	auto response = callDaemon([&](GitLabDaemon::Client& daemon) {
+		auto request = daemon.getGroupIDsRequest();
+		request.setName(user);
+		return request.send();
+	});
+	if (!response)
+		return NSS_STATUS_UNAVAIL;
 
-	auto user = promise.getGroup();
-	switch (static_cast<Error>(promise.getErrcode())) {
+	switch (static_cast<Error>(response->getErrcode())) {
 	case Error::Ok:
-		populateGroup(*result_buf, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
-		*result = result_buf;
-		return nss_status::NSS_STATUS_SUCCESS;
+		break;
 	case Error::NotFound:
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
-		*result = nullptr;
+		SPDLOG_LOGGER_DEBUG(logger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
 	default:
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
-		*result = nullptr;
+		SPDLOG_LOGGER_ERROR(logger(), "The daemon answered with error {}", response->getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
+
+	for (gid_t gid : response->getGids()) {
+		// The group passed in is already part of the list and other modules may have added ours before
+		if (gid == group || std::find(*groupsp, *groupsp + *start, gid) != *groupsp + *start)
+			continue;
+		if (*start == *size) {
+			if (limit > 0 && *size >= limit)
+				break;
+			auto grown = std::max(2 * *size, 8L);
+			if (limit > 0)
+				grown = std::min(grown, limit);
+			auto* groups = static_cast<gid_t*>(realloc(*groupsp, grown * sizeof(gid_t)));
+			if (!groups) {
+				*errnop = ENOMEM;
+				return nss_status::NSS_STATUS_TRYAGAIN;
+			}
+			*groupsp = groups;
+			*size = grown;
+		}
+		(*groupsp)[(*start)++] = gid;
+	}
+	SPDLOG_LOGGER_DEBUG(logger(), "Found!");
+	return nss_status::NSS_STATUS_SUCCESS;
+}
 }
-}
\ No newline at end of file
+#pragma GCC visibility pop
\ No newline at end of file
@@ -0,0 +1,269 @@
+#include <scheduler.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <string_view>
+
+using gitlab::Priority;
+using gitlab::Response;
+using gitlab::Scheduler;
+using gitlab::Urgency;
+
+/** The backoff after a 429 without Retry-After doubles from MinBackoff up to MaxBackoff **/
+static constexpr kj::Duration MinBackoff = 1 * kj::SECONDS;
+static constexpr kj::Duration MaxBackoff = 60 * kj::SECONDS;
+
+static std::optional<int64_t> header(const Response& response, const char* name) {
+	auto it = response.headers.find(name);
+	if (it == response.headers.end())
+		return std::nullopt;
+	int64_t value;
+	auto [end, error] = std::from_chars(it->second.data(), it->second.data() + it->second.size(), value);
+	if (error != std::errc{} || end == it->second.data())
+		return std::nullopt;
+	return value;
+}
+
+/**
+ * @return the path of url with IDs replaced, e.g. /users/:id/keys for https://host/api/v4/users/42/keys?page=2; a
+ * username in place of a user's ID is replaced as well
+ */
+static std::string endpointOf(std::string_view url) {
+	if (auto scheme = url.find("://"); scheme != std::string_view::npos)
+		url.remove_prefix(scheme + 3);
+	url = url.substr(std::min(url.find('/'), url.size()));
+	url = url.substr(0, url.find('?'));
+	if (auto api = url.find("/api/"); api != std::string_view::npos)
+		url.remove_prefix(api + 4);
+	if (url.starts_with("/v4/"))
+		url.remove_prefix(3);
+	std::string endpoint;
+	while (url.starts_with('/')) {
+		url.remove_prefix(1);
+		auto segment = url.substr(0, url.find('/'));
+		url.remove_prefix(segment.size());
+		bool id = !segment.empty() && (std::ranges::all_of(segment, [](char c) { return c >= '0' && c <= '9'; }) ||
+									   endpoint == "/users");
+		endpoint += '/';
+		endpoint += id ? std::string_view{":id"} : segment;
+	}
+	return endpoint;
+}
+
+static kj::Duration toDuration(double seconds) {
+	return static_cast<int64_t>(seconds * 1e9) * kj::NANOSECONDS;
+}
+
+Scheduler::Scheduler(const Config& config, HttpClient& http, kj::Timer& timer)
+		: config(config), http(http), timer(timer), tokens(std::max(config.gitlabapi.rateBurst, 1u)),
+		  refilled(timer.now()), pausedUntil(timer.now()), backoff(MinBackoff), tasks(*this) {}
+
+/** @return the current rate in requests per second; infinite if requests are not paced **/
+double Scheduler::rate() const noexcept {
+	double configured = config.gitlabapi.rateLimit > 0 ? config.gitlabapi.rateLimit / 60.0
+													   : std::numeric_limits<double>::infinity();
+	return quotaRate ? std::min(configured, *quotaRate) : configured;
+}
+
+void Scheduler::refill(kj::TimePoint now) {
+	double burst = std::max(config.gitlabapi.rateBurst, 1u);
+	auto elapsed = static_cast<double>((now - refilled) / kj::NANOSECONDS) / 1e9;
+	auto perSecond = rate();
+	tokens = std::isinf(perSecond) ? burst : std::min(burst, tokens + elapsed * perSecond);
+	refilled = now;
+}
+
+/** Makes sure that pump() is called again at the given time **/
+void Scheduler::wakeup(kj::TimePoint at) {
+	if (wakeupAt && *wakeupAt <= at)
+		return;
+	wakeupAt = at;
+	tasks.add(timer.atTime(at).then([this, at]() {
+		if (wakeupAt == at)
+			wakeupAt.reset();
+		pump();
+	}));
+}
+
+/** Moves the background requests that were raised to interactive over to the interactive queue **/
+void Scheduler::regroup() {
+	if (!raised)
+		return;
+	raised = false;
+	auto& interactive = queues[static_cast<std::size_t>(Priority::Interactive)];
+	auto& background = queues[static_cast<std::size_t>(Priority::Background)];
+	std::deque<std::shared_ptr<Request>> remaining;
+	for (auto& request : background)
+		(request->urgency.get() == Priority::Interactive ? interactive : remaining).push_back(std::move(request));
+	background = std::move(remaining);
+}
+
+void Scheduler::pump() {
+	auto now = timer.now();
+	if (now < pausedUntil) {
+		wakeup(pausedUntil);
+		return;
+	}
+	refill(now);
+	regroup();
+	for (auto& queue : queues) {
+		while (!queue.empty() && tokens >= 1) {
+			auto request = std::move(queue.front());
+			queue.pop_front();
+			request->queued = false;
+			// Nobody waits for the response anymore
+			if (!request->fulfiller->isWaiting())
+				continue;
+			tokens -= 1;
+			send(std::move(request));
+		}
+	}
+	// Waits for the next token; the rate is never 0 outside of a pause
+	if (std::ranges::any_of(queues, [](const auto& queue) { return !queue.empty(); }))
+		wakeup(now + std::max(toDuration((1 - tokens) / rate()), 1 * kj::MILLISECONDS));
+}
+
+void Scheduler::send(std::shared_ptr<Request> request) {
+	++counters.sent;
+	++counters.inFlight;
+	++request->attempts;
+	auto sent = request->body ? http.post(request->url, request->bearer, *request->body)
+							  : http.get(request->url, request->bearer);
+	tasks.add(sent.then(
+			[this, request, started = std::chrono::steady_clock::now()](Response&& response) {
+				record(request->url, response.status, started);
+				adapt(response, timer.now());
+				if (response.status == 429 && request->attempts < config.gitlabapi.maxAttempts) {
+					++counters.retries;
+					push(request, true);
+				} else {
+					request->fulfiller->fulfill(kj::mv(response));
+				}
+				pump();
+			},
+			[this, request, started = std::chrono::steady_clock::now()](kj::Exception&& exception) {
+				record(request->url, 0, started);
+				request->fulfiller->reject(kj::mv(exception));
+				pump();
+			}
+	));
+}
+
+/**
+ * @brief Adapts the pace to what GitLab tells about its rate limit.
+ */
+void Scheduler::adapt(const Response& response, kj::TimePoint now) {
+	if (response.status == 429) {
+		++counters.rateLimited;
+		auto retryAfter = header(response, "retry-after");
+		auto pause = retryAfter ? *retryAfter * kj::SECONDS : backoff;
+		backoff = std::min(backoff * 2, MaxBackoff);
+		if (now + pause > pausedUntil) {
+			spdlog::warn("GitLab's rate limit was hit; pausing requests for {} s", pause / kj::SECONDS);
+			pausedUntil = now + pause;
+		}
+		return;
+	}
+	if (response.status != 0 && response.status < 400)
+		backoff = MinBackoff;
+	// RateLimit-Reset is the time in seconds since the epoch at which the quota is replenished
+	auto remaining = header(response, "ratelimit-remaining");
+	auto reset = header(response, "ratelimit-reset");
+	if (!remaining || !reset) {
+		quotaRate.reset();
+		return;
+	}
+	auto epoch = std::chrono::system_clock::now().time_since_epoch();
+	auto untilReset = *reset - std::chrono::duration_cast<std::chrono::seconds>(epoch).count();
+	if (untilReset <= 0) {
+		quotaRate.reset();
+		return;
+	}
+	if (*remaining > 0) {
+		quotaRate = static_cast<double>(*remaining) / untilReset;
+		return;
+	}
+	// The quota is replenished once the pause is over
+	quotaRate.reset();
+	if (now + untilReset * kj::SECONDS > pausedUntil) {
+		spdlog::warn("GitLab's rate limit is exhausted; pausing requests for {} s", untilReset);
+		pausedUntil = now + untilReset * kj::SECONDS;
+	}
+}
+
+void Scheduler::record(const std::string& url, long status, std::chrono::steady_clock::time_point sent) {
+	--counters.inFlight;
+	auto& endpoint = endpoints.try_emplace(endpointOf(url)).first->second;
+	endpoint.latency.observe(std::chrono::steady_clock::now() - sent);
+	++endpoint.statuses[status];
+}
+
+void Scheduler::taskFailed(kj::Exception&& exception) {
+	spdlog::error("Scheduling a request to GitLab failed: {}", exception.getDescription().cStr());
+}
+
+void Scheduler::push(std::shared_ptr<Request> request, bool front) {
+	request->queued = true;
+	auto& queue = queues[static_cast<std::size_t>(request->urgency.get())];
+	if (front)
+		queue.push_front(std::move(request));
+	else
+		queue.push_back(std::move(request));
+}
+
+kj::Promise<Response> Scheduler::enqueue(Request&& request) {
+	auto [promise, fulfiller] = kj::newPromiseAndFulfiller<Response>();
+	request.fulfiller = kj::mv(fulfiller);
+	auto queued = std::make_shared<Request>(std::move(request));
+	bool bounded = queued->urgency.get() == Priority::Interactive && config.gitlabapi.queueTimeout > 0;
+	push(queued, false);
+	pump();
+	if (!bounded)
+		return kj::mv(promise);
+	// Whichever comes first; the request is withdrawn if the timeout wins
+	auto timeout = timer.afterDelay(config.gitlabapi.queueTimeout * kj::SECONDS)
+						   .then([this, request = std::weak_ptr{queued}]() -> kj::Promise<Response> {
+							   auto waiting = request.lock();
+							   // Once sent, the request is bounded by the HTTP client's timeouts instead
+							   if (!waiting || !waiting->queued)
+								   return kj::NEVER_DONE;
+							   ++counters.expired;
+							   return Response{.status = 429};
+						   });
+	return promise.exclusiveJoin(kj::mv(timeout));
+}
+
+kj::Promise<Response> Scheduler::get(std::string url, std::string bearer, Urgency urgency) {
+	return enqueue(Request{
+			.url = std::move(url), .bearer = std::move(bearer), .urgency = std::move(urgency), .attempts = 0
+	});
+}
+
+kj::Promise<Response> Scheduler::post(std::string url, std::string bearer, std::string body, Urgency urgency) {
+	return enqueue(Request{
+			.url = std::move(url),
+			.bearer = std::move(bearer),
+			.body = std::move(body),
+			.urgency = std::move(urgency),
+			.attempts = 0
+	});
+}
+
+void Scheduler::raise(const Urgency& urgency, Priority priority) {
+	if (priority >= *urgency.priority)
+		return;
+	*urgency.priority = priority;
+	raised = true;
+	pump();
+}
+
+Scheduler::Stats Scheduler::stats() const noexcept {
+	auto stats = counters;
+	stats.queued = queues[0].size() + queues[1].size();
+	return stats;
+}
\ No newline at end of file
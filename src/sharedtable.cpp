@@ -0,0 +1,362 @@
+#include <sharedtable.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+using sharedtable::Group;
+using sharedtable::GroupEntry;
+using sharedtable::Header;
+using sharedtable::Lookup;
+using sharedtable::Table;
+using sharedtable::User;
+using sharedtable::UserEntry;
+using sharedtable::Writer;
+
+/** How long to wait before trying to map a table again after there was none **/
+static constexpr std::chrono::seconds RetryInterval{1};
+static constexpr uint32_t NoEntry = UINT32_MAX;
+
+static uint64_t hashID(uint32_t id) noexcept {
+	// splitmix64
+	uint64_t x = id + 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+static uint64_t hashName(std::string_view name) noexcept {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (unsigned char c : name)
+		hash = (hash ^ c) * 0x100000001b3ull;
+	return hash;
+}
+
+/**
+ * @brief Searches an open addressing index whose buckets hold entry index + 1 or 0 if empty.
+ * @return the index of the first entry for which matches() holds or NoEntry
+ */
+template <typename F>
+static uint32_t probe(const uint32_t* buckets, uint32_t count, uint64_t hash, F&& matches) noexcept {
+	for (auto i = static_cast<uint32_t>(hash) & (count - 1);; i = (i + 1) & (count - 1)) {
+		if (buckets[i] == 0)
+			return NoEntry;
+		if (matches(buckets[i] - 1))
+			return buckets[i] - 1;
+	}
+}
+
+static void insert(std::vector<uint32_t>& buckets, uint64_t hash, uint32_t index) {
+	auto mask = static_cast<uint32_t>(buckets.size() - 1);
+	auto i = static_cast<uint32_t>(hash) & mask;
+	while (buckets[i] != 0)
+		i = (i + 1) & mask;
+	buckets[i] = index + 1;
+}
+
+/** Whether a section of the given size at offset lies within a table of size bytes after the header **/
+static bool within(uint64_t offset, uint64_t bytes, uint64_t size) noexcept {
+	return offset >= sizeof(Header) && offset % 8 == 0 && offset <= size && bytes <= size - offset;
+}
+
+/** An index must have an empty bucket for every probe to end **/
+static bool validIndex(uint32_t buckets, uint32_t count) noexcept {
+	return std::has_single_bit(buckets) && buckets > count;
+}
+
+/**
+ * @brief Checks that the sections the header describes lie within the mapping, such that a truncated or corrupt table
+ * is rejected instead of being read out of bounds.
+ */
+static bool validLayout(const Header& header, const std::byte* data, uint64_t size) noexcept {
+	return validIndex(header.userBuckets, header.userCount) && validIndex(header.groupBuckets, header.groupCount) &&
+		   within(header.users, uint64_t{header.userCount} * sizeof(UserEntry), size) &&
+		   within(header.groups, uint64_t{header.groupCount} * sizeof(GroupEntry), size) &&
+		   within(header.userByID, uint64_t{header.userBuckets} * sizeof(uint32_t), size) &&
+		   within(header.userByName, uint64_t{header.userBuckets} * sizeof(uint32_t), size) &&
+		   within(header.groupByID, uint64_t{header.groupBuckets} * sizeof(uint32_t), size) &&
+		   within(header.groupByName, uint64_t{header.groupBuckets} * sizeof(uint32_t), size) &&
+		   within(header.members, 0, header.strings) && within(header.strings, 0, size) &&
+		   // The strings section is last, so its final string is terminated if the file is
+		   (header.strings == size || data[size - 1] == std::byte{0});
+}
+
+Table::~Table() { munmap(const_cast<std::byte*>(data), size); }
+
+std::shared_ptr<const Table> Table::open(const std::filesystem::path& path) {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+	struct stat stat;
+	// Anybody else could have planted the file
+	if (fstat(fd, &stat) != 0 || stat.st_uid != 0 || (stat.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+		static_cast<std::size_t>(stat.st_size) < sizeof(Header)) {
+		close(fd);
+		return nullptr;
+	}
+	void* data = mmap(nullptr, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+	std::shared_ptr<const Table> table{new Table(static_cast<const std::byte*>(data), stat.st_size)};
+	const auto& header = table->header();
+	if (header.magic != Header::Magic || header.version != Header::Version || header.size != table->size ||
+		!validLayout(header, table->data, table->size))
+		return nullptr;
+	return table;
+}
+
+bool Table::stale() const noexcept {
+	// The mapping is read-only but loading through an atomic_ref does not write
+	auto& retired = const_cast<uint32_t&>(header().retired);
+	return std::atomic_ref<uint32_t>(retired).load(std::memory_order_acquire) != 0 ||
+		   std::time(nullptr) >= header().expires;
+}
+
+User Table::user(uint32_t index) const noexcept {
+	const auto& entry = section<UserEntry>(header().users)[index];
+	return User{
+			.id = entry.id,
+			.group = entry.group != UserEntry::NoGroup ? std::optional<uint32_t>{entry.group} : std::nullopt,
+			.username = string(entry.username),
+			.name = string(entry.name)
+	};
+}
+
+Group Table::group(uint32_t index) const noexcept {
+	const auto& entry = section<GroupEntry>(header().groups)[index];
+	return Group{
+			.id = entry.id,
+			.name = string(entry.name),
+			.members = {section<uint32_t>(header().members) + entry.members, entry.memberCount},
+			.strings = string(0)
+	};
+}
+
+Lookup Table::missing() const noexcept {
+	return (header().flags & Header::Complete) != 0 ? Lookup::NotFound : Lookup::Unknown;
+}
+
+Lookup Table::findUser(uint32_t id, User& user) const noexcept {
+	const auto* users = section<UserEntry>(header().users);
+	auto index = probe(
+			section<uint32_t>(header().userByID), header().userBuckets, hashID(id),
+			[users, id](uint32_t i) { return users[i].id == id; }
+	);
+	if (index == NoEntry)
+		return missing();
+	user = this->user(index);
+	return Lookup::Found;
+}
+
+Lookup Table::findUser(std::string_view username, User& user) const noexcept {
+	const auto* users = section<UserEntry>(header().users);
+	auto index = probe(
+			section<uint32_t>(header().userByName), header().userBuckets, hashName(username),
+			[this, users, username](uint32_t i) { return string(users[i].username) == username; }
+	);
+	if (index == NoEntry)
+		return missing();
+	user = this->user(index);
+	return Lookup::Found;
+}
+
+Lookup Table::findGroup(uint32_t id, Group& group) const noexcept {
+	const auto* groups = section<GroupEntry>(header().groups);
+	auto index = probe(
+			section<uint32_t>(header().groupByID), header().groupBuckets, hashID(id),
+			[groups, id](uint32_t i) { return groups[i].id == id; }
+	);
+	if (index == NoEntry)
+		return missing();
+	// Without the members, the daemon has to be asked
+	if (groups[index].members == GroupEntry::UnknownMembers)
+		return Lookup::Unknown;
+	group = this->group(index);
+	return Lookup::Found;
+}
+
+Lookup Table::findGroup(std::string_view name, Group& group) const noexcept {
+	const auto* groups = section<GroupEntry>(header().groups);
+	auto index = probe(
+			section<uint32_t>(header().groupByName), header().groupBuckets, hashName(name),
+			[this, groups, name](uint32_t i) { return string(groups[i].name) == name; }
+	);
+	if (index == NoEntry)
+		return missing();
+	if (groups[index].members == GroupEntry::UnknownMembers)
+		return Lookup::Unknown;
+	group = this->group(index);
+	return Lookup::Found;
+}
+
+std::shared_ptr<const Table> sharedtable::current(const std::filesystem::path& path) {
+	thread_local std::shared_ptr<const Table> local;
+	if (local && !local->stale())
+		return local;
+	static std::mutex mutex;
+	static std::shared_ptr<const Table> shared;
+	static std::chrono::steady_clock::time_point nextAttempt;
+	std::lock_guard lock(mutex);
+	if (!shared || shared->stale()) {
+		shared = nullptr;
+		auto now = std::chrono::steady_clock::now();
+		if (now >= nextAttempt) {
+			shared = Table::open(path);
+			if (!shared || shared->stale()) {
+				shared = nullptr;
+				nextAttempt = now + RetryInterval;
+			}
+		}
+	}
+	local = shared;
+	return local;
+}
+
+Writer::Writer(std::filesystem::path path) noexcept : path(std::move(path)) {}
+
+Writer::~Writer() {
+	// Removed first such that readers that notice the retirement fall back to the daemon
+	unlink(path.c_str());
+	retire();
+}
+
+void Writer::retire() noexcept {
+	if (!published)
+		return;
+	std::atomic_ref<uint32_t>(reinterpret_cast<Header*>(published)->retired).store(1, std::memory_order_release);
+	munmap(published, publishedSize);
+	published = nullptr;
+}
+
+bool Writer::publish(
+		std::span<const UserRecord> users, std::span<const GroupRecord> groups, bool complete, int64_t expires
+) {
+	std::string strings;
+	auto intern = [&strings](std::string_view string) {
+		auto offset = static_cast<uint32_t>(strings.size());
+		strings.append(string);
+		strings.push_back('\0');
+		return offset;
+	};
+	auto userBuckets = std::bit_ceil(2 * users.size() + 1);
+	auto groupBuckets = std::bit_ceil(2 * groups.size() + 1);
+	auto interned = [&strings](uint32_t offset) { return std::string_view{strings.c_str() + offset}; };
+	// Lookups only ever find the first of several entries with the same ID or name, so later ones are left out (e.g. a
+	// user that GitLab listed twice as they were renamed while being listed)
+	std::vector<UserEntry> userEntries;
+	std::vector<uint32_t> userByID(userBuckets), userByName(userBuckets);
+	for (const auto& user : users) {
+		auto sameID = [&](uint32_t i) { return userEntries[i].id == user.id; };
+		auto sameName = [&](uint32_t i) { return interned(userEntries[i].username) == user.username; };
+		if (probe(userByID.data(), userBuckets, hashID(user.id), sameID) != NoEntry ||
+			probe(userByName.data(), userBuckets, hashName(user.username), sameName) != NoEntry)
+			continue;
+		insert(userByID, hashID(user.id), userEntries.size());
+		insert(userByName, hashName(user.username), userEntries.size());
+		userEntries.push_back(UserEntry{
+				.id = user.id,
+				.group = user.group.value_or(UserEntry::NoGroup),
+				.username = intern(user.username),
+				.name = intern(user.name)
+		});
+	}
+	std::vector<GroupEntry> groupEntries;
+	std::vector<uint32_t> groupByID(groupBuckets), groupByName(groupBuckets), members;
+	for (const auto& group : groups) {
+		auto sameID = [&](uint32_t i) { return groupEntries[i].id == group.id; };
+		auto sameName = [&](uint32_t i) { return interned(groupEntries[i].name) == group.name; };
+		if (probe(groupByID.data(), groupBuckets, hashID(group.id), sameID) != NoEntry ||
+			probe(groupByName.data(), groupBuckets, hashName(group.name), sameName) != NoEntry)
+			continue;
+		insert(groupByID, hashID(group.id), groupEntries.size());
+		insert(groupByName, hashName(group.name), groupEntries.size());
+		GroupEntry entry{.id = group.id, .name = intern(group.name), .members = GroupEntry::UnknownMembers};
+		if (group.members) {
+			entry.members = members.size();
+			entry.memberCount = group.members->size();
+			for (const auto& member : *group.members)
+				members.push_back(intern(member));
+		}
+		groupEntries.push_back(entry);
+	}
+
+	// Lay out the sections, each aligned to 8 bytes
+	std::size_t size = sizeof(Header);
+	auto place = [&size](std::size_t bytes) {
+		auto offset = size;
+		size = (size + bytes + 7) & ~std::size_t{7};
+		return offset;
+	};
+	Header header{
+			.magic = Header::Magic,
+			.version = Header::Version,
+			.retired = 0,
+			.flags = complete ? Header::Complete : 0,
+			.expires = expires,
+			.userCount = static_cast<uint32_t>(userEntries.size()),
+			.groupCount = static_cast<uint32_t>(groupEntries.size()),
+			.userBuckets = static_cast<uint32_t>(userBuckets),
+			.groupBuckets = static_cast<uint32_t>(groupBuckets),
+			.users = place(userEntries.size() * sizeof(UserEntry)),
+			.groups = place(groupEntries.size() * sizeof(GroupEntry)),
+			.userByID = place(userByID.size() * sizeof(uint32_t)),
+			.userByName = place(userByName.size() * sizeof(uint32_t)),
+			.groupByID = place(groupByID.size() * sizeof(uint32_t)),
+			.groupByName = place(groupByName.size() * sizeof(uint32_t)),
+			.members = place(members.size() * sizeof(uint32_t)),
+			.strings = place(strings.size()),
+	};
+	header.size = size;
+
+	// Written to a fresh file (never through a planted symlink) that then atomically replaces the published one
+	auto temporary = path;
+	temporary += ".new";
+	unlink(temporary.c_str());
+	int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	if (fchmod(fd, 0644) != 0 || ftruncate(fd, size) != 0) {
+		close(fd);
+		unlink(temporary.c_str());
+		return false;
+	}
+	void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		unlink(temporary.c_str());
+		return false;
+	}
+	auto* data = static_cast<std::byte*>(mapped);
+	auto copy = [data](uint64_t offset, const auto& section) {
+		if (!section.empty())
+			std::memcpy(data + offset, section.data(), section.size() * sizeof(section[0]));
+	};
+	std::memcpy(data, &header, sizeof(header));
+	copy(header.users, userEntries);
+	copy(header.groups, groupEntries);
+	copy(header.userByID, userByID);
+	copy(header.userByName, userByName);
+	copy(header.groupByID, groupByID);
+	copy(header.groupByName, groupByName);
+	copy(header.members, members);
+	copy(header.strings, strings);
+	if (rename(temporary.c_str(), path.c_str()) != 0) {
+		munmap(mapped, size);
+		unlink(temporary.c_str());
+		return false;
+	}
+	retire();
+	published = data;
+	publishedSize = size;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include <sshkeys.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace {
+	constexpr std::string_view Base64Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	constexpr std::string_view Prefix = "SHA256:";
+	/** The length of the unpadded base64 of a SHA-256 hash **/
+	constexpr std::size_t EncodedHashLength = 43;
+
+	/** @return the value of a base64 digit or -1 if c is none **/
+	int base64Digit(char c) noexcept {
+		auto pos = Base64Alphabet.find(c);
+		return pos == std::string_view::npos ? -1 : static_cast<int>(pos);
+	}
+
+	/** @return the decoded bytes or std::nullopt if text is not (padded or unpadded) base64 **/
+	std::optional<std::vector<uint8_t>> decodeBase64(std::string_view text) {
+		while (text.ends_with('='))
+			text.remove_suffix(1);
+		std::vector<uint8_t> bytes;
+		bytes.reserve(text.size() * 3 / 4);
+		uint32_t buffer = 0;
+		unsigned bits = 0;
+		for (char c : text) {
+			int digit = base64Digit(c);
+			if (digit < 0)
+				return std::nullopt;
+			buffer = (buffer << 6) | static_cast<uint32_t>(digit);
+			bits += 6;
+			if (bits >= 8) {
+				bits -= 8;
+				bytes.push_back(static_cast<uint8_t>(buffer >> bits));
+			}
+		}
+		return bytes;
+	}
+
+	std::string encodeBase64Unpadded(const uint8_t* data, std::size_t size) {
+		std::string text;
+		text.reserve((size * 4 + 2) / 3);
+		uint32_t buffer = 0;
+		unsigned bits = 0;
+		for (std::size_t i = 0; i < size; ++i) {
+			buffer = (buffer << 8) | data[i];
+			bits += 8;
+			while (bits >= 6) {
+				bits -= 6;
+				text += Base64Alphabet[(buffer >> bits) & 0x3f];
+			}
+		}
+		if (bits > 0)
+			text += Base64Alphabet[(buffer << (6 - bits)) & 0x3f];
+		return text;
+	}
+
+	/** SHA-256 as specified in FIPS 180-4 **/
+	std::array<uint8_t, 32> sha256(const std::vector<uint8_t>& message) {
+		static constexpr std::array<uint32_t, 64> K{
+				0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+				0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+				0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+				0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+				0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+				0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+				0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+				0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+		};
+		std::array<uint32_t, 8> state{
+				0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+		// Padded with a one bit, zeros and the length in bits to a multiple of 64 bytes
+		auto padded = message;
+		padded.push_back(0x80);
+		while (padded.size() % 64 != 56)
+			padded.push_back(0);
+		uint64_t length = static_cast<uint64_t>(message.size()) * 8;
+		for (int shift = 56; shift >= 0; shift -= 8)
+			padded.push_back(static_cast<uint8_t>(length >> shift));
+
+		for (std::size_t block = 0; block < padded.size(); block += 64) {
+			std::array<uint32_t, 64> w;
+			for (int i = 0; i < 16; ++i)
+				w[i] = (uint32_t{padded[block + 4 * i]} << 24) | (uint32_t{padded[block + 4 * i + 1]} << 16) |
+					   (uint32_t{padded[block + 4 * i + 2]} << 8) | uint32_t{padded[block + 4 * i + 3]};
+			for (int i = 16; i < 64; ++i) {
+				auto s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				auto s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+			auto [a, b, c, d, e, f, g, h] = state;
+			for (int i = 0; i < 64; ++i) {
+				auto s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+				auto choice = (e & f) ^ (~e & g);
+				auto t1 = h + s1 + choice + K[i] + w[i];
+				auto s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+				auto majority = (a & b) ^ (a & c) ^ (b & c);
+				auto t2 = s0 + majority;
+				h = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			std::array<uint32_t, 8> add{a, b, c, d, e, f, g, h};
+			for (int i = 0; i < 8; ++i)
+				state[i] += add[i];
+		}
+		std::array<uint8_t, 32> digest;
+		for (int i = 0; i < 8; ++i)
+			for (int j = 0; j < 4; ++j)
+				digest[4 * i + j] = static_cast<uint8_t>(state[i] >> (24 - 8 * j));
+		return digest;
+	}
+} // namespace
+
+std::optional<std::string> sshkeys::fingerprint(std::string_view key) {
+	// The key type, then the base64 encoded key and optionally a comment, separated by spaces
+	auto start = key.find(' ');
+	if (start == std::string_view::npos)
+		return std::nullopt;
+	auto encoded = key.substr(start + 1);
+	encoded = encoded.substr(0, encoded.find(' '));
+	auto decoded = decodeBase64(encoded);
+	if (!decoded || decoded->empty())
+		return std::nullopt;
+	auto digest = sha256(*decoded);
+	return std::string{Prefix} + encodeBase64Unpadded(digest.data(), digest.size());
+}
+
+bool sshkeys::isFingerprint(std::string_view fingerprint) noexcept {
+	if (!fingerprint.starts_with(Prefix))
+		return false;
+	fingerprint.remove_prefix(Prefix.size());
+	return fingerprint.size() == EncodedHashLength &&
+		   std::ranges::all_of(fingerprint, [](char c) { return base64Digit(c) >= 0; });
+}
\ No newline at end of file